@@ -0,0 +1,235 @@
+#!/usr/bin/env python3
+"""Repeated, statistically summarised MiniWeather runs with JSON output.
+
+Every variant is run ``--warmup`` times (discarded) and ``--reps`` times
+(measured) for every grid size. Grid size and step count are compile-time,
+so the binaries are rebuilt per grid unless ``--no-build`` is given. The
+METRICS ``TIME=`` of each measured run is summarised as min / median / p95 /
+mean with a 95% confidence interval of the mean (Student t), and the whole
+campaign, including build commands, host, rank and thread counts, is written
+as JSON that ``scripts/plot_scaling.py --bench`` plots directly.
+
+Variants are ``LABEL:BINARY[@RANKSxTHREADS] [ARGS...]``, e.g.::
+
+    scripts/bench.py --grid 256x128x128 --steps 50 --warmup 2 --reps 10 \\
+        --variant "serial:miniweather_serial" \\
+        --variant "omp:miniweather_openmp@1x4 --tile-y=8 --tile-z=64" \\
+        --variant "mpi4:miniweather_mpi@4x1 --decomp=2 --halo=shm" \\
+        -o results/bench/bench.json
+"""
+from __future__ import annotations
+
+import argparse
+import datetime as dt
+import json
+import math
+import os
+import platform
+import re
+import shlex
+import statistics
+import subprocess
+import sys
+from pathlib import Path
+
+ROOT = Path(__file__).resolve().parents[1]
+SRC_DIR = ROOT / "src"
+SCHEMA = "miniweather-bench/1"
+
+# Two-sided 95% Student t quantiles by degrees of freedom; 1.96 beyond 30.
+T975 = [12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042]
+
+MPI_BINARIES = ("miniweather_mpi", "miniweather_hybrid", "miniweather_fields")
+
+
+def parse_variant(spec: str) -> dict:
+    tokens = shlex.split(spec)
+    head = tokens[0]
+    label, _, binary = head.partition(":")
+    if not binary:
+        raise argparse.ArgumentTypeError(f"variant '{spec}' is not LABEL:BINARY[@RxT]")
+    ranks, threads = 1, 1
+    if "@" in binary:
+        binary, _, layout = binary.partition("@")
+        m = re.fullmatch(r"(\d+)x(\d+)", layout)
+        if not m:
+            raise argparse.ArgumentTypeError(f"bad layout '{layout}' in '{spec}' (want RxT)")
+        ranks, threads = int(m.group(1)), int(m.group(2))
+    return {"label": label, "binary": binary, "args": tokens[1:],
+            "ranks": ranks, "threads": threads}
+
+
+def parse_grid(text: str) -> tuple[int, int, int]:
+    m = re.fullmatch(r"(\d+)x(\d+)x(\d+)", text)
+    if not m:
+        raise argparse.ArgumentTypeError(f"grid '{text}' is not NXxNYxNZ")
+    return tuple(int(v) for v in m.groups())
+
+
+def parse_metrics(output: str) -> dict | None:
+    for line in output.splitlines():
+        if line.startswith("METRICS:"):
+            return dict(re.findall(r"(\w+)=(\S+)", line))
+    return None
+
+
+def percentile(values: list[float], q: float) -> float:
+    """Linear interpolation between closest ranks (numpy's default)."""
+    s = sorted(values)
+    pos = (len(s) - 1) * q
+    lo = math.floor(pos)
+    hi = min(lo + 1, len(s) - 1)
+    return s[lo] + (s[hi] - s[lo]) * (pos - lo)
+
+
+def summarise(times: list[float]) -> dict:
+    n = len(times)
+    mean = statistics.fmean(times)
+    stdev = statistics.stdev(times) if n > 1 else 0.0
+    t = T975[n - 2] if 2 <= n <= len(T975) + 1 else 1.96
+    half = t * stdev / math.sqrt(n) if n > 1 else 0.0
+    return {
+        "n": n,
+        "min": min(times),
+        "median": statistics.median(times),
+        "p95": percentile(times, 0.95),
+        "max": max(times),
+        "mean": mean,
+        "stdev": stdev,
+        "ci95": [mean - half, mean + half],
+    }
+
+
+def host_info() -> dict:
+    cpu_model = platform.processor()
+    try:
+        for line in Path("/proc/cpuinfo").read_text().splitlines():
+            if line.startswith("model name"):
+                cpu_model = line.split(":", 1)[1].strip()
+                break
+    except OSError:
+        pass
+    return {
+        "hostname": platform.node(),
+        "platform": platform.platform(),
+        "cpu_model": cpu_model,
+        "cpus": os.cpu_count(),
+        "slurm_job_id": os.environ.get("SLURM_JOB_ID"),
+    }
+
+
+def git_commit() -> str | None:
+    try:
+        out = subprocess.run(["git", "-C", str(ROOT), "rev-parse", "HEAD"],
+                             capture_output=True, text=True, check=True)
+        return out.stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def build(binaries: list[str], grid, steps: int, make_args: list[str]) -> dict:
+    """Rebuilds the binaries for this grid; returns the link command of each."""
+    nx, ny, nz = grid
+    cmd = ["make", "-C", str(SRC_DIR), "--no-print-directory", "-B",
+           f"NX={nx}", f"NY={ny}", f"NZ={nz}", f"STEPS={steps}", *make_args, *binaries]
+    print(f"Building {' '.join(binaries)} for {nx}x{ny}x{nz}, {steps} steps")
+    out = subprocess.run(cmd, capture_output=True, text=True)
+    if out.returncode != 0:
+        sys.stderr.write(out.stdout + out.stderr)
+        raise SystemExit(f"build failed for grid {nx}x{ny}x{nz}")
+    commands = {}
+    for line in out.stdout.splitlines():
+        for b in binaries:
+            if re.search(rf"-o {re.escape(b)}(\s|$)", line):
+                commands[b] = line.strip()
+    return commands
+
+
+def run_once(variant: dict, launcher: str, timeout: float | None) -> dict:
+    exe = str(SRC_DIR / variant["binary"])
+    cmd = [exe, *variant["args"]]
+    if variant["binary"].startswith(MPI_BINARIES):
+        cmd = shlex.split(launcher.format(ranks=variant["ranks"])) + cmd
+    env = dict(os.environ, OMP_NUM_THREADS=str(variant["threads"]))
+    out = subprocess.run(cmd, capture_output=True, text=True, env=env, timeout=timeout)
+    metrics = parse_metrics(out.stdout)
+    if out.returncode != 0 or metrics is None or "TIME" not in metrics:
+        sys.stderr.write(out.stdout + out.stderr)
+        raise SystemExit(f"run failed: {' '.join(cmd)}")
+    return metrics
+
+
+def main(argv: list[str] | None = None) -> None:
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--variant", action="append", type=parse_variant, required=True,
+                        help="LABEL:BINARY[@RANKSxTHREADS] [ARGS...] (repeatable)")
+    parser.add_argument("--grid", action="append", type=parse_grid,
+                        help="NXxNYxNZ to build and run (repeatable); default: as built")
+    parser.add_argument("--steps", type=int, default=50, help="STEPS for the build")
+    parser.add_argument("--warmup", type=int, default=2, help="discarded runs per variant")
+    parser.add_argument("--reps", type=int, default=10, help="measured runs per variant")
+    parser.add_argument("--launcher", default="mpirun -np {ranks}",
+                        help="command prefix for MPI binaries; {ranks} is substituted")
+    parser.add_argument("--make-arg", action="append", default=[],
+                        help="extra make variable/flag for the build (repeatable)")
+    parser.add_argument("--no-build", action="store_true",
+                        help="run the binaries already in src/ (grid from METRICS)")
+    parser.add_argument("--timeout", type=float, default=None, help="seconds per run")
+    parser.add_argument("-o", "--output", type=Path,
+                        default=ROOT / "results" / "bench" / "bench.json")
+    args = parser.parse_args(argv)
+    if args.reps < 1 or args.warmup < 0:
+        parser.error("--reps must be >= 1 and --warmup >= 0")
+
+    grids = [None] if args.no_build or not args.grid else args.grid
+    binaries = sorted({v["binary"] for v in args.variant})
+    results = []
+    for grid in grids:
+        commands = {} if grid is None else build(binaries, grid, args.steps, args.make_arg)
+        for v in args.variant:
+            for _ in range(args.warmup):
+                run_once(v, args.launcher, args.timeout)
+            runs = [run_once(v, args.launcher, args.timeout) for _ in range(args.reps)]
+            times = [float(m["TIME"]) for m in runs]
+            last = runs[-1]
+            stats = summarise(times)
+            gx, gy, gz = (int(n) for n in last["GRID"].split("x"))
+            results.append({
+                "variant": v["label"],
+                "binary": v["binary"],
+                "args": v["args"],
+                "ranks": v["ranks"],
+                "threads": v["threads"],
+                "grid": [gx, gy, gz],
+                "steps": int(last["STEPS"]),
+                "build": commands.get(v["binary"]),
+                "times": times,
+                **stats,
+                "throughput_cells_median": gx * gy * gz * int(last["STEPS"]) / stats["median"],
+                "checksum": last.get("CHECKSUM"),
+                "metrics": last,
+            })
+            print(f"{v['label']:>16} {gx}x{gy}x{gz} {v['ranks']}x{v['threads']}: "
+                  f"median {stats['median']:.6f}s  min {stats['min']:.6f}s  "
+                  f"p95 {stats['p95']:.6f}s  CI95 [{stats['ci95'][0]:.6f}, {stats['ci95'][1]:.6f}]")
+
+    doc = {
+        "schema": SCHEMA,
+        "created": dt.datetime.now(dt.timezone.utc).isoformat(timespec="seconds"),
+        "git_commit": git_commit(),
+        "host": host_info(),
+        "warmup": args.warmup,
+        "reps": args.reps,
+        "launcher": args.launcher,
+        "make_args": args.make_arg,
+        "results": results,
+    }
+    args.output.parent.mkdir(parents=True, exist_ok=True)
+    args.output.write_text(json.dumps(doc, indent=2) + "\n")
+    print(f"✅ Wrote {args.output}")
+
+
+if __name__ == "__main__":
+    main()
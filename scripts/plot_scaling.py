@@ -1,8 +1,9 @@
 #!/usr/bin/env python3
-"""Generate scaling plots from CSV logs under results/."""
+"""Generate scaling plots from CSV logs and bench JSON under results/."""
 from __future__ import annotations
 
 import argparse
+import json
 from pathlib import Path
 
 import matplotlib
@@ -62,7 +63,72 @@ def _plot_series(df, xcol, xlabel, ylabel, title, output):
     print(f"✅ Wrote {output.relative_to(ROOT)}")
 
 
-def main(selected: list[str] | None = None):
+def _load_bench(paths):
+    """Rows of scripts/bench.py JSON files: one per variant and grid."""
+    rows = []
+    for path in paths:
+        try:
+            doc = json.loads(Path(path).read_text())
+        except Exception as exc:  # pragma: no cover - logging helper
+            print(f"⚠️  Skipping {path}: {exc}")
+            continue
+        if not str(doc.get("schema", "")).startswith("miniweather-bench/"):
+            print(f"⚠️  Skipping {path}: not a bench result")
+            continue
+        for r in doc.get("results", []):
+            family = " ".join([r["binary"].replace("miniweather_", ""), *r["args"]])
+            rows.append(
+                {
+                    "family": family,
+                    "grid": "x".join(str(n) for n in r["grid"]),
+                    "workers": r["ranks"] * r["threads"],
+                    "median": r["median"],
+                    "ci_lo": r["ci95"][0],
+                    "ci_hi": r["ci95"][1],
+                    "p95": r["p95"],
+                }
+            )
+    if not rows:
+        return None
+    return pd.DataFrame(rows)
+
+
+def _plot_bench(df, prefix):
+    """Median time vs ranks*threads per grid, one line per binary+args, with
+    the 95% CI of the mean as error bars and p95 as open markers."""
+    if df is None or df.empty:
+        print("⚠️  No bench results; skipping plot")
+        return
+    for grid, sub in df.groupby("grid"):
+        fig, ax = plt.subplots(figsize=(6, 4))
+        for family, fam in sub.groupby("family"):
+            fam = fam.groupby("workers", as_index=False).median(numeric_only=True)
+            fam = fam.sort_values("workers")
+            err = [
+                (fam["median"] - fam["ci_lo"]).clip(lower=0),
+                (fam["ci_hi"] - fam["median"]).clip(lower=0),
+            ]
+            line = ax.errorbar(fam["workers"], fam["median"], yerr=err, marker="o",
+                               linewidth=2, capsize=3, label=family)
+            ax.scatter(fam["workers"], fam["p95"], marker="^", facecolors="none",
+                       edgecolors=line[0].get_color())
+        ax.set_xlabel("Ranks x threads")
+        ax.set_ylabel("Time (s), median; CI95 bars, p95 ^")
+        ax.set_title(f"Benchmark {grid}")
+        ax.grid(True, linestyle=":", linewidth=0.7)
+        ax.legend(fontsize="small")
+        fig.tight_layout()
+        output = PLOT_DIR / f"{prefix}_{grid}.png"
+        fig.savefig(output, dpi=160)
+        plt.close(fig)
+        print(f"✅ Wrote {output.relative_to(ROOT)}")
+
+
+def main(selected: list[str] | None = None, bench: list[str] | None = None):
+    if bench:
+        _plot_bench(_load_bench(bench), "bench")
+        return
+
     configs = [
         {
             "name": "cpu_strong",
@@ -126,7 +192,9 @@ def main(selected: list[str] | None = None):
         },
     ]
 
-    selected = set(selected or [cfg["name"] for cfg in configs])
+    selected = set(selected or [cfg["name"] for cfg in configs] + ["bench"])
+    if "bench" in selected:
+        _plot_bench(_load_bench(sorted(RESULTS_DIR.glob("bench/*.json"))), "bench")
     for cfg in configs:
         if cfg["name"] not in selected:
             continue
@@ -146,7 +214,13 @@ if __name__ == "__main__":
     parser.add_argument(
         "names",
         nargs="*",
-        help="Subset of plot names to build (default: all).",
+        help="Subset of plot names to build (default: all; 'bench' = results/bench/*.json).",
+    )
+    parser.add_argument(
+        "--bench",
+        nargs="+",
+        metavar="JSON",
+        help="Plot only these scripts/bench.py result files.",
     )
     args = parser.parse_args()
-    main(args.names)
+    main(args.names, args.bench)
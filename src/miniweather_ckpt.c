@@ -0,0 +1,109 @@
+// miniweather_ckpt.c - Collective MPI-IO checkpoint/restart
+#include <stdio.h>
+#include <string.h>
+#include "miniweather_ckpt.h"
+
+// Local checksum box inside the padded grid, and where it sits in the
+// global array of the file.
+static void make_types(const mw_decomp *d, const mw_grid *g,
+                       MPI_Datatype *mem, MPI_Datatype *file) {
+    int lsize[3] = { g->sx, g->sy, g->zs };
+    int sub[3], lstart[3], gstart[3];
+    for (int i = 0; i < 3; ++i) {
+        sub[i]    = d->sum_hi[i] - d->sum_lo[i] + 1;
+        lstart[i] = d->sum_lo[i];
+        gstart[i] = d->lo[i] - 1 + d->sum_lo[i];
+    }
+    MPI_Type_create_subarray(3, lsize, sub, lstart, MPI_ORDER_C, MW_MPI_REAL, mem);
+    MPI_Type_create_subarray(3, d->ext, sub, gstart, MPI_ORDER_C, MW_MPI_REAL, file);
+    MPI_Type_commit(mem);
+    MPI_Type_commit(file);
+}
+
+// Collective data transfer through the file view; 0 if every rank succeeded.
+static int transfer(MPI_File fh, const mw_decomp *d, const mw_grid *g, int write) {
+    MPI_Datatype mem, file;
+    make_types(d, g, &mem, &file);
+    int rc = MPI_File_set_view(fh, MW_CKPT_HEADER_BYTES, MW_MPI_REAL, file,
+                               "native", MPI_INFO_NULL);
+    if (rc == MPI_SUCCESS) {
+        rc = write ? MPI_File_write_all(fh, g->cur, 1, mem, MPI_STATUS_IGNORE)
+                   : MPI_File_read_all(fh, g->cur, 1, mem, MPI_STATUS_IGNORE);
+    }
+    MPI_Type_free(&mem);
+    MPI_Type_free(&file);
+
+    int ok = rc == MPI_SUCCESS, all_ok = 0;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, d->cart);
+    return all_ok ? 0 : -1;
+}
+
+int mw_ckpt_write(const char *path, const mw_decomp *d, const mw_grid *g, int step) {
+    char tmp[4096];
+    snprintf(tmp, sizeof tmp, "%s.tmp", path);
+
+    MPI_File fh;
+    if (MPI_File_open(d->cart, tmp, MPI_MODE_CREATE | MPI_MODE_WRONLY,
+                      MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        return -1;
+    }
+    MPI_File_set_size(fh, 0);   // drop a stale, longer .tmp
+
+    int ok = 1;
+    if (d->rank == 0) {
+        char raw[MW_CKPT_HEADER_BYTES];
+        mw_ckpt_header hd;
+        memset(raw, 0, sizeof raw);
+        memset(&hd, 0, sizeof hd);
+        memcpy(hd.magic, MW_CKPT_MAGIC, sizeof hd.magic);
+        hd.nx = d->ext[0];
+        hd.ny = d->ext[1];
+        hd.nz = d->ext[2];
+        hd.real_bytes = (int32_t)sizeof(mw_real);
+        hd.step  = step;
+        hd.ranks = d->size;
+        for (int i = 0; i < 3; ++i) hd.dims[i] = d->dims[i];
+        memcpy(raw, &hd, sizeof hd);
+        ok = MPI_File_write_at(fh, 0, raw, sizeof raw, MPI_BYTE,
+                               MPI_STATUS_IGNORE) == MPI_SUCCESS;
+    }
+    MPI_Bcast(&ok, 1, MPI_INT, 0, d->cart);
+
+    int rc = ok ? transfer(fh, d, g, 1) : -1;
+    MPI_File_close(&fh);
+
+    // Only a complete file replaces the previous checkpoint
+    if (rc == 0 && d->rank == 0 && rename(tmp, path) != 0) rc = -1;
+    MPI_Bcast(&rc, 1, MPI_INT, 0, d->cart);
+    return rc;
+}
+
+int mw_ckpt_read(const char *path, const mw_decomp *d, mw_grid *g, int *step) {
+    MPI_File fh;
+    if (MPI_File_open(d->cart, path, MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+        return -1;
+    }
+
+    // Rank 0 checks the header, everyone learns the verdict and the step
+    int hdr[2] = { 0, 0 };   // status, step
+    if (d->rank == 0) {
+        mw_ckpt_header hd;
+        memset(&hd, 0, sizeof hd);
+        if (MPI_File_read_at(fh, 0, &hd, sizeof hd, MPI_BYTE,
+                             MPI_STATUS_IGNORE) != MPI_SUCCESS ||
+            memcmp(hd.magic, MW_CKPT_MAGIC, sizeof hd.magic) != 0) {
+            hdr[0] = -1;
+        } else if (hd.nx != d->ext[0] || hd.ny != d->ext[1] || hd.nz != d->ext[2] ||
+                   hd.real_bytes != (int32_t)sizeof(mw_real)) {
+            hdr[0] = -2;
+        }
+        hdr[1] = hd.step;
+    }
+    MPI_Bcast(hdr, 2, MPI_INT, 0, d->cart);
+
+    int rc = hdr[0];
+    if (rc == 0) rc = transfer(fh, d, g, 0);
+    MPI_File_close(&fh);
+    if (rc == 0) *step = hdr[1];
+    return rc;
+}
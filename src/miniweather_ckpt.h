@@ -0,0 +1,39 @@
+// miniweather_ckpt.h - Collective MPI-IO checkpoint/restart
+#ifndef MINIWEATHER_CKPT_H
+#define MINIWEATHER_CKPT_H
+
+#include <stdint.h>
+#include <mpi.h>
+#include "miniweather_core.h"
+#include "miniweather_decomp.h"
+
+// One shared file per checkpoint: a fixed-size header followed by the
+// global NX x NY x NZ array of the current time level, z fastest, in
+// storage precision. Every rank writes the cells its checksum range covers
+// (owned cells plus the fixed boundary cells at the global edges), so the
+// file does not depend on how the grid was split and can be read back by
+// any rank count or layout. The x ghost planes outside the grid are not
+// stored; they are fixed and rebuilt by mw_decomp_grid.
+#define MW_CKPT_MAGIC        "MWCKPT1"
+#define MW_CKPT_HEADER_BYTES 512
+
+typedef struct {
+    char    magic[8];
+    int32_t nx, ny, nz;
+    int32_t real_bytes;     // sizeof(mw_real) of the writer
+    int32_t step;           // completed time steps
+    int32_t ranks;          // writer's decomposition, informational
+    int32_t dims[3];
+} mw_ckpt_header;
+
+// Writes g->cur after `step` steps to path (collective over d->cart). The
+// data goes to path.tmp first and is renamed once complete, so a run killed
+// mid-write keeps the previous checkpoint. Returns 0 on success.
+int mw_ckpt_write(const char *path, const mw_decomp *d, const mw_grid *g, int step);
+
+// Fills g->cur (allocated and initialised by mw_decomp_grid) from path and
+// stores the step it was written at. Collective. Returns 0 on success, -1 if
+// the file cannot be read, -2 if it holds a different grid or precision.
+int mw_ckpt_read(const char *path, const mw_decomp *d, mw_grid *g, int *step);
+
+#endif
@@ -0,0 +1,566 @@
+// miniweather_core.c - Shared grid state, stencil kernel and reductions
+//
+// Built once per parallel model (serial, OpenMP, OpenACC); the pragmas below
+// are selected by whichever of _OPENMP / _OPENACC the compiler defines.
+#include <float.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "miniweather_core.h"
+
+// Offset of cell (0,0,0) from the aligned block start: puts z = 1 of every
+// row (rows are MW_ZPAD-multiples long) on an MW_ALIGN boundary.
+#define MW_ZOFF (MW_ZPAD - 1)
+
+#define MW_HUGEPAGE (2u << 20)
+
+static int use_hugepages = 0;
+static int use_inplace = 0;
+
+int mw_grid_hugepages(int on) {
+#ifdef MADV_HUGEPAGE
+    use_hugepages = on;
+    return 1;
+#else
+    use_hugepages = 0;
+    return !on;
+#endif
+}
+
+int mw_grid_inplace(int on) {
+#ifdef _OPENACC
+    use_inplace = 0;
+    return !on;
+#else
+    use_inplace = on;
+    return 1;
+#endif
+}
+
+static mw_real *alloc_buffer(size_t elems) {
+    void *p = NULL;
+    size_t bytes = (elems + MW_ZPAD) * sizeof(mw_real);
+#ifdef MADV_HUGEPAGE
+    if (use_hugepages) {
+        // Whole 2 MiB pages so khugepaged / the fault path can back them
+        bytes = (bytes + MW_HUGEPAGE - 1) / MW_HUGEPAGE * MW_HUGEPAGE;
+        if (posix_memalign(&p, MW_HUGEPAGE, bytes) != 0) return NULL;
+        madvise(p, bytes, MADV_HUGEPAGE);
+        return (mw_real*)p + MW_ZOFF;
+    }
+#endif
+    if (posix_memalign(&p, MW_ALIGN, bytes) != 0)
+        return NULL;
+    return (mw_real*)p + MW_ZOFF;
+}
+
+static void free_buffer(mw_real *b) {
+    if (b) free(b - MW_ZOFF);
+}
+
+size_t mw_grid_buffer_bytes(const mw_grid *g) {
+    return (g->elems + MW_ZPAD) * sizeof(mw_real) + MW_ALIGN;
+}
+
+size_t mw_grid_bytes(const mw_grid *g) {
+    size_t elems = g->elems * (g->next ? 2 : 1);
+    for (int k = 0; k < 3; ++k) {
+        if (g->plane[k]) elems += mw_plane_elems(g);
+    }
+    return elems * sizeof(mw_real);
+}
+
+mw_real *mw_grid_place(void *mem) {
+    uintptr_t p = ((uintptr_t)mem + MW_ALIGN - 1) & ~(uintptr_t)(MW_ALIGN - 1);
+    return (mw_real*)p + MW_ZOFF;
+}
+
+int mw_grid_alloc(mw_grid *g, int sx, int sy, int sz) {
+    g->sx = sx;
+    g->sy = sy;
+    g->sz = sz;
+    g->zs = (sz + MW_ZPAD - 1) / MW_ZPAD * MW_ZPAD;
+    g->elems = (size_t)sx * sy * g->zs;
+    g->cur  = alloc_buffer(g->elems);
+    g->next = NULL;
+    for (int k = 0; k < 3; ++k) g->plane[k] = NULL;
+
+    int ok = g->cur != NULL;
+    if (use_inplace) {
+        for (int k = 0; k < 3; ++k) {
+            g->plane[k] = alloc_buffer(mw_plane_elems(g));
+            if (!g->plane[k]) ok = 0;
+        }
+    } else {
+        g->next = alloc_buffer(g->elems);
+        if (!g->next) ok = 0;
+    }
+    if (!ok) {
+        mw_grid_free(g);
+        return -1;
+    }
+
+#ifdef _OPENACC
+    mw_real *cur = g->cur, *next = g->next;
+    size_t elems = g->elems;
+    #pragma acc enter data create(cur[0:elems], next[0:elems])
+#else
+    mw_grid_touch(g);
+#endif
+    return 0;
+}
+
+void mw_grid_touch(const mw_grid *g) {
+    const int sx = g->sx, sy = g->sy, zs = g->zs;
+    const size_t px = mw_plane_elems(g);
+    for (int k = 0; k < 3; ++k) {
+        if (g->plane[k]) memset(g->plane[k], 0, px * sizeof(mw_real));
+    }
+    if (sx < 3 || sy < 3) {
+        memset(g->cur, 0, g->elems * sizeof(mw_real));
+        if (g->next) memset(g->next, 0, g->elems * sizeof(mw_real));
+        return;
+    }
+
+    // Same iteration space and schedule as the sweep in mw_stencil_box;
+    // the fixed boundary rows/planes go with the interior row next to them
+#ifdef _OPENMP
+    #pragma omp parallel for collapse(2) schedule(static)
+#endif
+    for (int x = 1; x <= sx - 2; ++x) {
+        for (int y = 1; y <= sy - 2; ++y) {
+            const int x0 = x == 1 ? 0 : x, x1 = x == sx - 2 ? sx - 1 : x;
+            const int y0 = y == 1 ? 0 : y, y1 = y == sy - 2 ? sy - 1 : y;
+            for (int xx = x0; xx <= x1; ++xx) {
+                const size_t i = xx * px + (size_t)y0 * zs;
+                const size_t n = (size_t)(y1 - y0 + 1) * zs * sizeof(mw_real);
+                memset(&g->cur[i], 0, n);
+                if (g->next) memset(&g->next[i], 0, n);
+            }
+        }
+    }
+}
+
+void mw_grid_free(mw_grid *g) {
+#ifdef _OPENACC
+    if (g->cur && g->next) {
+        mw_real *cur = g->cur, *next = g->next;
+        size_t elems = g->elems;
+        #pragma acc exit data delete(cur[0:elems], next[0:elems])
+    }
+#endif
+    for (int k = 0; k < 3; ++k) {
+        free_buffer(g->plane[k]);
+        g->plane[k] = NULL;
+    }
+    free_buffer(g->next);
+    free_buffer(g->cur);
+    g->cur = g->next = NULL;
+}
+
+void mw_grid_init(mw_grid *g, int gx_first, int gy_first, int gz_first) {
+    mw_real *restrict a = g->cur;
+    mw_real *restrict b = g->next;
+    const int sx = g->sx, sy = g->sy, sz = g->sz, zs = g->zs;
+
+#if defined(_OPENACC)
+    #pragma acc parallel loop collapse(3) present(a, b)
+#elif defined(_OPENMP)
+    #pragma omp parallel for collapse(3)
+#endif
+    for (int x = 0; x < sx; ++x) {
+        for (int y = 0; y < sy; ++y) {
+            for (int z = 0; z < zs; ++z) {
+                size_t i = ((size_t)x * sy + y) * zs + z;
+                a[i] = (z < sz) ? (mw_real)mw_init_value(gx_first + x, gy_first + y,
+                                                         gz_first + z) : 0;
+                if (b) b[i] = a[i];
+            }
+        }
+    }
+}
+
+void mw_stencil_planes(mw_grid *grid, int x_lo, int x_hi) {
+#if defined(_OPENACC)
+    const mw_real *restrict g = grid->cur;
+    mw_real *restrict ng = grid->next;
+    const int sy = grid->sy, sz = grid->sz, zs = grid->zs;
+    const size_t px = (size_t)sy * zs;
+
+    #pragma acc parallel loop collapse(3) present(g, ng)
+    for (int x = x_lo; x <= x_hi; ++x) {
+        for (int y = 1; y < sy - 1; ++y) {
+            for (int z = 1; z < sz - 1; ++z) {
+                size_t i = ((size_t)x * sy + y) * zs + z;
+                double xm = g[i - px];
+                double xp = g[i + px];
+                double ym = g[i - zs];
+                double yp = g[i + zs];
+                double zm = g[i - 1];
+                double zp = g[i + 1];
+                ng[i] = (mw_real)((xm + xp + ym + yp + zm + zp) / 6.0);
+            }
+        }
+    }
+#else
+    mw_stencil_box(grid, x_lo, x_hi, 1, grid->sy - 2, 1, grid->sz - 2);
+#endif
+}
+
+void mw_stencil_box(mw_grid *grid, int x_lo, int x_hi, int y_lo, int y_hi,
+                    int z_lo, int z_hi) {
+    const mw_real *restrict g = grid->cur;
+    mw_real *restrict ng = grid->next;
+    const int sy = grid->sy, zs = grid->zs;
+    const size_t px = (size_t)sy * zs;
+    const mw_row_fn row = mw_row_kernel;
+
+#ifdef _OPENMP
+    #pragma omp parallel for collapse(2) schedule(static)
+#endif
+    for (int x = x_lo; x <= x_hi; ++x) {
+        for (int y = y_lo; y <= y_hi; ++y) {
+            row(g, ng, ((size_t)x * sy + y) * zs, px, zs, z_lo, z_hi + 1);
+        }
+    }
+}
+
+static double step_inplace(mw_grid *g, int x_lo, int x_hi, mw_stats *s, int norm);
+
+void mw_step(mw_grid *g, int x_lo, int x_hi) {
+    if (!g->next) {
+        step_inplace(g, x_lo, x_hi, NULL, -1);
+        return;
+    }
+    mw_stencil_planes(g, x_lo, x_hi);
+    mw_grid_swap(g);
+}
+
+void mw_stats_clear(mw_stats *s) {
+    s->sum = 0.0;
+    s->min = DBL_MAX;
+    s->max = -DBL_MAX;
+    s->cells = 0.0;
+}
+
+void mw_stats_merge(mw_stats *s, const mw_stats *t) {
+    s->sum += t->sum;
+    if (t->min < s->min) s->min = t->min;
+    if (t->max > s->max) s->max = t->max;
+    s->cells += t->cells;
+}
+
+void mw_stencil_box_stats(mw_grid *grid, int x_lo, int x_hi, int y_lo, int y_hi,
+                          int z_lo, int z_hi, mw_stats *s) {
+    const mw_real *restrict g = grid->cur;
+    mw_real *restrict ng = grid->next;
+    const int sy = grid->sy, zs = grid->zs;
+    const size_t px = (size_t)sy * zs;
+    const mw_row_fn row = mw_row_kernel;
+    double sum = 0.0, mn = s->min, mx = s->max;
+
+    // Each row is folded into the statistics straight after the row kernel
+    // wrote it, while it is still in L1
+#ifdef _OPENMP
+    #pragma omp parallel for collapse(2) schedule(static) \
+        reduction(+:sum) reduction(min:mn) reduction(max:mx)
+#endif
+    for (int x = x_lo; x <= x_hi; ++x) {
+        for (int y = y_lo; y <= y_hi; ++y) {
+            const size_t i0 = ((size_t)x * sy + y) * zs;
+            row(g, ng, i0, px, zs, z_lo, z_hi + 1);
+            for (int z = z_lo; z <= z_hi; ++z) {
+                const double v = ng[i0 + z];
+                sum += v;
+                if (v < mn) mn = v;
+                if (v > mx) mx = v;
+            }
+        }
+    }
+    if (x_hi >= x_lo && y_hi >= y_lo && z_hi >= z_lo) {
+        s->sum += sum;
+        s->min = mn;
+        s->max = mx;
+        s->cells += (double)(x_hi - x_lo + 1) * (y_hi - y_lo + 1) * (z_hi - z_lo + 1);
+    }
+}
+
+void mw_step_stats(mw_grid *grid, int x_lo, int x_hi, mw_stats *s) {
+    if (!grid->next) {
+        step_inplace(grid, x_lo, x_hi, s, -1);
+        return;
+    }
+#if defined(_OPENACC)
+    const mw_real *restrict g = grid->cur;
+    mw_real *restrict ng = grid->next;
+    const int sy = grid->sy, sz = grid->sz, zs = grid->zs;
+    const size_t px = (size_t)sy * zs;
+    double sum = 0.0, mn = s->min, mx = s->max;
+
+    #pragma acc parallel loop collapse(3) present(g, ng) \
+        reduction(+:sum) reduction(min:mn) reduction(max:mx)
+    for (int x = x_lo; x <= x_hi; ++x) {
+        for (int y = 1; y < sy - 1; ++y) {
+            for (int z = 1; z < sz - 1; ++z) {
+                size_t i = ((size_t)x * sy + y) * zs + z;
+                double v = ((double)g[i - px] + g[i + px] + g[i - zs] + g[i + zs] +
+                            g[i - 1] + g[i + 1]) / 6.0;
+                ng[i] = (mw_real)v;
+                v = ng[i];
+                sum += v;
+                mn = v < mn ? v : mn;
+                mx = v > mx ? v : mx;
+            }
+        }
+    }
+    if (x_hi >= x_lo && sy > 2 && sz > 2) {
+        s->sum += sum;
+        s->min = mn;
+        s->max = mx;
+        s->cells += (double)(x_hi - x_lo + 1) * (sy - 2) * (sz - 2);
+    }
+#else
+    mw_stencil_box_stats(grid, x_lo, x_hi, 1, grid->sy - 2, 1, grid->sz - 2, s);
+#endif
+    mw_grid_swap(grid);
+}
+
+void mw_stats_box(const mw_grid *grid, int x_lo, int x_hi, int y_lo, int y_hi,
+                  int z_lo, int z_hi, mw_stats *s) {
+    const mw_real *restrict g = grid->cur;
+    const int sy = grid->sy, zs = grid->zs;
+    double sum = 0.0, mn = s->min, mx = s->max;
+
+#if defined(_OPENACC)
+    #pragma acc parallel loop collapse(3) present(g) \
+        reduction(+:sum) reduction(min:mn) reduction(max:mx)
+#elif defined(_OPENMP)
+    #pragma omp parallel for collapse(2) schedule(static) \
+        reduction(+:sum) reduction(min:mn) reduction(max:mx)
+#endif
+    for (int x = x_lo; x <= x_hi; ++x) {
+        for (int y = y_lo; y <= y_hi; ++y) {
+            for (int z = z_lo; z <= z_hi; ++z) {
+                const double v = g[((size_t)x * sy + y) * zs + z];
+                sum += v;
+                mn = v < mn ? v : mn;
+                mx = v > mx ? v : mx;
+            }
+        }
+    }
+    if (x_hi >= x_lo && y_hi >= y_lo && z_hi >= z_lo) {
+        s->sum += sum;
+        s->min = mn;
+        s->max = mx;
+        s->cells += (double)(x_hi - x_lo + 1) * (y_hi - y_lo + 1) * (z_hi - z_lo + 1);
+    }
+}
+
+void mw_stats_shell(const mw_grid *g, const int olo[3], const int ohi[3],
+                    const int ilo[3], const int ihi[3], mw_stats *s) {
+    // x end slabs in full, then y rows and z columns of the inner x range,
+    // so every outer cell outside the inner box is visited exactly once
+    mw_stats_box(g, olo[0], ilo[0] - 1, olo[1], ohi[1], olo[2], ohi[2], s);
+    mw_stats_box(g, ihi[0] + 1, ohi[0], olo[1], ohi[1], olo[2], ohi[2], s);
+    mw_stats_box(g, ilo[0], ihi[0], olo[1], ilo[1] - 1, olo[2], ohi[2], s);
+    mw_stats_box(g, ilo[0], ihi[0], ihi[1] + 1, ohi[1], olo[2], ohi[2], s);
+    mw_stats_box(g, ilo[0], ihi[0], ilo[1], ihi[1], olo[2], ilo[2] - 1, s);
+    mw_stats_box(g, ilo[0], ihi[0], ilo[1], ihi[1], ihi[2] + 1, ohi[2], s);
+}
+
+void mw_grid_stats(const mw_grid *g, mw_stats *s, int fused) {
+    const int olo[3] = { 0, 0, 0 }, ohi[3] = { g->sx - 1, g->sy - 1, g->sz - 1 };
+    const int ilo[3] = { 1, 1, 1 }, ihi[3] = { g->sx - 2, g->sy - 2, g->sz - 2 };
+    if (fused) {
+        mw_stats_shell(g, olo, ohi, ilo, ihi, s);
+    } else {
+        mw_stats_clear(s);
+        mw_stats_box(g, 0, g->sx - 1, 0, g->sy - 1, 0, g->sz - 1, s);
+    }
+}
+
+void mw_stats_print(int step, const mw_stats *s) {
+    printf("STATS: STEP=%d SUM=%.10e MIN=%.6e MAX=%.6e MEAN=%.10e\n",
+           step, s->sum, s->min, s->max, s->sum / s->cells);
+}
+
+int mw_norm_parse(const char *name) {
+    if (strcmp(name, "max") == 0) return MW_NORM_MAX;
+    if (strcmp(name, "l2") == 0)  return MW_NORM_L2;
+    return -1;
+}
+
+// Change of one row between the levels in g and ng, folded into r.
+static inline double row_residual(const mw_real *restrict g, const mw_real *restrict ng,
+                                  size_t i0, int z0, int z1, int norm, double r) {
+    for (int z = z0; z < z1; ++z) {
+        const double d = (double)ng[i0 + z] - g[i0 + z];
+        if (norm == MW_NORM_MAX) {
+            const double a = d < 0.0 ? -d : d;
+            if (a > r) r = a;
+        } else {
+            r += d * d;
+        }
+    }
+    return r;
+}
+
+double mw_stencil_box_residual(mw_grid *grid, int x_lo, int x_hi, int y_lo, int y_hi,
+                               int z_lo, int z_hi, int norm) {
+    const mw_real *restrict g = grid->cur;
+    mw_real *restrict ng = grid->next;
+    const int sy = grid->sy, zs = grid->zs;
+    const size_t px = (size_t)sy * zs;
+    const mw_row_fn row = mw_row_kernel;
+    double r = 0.0;
+
+    // The residual is taken right behind the row kernel while the row is
+    // still in L1, so the sweep streams the grid once either way
+    if (norm == MW_NORM_MAX) {
+#ifdef _OPENMP
+        #pragma omp parallel for collapse(2) schedule(static) reduction(max:r)
+#endif
+        for (int x = x_lo; x <= x_hi; ++x) {
+            for (int y = y_lo; y <= y_hi; ++y) {
+                const size_t i0 = ((size_t)x * sy + y) * zs;
+                row(g, ng, i0, px, zs, z_lo, z_hi + 1);
+                r = row_residual(g, ng, i0, z_lo, z_hi + 1, MW_NORM_MAX, r);
+            }
+        }
+    } else {
+#ifdef _OPENMP
+        #pragma omp parallel for collapse(2) schedule(static) reduction(+:r)
+#endif
+        for (int x = x_lo; x <= x_hi; ++x) {
+            for (int y = y_lo; y <= y_hi; ++y) {
+                const size_t i0 = ((size_t)x * sy + y) * zs;
+                row(g, ng, i0, px, zs, z_lo, z_hi + 1);
+                r = row_residual(g, ng, i0, z_lo, z_hi + 1, MW_NORM_L2, r);
+            }
+        }
+    }
+    return r;
+}
+
+double mw_step_residual(mw_grid *g, int x_lo, int x_hi, int norm) {
+    if (!g->next) return step_inplace(g, x_lo, x_hi, NULL, norm);
+    const double r = mw_stencil_box_residual(g, x_lo, x_hi, 1, g->sy - 2, 1, g->sz - 2, norm);
+    mw_grid_swap(g);
+    return r;
+}
+
+// In-place step over planes x_lo..x_hi (interior y/z), optionally folding
+// the new level into s and returning the residual in norm (norm < 0: none).
+// Plane x goes to plane[x % 3] while cur still holds the old x-1..x+1; plane
+// x-1 is copied back after the barrier that ends plane x. The copy needs no
+// barrier of its own: plane x+1 neither reads plane x-1 nor writes its buffer.
+static double step_inplace(mw_grid *grid, int x_lo, int x_hi, mw_stats *s, int norm) {
+    mw_real *g = grid->cur;
+    const int sy = grid->sy, zs = grid->zs, z_hi = grid->sz - 2;
+    const size_t px = (size_t)sy * zs;
+    const size_t row_bytes = (size_t)(z_hi > 0 ? z_hi : 0) * sizeof(mw_real);
+    const mw_row_fn row = mw_row_kernel;
+    double sum = 0.0, mn = s ? s->min : DBL_MAX, mx = s ? s->max : -DBL_MAX;
+    double rmax = 0.0, r2 = 0.0;
+
+#ifdef _OPENMP
+    #pragma omp parallel reduction(+:sum, r2) reduction(min:mn) reduction(max:mx, rmax)
+#endif
+    for (int x = x_lo; x <= x_hi + 1; ++x) {
+        if (x <= x_hi) {
+            const mw_real *gx = g + (size_t)x * px;
+            mw_real *restrict p = grid->plane[x % 3];
+#ifdef _OPENMP
+            #pragma omp for schedule(static)
+#endif
+            for (int y = 1; y <= sy - 2; ++y) {
+                const size_t i0 = (size_t)y * zs;
+                row(gx, p, i0, px, zs, 1, z_hi + 1);
+                if (s) {
+                    for (int z = 1; z <= z_hi; ++z) {
+                        const double v = p[i0 + z];
+                        sum += v;
+                        if (v < mn) mn = v;
+                        if (v > mx) mx = v;
+                    }
+                }
+                if (norm == MW_NORM_MAX) rmax = row_residual(gx, p, i0, 1, z_hi + 1, norm, rmax);
+                else if (norm == MW_NORM_L2) r2 = row_residual(gx, p, i0, 1, z_hi + 1, norm, r2);
+            }
+        }
+        if (x > x_lo) {
+            const mw_real *restrict p = grid->plane[(x - 1) % 3];
+            mw_real *restrict dst = g + (size_t)(x - 1) * px;
+#ifdef _OPENMP
+            #pragma omp for schedule(static) nowait
+#endif
+            for (int y = 1; y <= sy - 2; ++y) {
+                memcpy(&dst[(size_t)y * zs + 1], &p[(size_t)y * zs + 1], row_bytes);
+            }
+        }
+    }
+
+    if (s && x_hi >= x_lo && sy > 2 && z_hi >= 1) {
+        s->sum += sum;
+        s->min = mn;
+        s->max = mx;
+        s->cells += (double)(x_hi - x_lo + 1) * (sy - 2) * z_hi;
+    }
+    return norm == MW_NORM_MAX ? rmax : r2;
+}
+
+double mw_residual(const mw_grid *grid, int x_lo, int x_hi, int norm) {
+    // After the swap cur holds the new level and next the old one
+    const mw_real *restrict g = grid->next;
+    const mw_real *restrict ng = grid->cur;
+    const int sy = grid->sy, sz = grid->sz, zs = grid->zs;
+    double r = 0.0;
+
+    if (norm == MW_NORM_MAX) {
+#ifdef _OPENMP
+        #pragma omp parallel for collapse(2) schedule(static) reduction(max:r)
+#endif
+        for (int x = x_lo; x <= x_hi; ++x) {
+            for (int y = 1; y < sy - 1; ++y) {
+                r = row_residual(g, ng, ((size_t)x * sy + y) * zs, 1, sz - 1, MW_NORM_MAX, r);
+            }
+        }
+    } else {
+#ifdef _OPENMP
+        #pragma omp parallel for collapse(2) schedule(static) reduction(+:r)
+#endif
+        for (int x = x_lo; x <= x_hi; ++x) {
+            for (int y = 1; y < sy - 1; ++y) {
+                r = row_residual(g, ng, ((size_t)x * sy + y) * zs, 1, sz - 1, MW_NORM_L2, r);
+            }
+        }
+    }
+    return r;
+}
+
+double mw_checksum(const mw_grid *g, int x_lo, int x_hi) {
+    return mw_checksum_box(g, x_lo, x_hi, 0, g->sy - 1, 0, g->sz - 1);
+}
+
+double mw_checksum_box(const mw_grid *grid, int x_lo, int x_hi,
+                       int y_lo, int y_hi, int z_lo, int z_hi) {
+    const mw_real *restrict g = grid->cur;
+    const int sy = grid->sy, zs = grid->zs;
+    double sum = 0.0;
+
+#if defined(_OPENACC)
+    #pragma acc parallel loop collapse(3) reduction(+:sum) present(g)
+#elif defined(_OPENMP)
+    #pragma omp parallel for collapse(3) reduction(+:sum)
+#endif
+    for (int x = x_lo; x <= x_hi; ++x) {
+        for (int y = y_lo; y <= y_hi; ++y) {
+            for (int z = z_lo; z <= z_hi; ++z) {
+                sum += g[((size_t)x * sy + y) * zs + z];
+            }
+        }
+    }
+    return sum;
+}
@@ -0,0 +1,232 @@
+// miniweather_core.h - Shared grid state, stencil kernel and reductions
+#ifndef MINIWEATHER_CORE_H
+#define MINIWEATHER_CORE_H
+
+#include <stddef.h>
+
+// Storage precision of the grid cells (-DMW_PRECISION=32 in the _fp32 builds):
+// with 32 the state is stored as float, halving the bytes each sweep and
+// halo moves, while the stencil sum and every reduction still accumulate in
+// double.
+#ifndef MW_PRECISION
+#define MW_PRECISION 64
+#endif
+#if MW_PRECISION == 32
+typedef float mw_real;
+#else
+typedef double mw_real;
+#endif
+
+// Local grid: sx*sy*sz cells (ghost/boundary layers included), z fastest.
+// Two buffers are kept and swapped after every step instead of copying
+// the new time level back, so each step streams the grid only once.
+//
+// z-rows are padded to zs = sz rounded up to MW_ZPAD cells, and buffers
+// are offset so the first interior cell (z = 1) of every row sits on an
+// MW_ALIGN boundary; pad cells hold 0 and are never read by the stencil.
+#define MW_ALIGN 64
+#define MW_ZPAD  (MW_ALIGN / (int)sizeof(mw_real))
+
+typedef struct {
+    int sx, sy, sz;
+    int zs;         // padded row stride
+    size_t elems;   // sx * sy * zs
+    mw_real *cur;   // current time level
+    mw_real *next;  // receives the next time level (NULL in place)
+    mw_real *plane[3];  // in-place mode: rolling new-level x-planes, else NULL
+} mw_grid;
+
+#define MW_IDX(g,x,y,z) ( ((size_t)(x) * (g)->sy + (y)) * (g)->zs + (z) )
+
+// Elements in one x-plane (halo face), padding included.
+static inline size_t mw_plane_elems(const mw_grid *g) {
+    return (size_t)g->sy * g->zs;
+}
+
+// Returns 0 on success, -1 if either buffer could not be allocated.
+int  mw_grid_alloc(mw_grid *g, int sx, int sy, int sz);
+void mw_grid_free(mw_grid *g);
+
+// Placement: mw_grid_alloc first-touches both buffers with mw_grid_touch,
+// which splits rows over threads exactly like the full sweep
+// (mw_stencil_box over x 1..sx-2, y 1..sy-2, static schedule), so on a
+// first-touch NUMA policy every thread's rows live on its node. Call it
+// again on memory obtained elsewhere before filling it. mw_grid_hugepages(1)
+// makes later allocations 2 MiB aligned and madvise(MADV_HUGEPAGE)d; returns
+// 0 if the platform lacks transparent huge pages.
+void mw_grid_touch(const mw_grid *g);
+int  mw_grid_hugepages(int on);
+
+// In-place mode: mw_grid_inplace(1) makes later allocations keep only cur
+// plus three rolling x-planes (next = NULL), nearly halving the grid's
+// memory. mw_step, mw_step_stats and mw_step_residual then sweep x upwards,
+// building plane x in a plane buffer and writing plane x-1 back into cur
+// once nothing reads its old level any more, so results are bit-identical
+// to the two-buffer sweep. The other sweeps need next and must not be used.
+// Returns 0 if unavailable (the OpenACC build).
+int  mw_grid_inplace(int on);
+
+// Buffers in caller-owned memory (e.g. an MPI shared window): one buffer of
+// g needs mw_grid_buffer_bytes at any alignment; mw_grid_place returns its
+// start inside mem with the same row alignment as mw_grid_alloc. The caller
+// frees the memory, not mw_grid_free.
+size_t  mw_grid_buffer_bytes(const mw_grid *g);
+mw_real *mw_grid_place(void *mem);
+
+// Bytes the grid holds: both buffers, or cur and the planes in place.
+size_t mw_grid_bytes(const mw_grid *g);
+
+// Initial state of the cell at global index (gx, gy, gz): gx + gy + gz,
+// with gx clamped at 0 (ghost planes left of the domain repeat the
+// boundary plane). Every initialiser (grids, ensembles, multi-variable
+// state) goes through this, so their runs stay comparable bit for bit.
+#ifdef _OPENACC
+#pragma acc routine seq
+#endif
+static inline double mw_init_value(int gx, int gy, int gz) {
+    return (double)((gx < 0 ? 0 : gx) + gy + gz);
+}
+
+// Fills both buffers with mw_init_value of the global indices gx_first + x,
+// gy_first + y and gz_first + z of local cell (x,y,z), pads with 0. Both
+// buffers are written so the fixed boundary cells survive the pointer
+// swaps (only cur in place).
+void mw_grid_init(mw_grid *g, int gx_first, int gy_first, int gz_first);
+
+static inline void mw_grid_swap(mw_grid *g) {
+    mw_real *tmp = g->cur;
+    g->cur  = g->next;
+    g->next = tmp;
+}
+
+// 6-point stencil for cells z0..z1-1 of the row starting at flat index i0
+// (z = 0); px is the x-plane stride, zs the row stride. The sum is taken in
+// double whatever the storage precision. This is the scalar reference: the
+// SIMD kernels keep its summation order, so every kernel variant produces
+// bit-identical results.
+static inline void mw_stencil_row(const mw_real *restrict g, mw_real *restrict ng,
+                                  size_t i0, size_t px, int zs, int z0, int z1) {
+    for (int z = z0; z < z1; ++z) {
+        size_t i = i0 + z;
+        ng[i] = (mw_real)(((double)g[i - px] + g[i + px] + g[i - zs] + g[i + zs] +
+                           g[i - 1] + g[i + 1]) / 6.0);
+    }
+}
+
+// Row kernel used by every CPU sweep, chosen at startup by mw_simd_select.
+typedef void (*mw_row_fn)(const mw_real *restrict g, mw_real *restrict ng,
+                          size_t i0, size_t px, int zs, int z0, int z1);
+extern mw_row_fn mw_row_kernel;
+
+// Selects "scalar", "avx2", "avx512" or "auto" (best the CPU supports, via
+// cpuid). Returns the selected kernel name, or NULL if the request is
+// unknown or unsupported on this CPU (the current kernel is then kept).
+const char *mw_simd_select(const char *want);
+const char *mw_simd_name(void);
+
+// 6-point stencil from cur into next for planes x_lo..x_hi (inclusive),
+// interior y/z only. Does not swap.
+void mw_stencil_planes(mw_grid *g, int x_lo, int x_hi);
+
+// Stencil over an arbitrary local box (inclusive bounds, interior cells
+// only). CPU kernels only; the OpenACC build sweeps whole planes.
+void mw_stencil_box(mw_grid *g, int x_lo, int x_hi, int y_lo, int y_hi,
+                    int z_lo, int z_hi);
+
+// One full time step over planes x_lo..x_hi: stencil, then swap.
+void mw_step(mw_grid *g, int x_lo, int x_hi);
+
+// Field statistics of the current level: sum (the CHECKSUM), min, max and
+// the number of cells, so mean = sum / cells. Partial statistics merge
+// (over boxes, threads or ranks) with mw_stats_merge.
+typedef struct {
+    double sum, min, max, cells;
+} mw_stats;
+
+void mw_stats_clear(mw_stats *s);
+void mw_stats_merge(mw_stats *s, const mw_stats *t);
+
+// mw_stencil_box / mw_step that also fold the new level of every swept
+// cell into s, each row right after the kernel wrote it, so no separate
+// pass over the grid is needed. mw_step_stats has its own OpenACC kernel.
+void mw_stencil_box_stats(mw_grid *g, int x_lo, int x_hi, int y_lo, int y_hi,
+                          int z_lo, int z_hi, mw_stats *s);
+void mw_step_stats(mw_grid *g, int x_lo, int x_hi, mw_stats *s);
+
+// Adds the cells of cur in a box (empty boxes add nothing), or in the shell
+// of the outer box around an inner box it contains: the fixed cells a
+// fused sweep leaves out of its statistics.
+void mw_stats_box(const mw_grid *g, int x_lo, int x_hi, int y_lo, int y_hi,
+                  int z_lo, int z_hi, mw_stats *s);
+void mw_stats_shell(const mw_grid *g, const int olo[3], const int ohi[3],
+                    const int ilo[3], const int ihi[3], mw_stats *s);
+
+// Statistics of the whole grid g after a step, fixed boundary included: a
+// fused sweep (mw_step_stats) already holds the interior and only the
+// shell is added, otherwise s is refilled in one pass (the single-grid
+// counterpart of mw_decomp_stats).
+void mw_grid_stats(const mw_grid *g, mw_stats *s, int fused);
+
+// Prints "STATS: STEP= SUM= MIN= MAX= MEAN=" for --stats-every.
+void mw_stats_print(int step, const mw_stats *s);
+
+// Residual of a step, for the convergence mode: MW_NORM_MAX is the largest
+// |new - old| of any swept cell, MW_NORM_L2 the sum of (new - old)^2 (the
+// caller takes the root after reducing over ranks). mw_norm_parse maps
+// "max" / "l2" to these, -1 if unknown.
+#define MW_NORM_MAX 0
+#define MW_NORM_L2  1
+int mw_norm_parse(const char *name);
+
+// mw_stencil_box / mw_step that also return the residual of the swept
+// cells, computed row by row behind the row kernel (same results as the
+// plain sweep). CPU kernels only.
+double mw_stencil_box_residual(mw_grid *g, int x_lo, int x_hi, int y_lo, int y_hi,
+                               int z_lo, int z_hi, int norm);
+double mw_step_residual(mw_grid *g, int x_lo, int x_hi, int norm);
+
+// Residual of the step just taken by any other sweep (cur against next over
+// planes x_lo..x_hi, interior y/z); an extra pass over both buffers.
+double mw_residual(const mw_grid *g, int x_lo, int x_hi, int norm);
+
+// Temporally blocked variant of nsteps calls to mw_step: planes are swept in
+// x-tiles skewed by one plane per step (parallelogram tiling), so each tile
+// advances `depth` steps while its planes are still cache resident. tile = 0
+// picks a tile width that fits MW_TBLOCK_CACHE_BYTES. Same result as mw_step.
+#ifndef MW_TBLOCK_CACHE_BYTES
+#define MW_TBLOCK_CACHE_BYTES (8u << 20)
+#endif
+void mw_step_tblock(mw_grid *g, int x_lo, int x_hi, int nsteps, int depth, int tile);
+int  mw_tblock_auto_tile(const mw_grid *g, int depth);
+
+// Spatially blocked sweep: the y/z plane is cut into ty x tz tiles (threads
+// split the tiles) and each tile streams through x, so the x-1/x/x+1 slices
+// of a tile stay in L2. One of ty/tz <= 0 means the full interior extent in
+// that direction; both <= 0 is the plain mw_stencil_planes sweep.
+void mw_stencil_planes_tiled(mw_grid *g, int x_lo, int x_hi, int ty, int tz);
+void mw_step_tiled(mw_grid *g, int x_lo, int x_hi, int ty, int tz);
+
+// Picks ty/tz for the tiled sweep. Uses the entry cached in `path` for the
+// key (nx, ny, nz, threads) unless `force`; otherwise times candidate shapes
+// on g (cur is left untouched) and records the winner. Returns 1 when the
+// shape came from the cache, 0 when it was searched.
+int mw_autotune_tiles(mw_grid *g, int x_lo, int x_hi, const char *path,
+                      int nx, int ny, int nz, int threads, int force,
+                      int *ty, int *tz);
+
+// Modelled DRAM traffic per cell update: both buffers stream once per sweep
+// of `depth` steps (depth <= 1 is the naive kernel).
+double mw_bytes_per_update(int depth);
+
+// Floating-point operations per cell update: five adds and the divide,
+// whatever the blocking.
+double mw_flops_per_update(void);
+
+// Sum of the current time level over planes x_lo..x_hi (all y/z).
+double mw_checksum(const mw_grid *g, int x_lo, int x_hi);
+
+// Sum over the local box x_lo..x_hi, y_lo..y_hi, z_lo..z_hi (inclusive).
+double mw_checksum_box(const mw_grid *g, int x_lo, int x_hi,
+                       int y_lo, int y_hi, int z_lo, int z_hi);
+
+#endif
@@ -0,0 +1,249 @@
+// miniweather_decomp.c - Cartesian domain decomposition
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "miniweather_decomp.h"
+
+// Even block split of n cells over parts: the first n % parts parts take
+// one extra cell, so sizes differ by at most one.
+static void split(int n, int parts, int coord, int *start, int *len) {
+    const int base = n / parts, rem = n % parts;
+    *start = coord * base + (coord < rem ? coord : rem);
+    *len   = base + (coord < rem ? 1 : 0);
+}
+
+// Sets the owned range of direction i and the checksum range derived from
+// it. A ghost layer with no neighbour is counted only if it is a real
+// (fixed boundary) cell of the global grid.
+static void set_extent(mw_decomp *d, int i, int lo, int len) {
+    d->lo[i] = lo;
+    d->n[i]  = len;
+    const int ghost_lo = lo - 1, ghost_hi = lo + len;
+    d->sum_lo[i] = (d->nbr[i][0] == MPI_PROC_NULL && ghost_lo >= 0) ? 0 : 1;
+    d->sum_hi[i] = (d->nbr[i][1] == MPI_PROC_NULL && ghost_hi < d->ext[i]) ? len + 1 : len;
+}
+
+int mw_decomp_create(mw_decomp *d, MPI_Comm comm, int layout,
+                     int nx, int ny, int nz) {
+    const int first[3]  = { 0,  1,      1      };
+    const int count[3]  = { nx, ny - 2, nz - 2 };
+    const int extent[3] = { nx, ny,     nz     };
+    const int periods[3] = { 0, 0, 0 };
+
+    d->cart = MPI_COMM_NULL;
+    if (layout < 1 || layout > 3) return -1;
+
+    MPI_Comm_size(comm, &d->size);
+    for (int i = 0; i < 3; ++i) d->dims[i] = (i < layout) ? 0 : 1;
+    MPI_Dims_create(d->size, 3, d->dims);
+    MPI_Cart_create(comm, 3, d->dims, periods, 1, &d->cart);
+    MPI_Comm_rank(d->cart, &d->rank);
+    MPI_Cart_coords(d->cart, d->rank, 3, d->coords);
+
+    int ok = 1;
+    for (int i = 0; i < 3; ++i) {
+        int start, len;
+        split(count[i], d->dims[i], d->coords[i], &start, &len);
+        if (len < 1) ok = 0;
+
+        MPI_Cart_shift(d->cart, i, 1, &d->nbr[i][0], &d->nbr[i][1]);
+        d->ext[i] = extent[i];
+        set_extent(d, i, first[i] + start, len);
+    }
+
+    int all_ok = 0;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, d->cart);
+    if (!all_ok) {
+        MPI_Comm_free(&d->cart);
+        return -1;
+    }
+    return 0;
+}
+
+void mw_decomp_free(mw_decomp *d) {
+    if (d->cart != MPI_COMM_NULL) MPI_Comm_free(&d->cart);
+}
+
+int mw_decomp_grid(const mw_decomp *d, mw_grid *g) {
+    if (mw_grid_alloc(g, d->n[0] + 2, d->n[1] + 2, d->n[2] + 2) != 0) return -1;
+    mw_grid_init(g, d->lo[0] - 1, d->lo[1] - 1, d->lo[2] - 1);
+    return 0;
+}
+
+double mw_decomp_checksum(const mw_decomp *d, const mw_grid *g) {
+    return mw_checksum_box(g, d->sum_lo[0], d->sum_hi[0],
+                              d->sum_lo[1], d->sum_hi[1],
+                              d->sum_lo[2], d->sum_hi[2]);
+}
+
+void mw_decomp_stats(const mw_decomp *d, const mw_grid *g, mw_stats *s, int fused) {
+    if (fused) {
+        const int own_lo[3] = { 1, 1, 1 };
+        const int own_hi[3] = { d->n[0], d->n[1], d->n[2] };
+        mw_stats_shell(g, d->sum_lo, d->sum_hi, own_lo, own_hi, s);
+    } else {
+        mw_stats_clear(s);
+        mw_stats_box(g, d->sum_lo[0], d->sum_hi[0], d->sum_lo[1], d->sum_hi[1],
+                     d->sum_lo[2], d->sum_hi[2], s);
+    }
+}
+
+// Elementwise merge of packed mw_stats for MPI_Reduce.
+static void stats_op(void *in, void *inout, int *len, MPI_Datatype *type) {
+    (void)type;
+    const mw_stats *a = (const mw_stats*)in;
+    mw_stats *b = (mw_stats*)inout;
+    for (int i = 0; i < *len; ++i) mw_stats_merge(&b[i], &a[i]);
+}
+
+void mw_stats_reduce(const mw_stats *in, mw_stats *out, int root, MPI_Comm comm) {
+    static MPI_Datatype type = MPI_DATATYPE_NULL;
+    static MPI_Op op = MPI_OP_NULL;
+    if (type == MPI_DATATYPE_NULL) {
+        MPI_Type_contiguous(4, MPI_DOUBLE, &type);
+        MPI_Type_commit(&type);
+        MPI_Op_create(stats_op, 1, &op);
+    }
+    MPI_Reduce((void*)in, out, 1, type, op, root, comm);
+}
+
+void mw_conv_init(mw_conv *c, MPI_Comm comm, const char *norm_name, int norm, double tol,
+                  double interior) {
+    c->comm = comm;
+    c->norm_name = norm_name;
+    c->norm = norm;
+    c->tol = tol;
+    c->interior = interior;
+    c->req = MPI_REQUEST_NULL;
+    c->send = c->recv = 0.0;
+    c->residual = -1.0;
+    c->converged = 0;
+}
+
+// Waits for the posted reduction and records its residual.
+static void conv_wait(mw_conv *c) {
+    MPI_Wait(&c->req, MPI_STATUS_IGNORE);
+    c->residual = c->norm == MW_NORM_L2 ? sqrt(c->recv / c->interior) : c->recv;
+    c->converged = c->residual <= c->tol;
+}
+
+int mw_conv_check(mw_conv *c) {
+    if (c->req == MPI_REQUEST_NULL) return 0;
+    conv_wait(c);
+    return c->converged;
+}
+
+void mw_conv_post(mw_conv *c, double local) {
+    c->send = local;
+    MPI_Iallreduce(&c->send, &c->recv, 1, MPI_DOUBLE,
+                   c->norm == MW_NORM_L2 ? MPI_SUM : MPI_MAX, c->comm, &c->req);
+}
+
+void mw_conv_finish(mw_conv *c) {
+    if (c->req != MPI_REQUEST_NULL) conv_wait(c);
+}
+
+void mw_conv_format(const mw_conv *c, char *buf, size_t len, int steps, int steps_taken,
+                    int steps_run, double elapsed) {
+    snprintf(buf, len,
+             " CONVERGE=1 CONVERGE_NORM=%s CONVERGE_TOL=%.3e RESIDUAL=%.3e CONVERGED=%d "
+             "STEPS_TAKEN=%d TIME_SAVED=%.6f",
+             c->norm_name, c->tol, c->residual, c->converged, steps_taken,
+             steps_run > 0 ? (steps - steps_taken) * elapsed / steps_run : 0.0);
+}
+
+double mw_decomp_imbalance(const mw_decomp *d, double comp) {
+    double mx = 0.0, sum = 0.0;
+    MPI_Allreduce(&comp, &mx, 1, MPI_DOUBLE, MPI_MAX, d->cart);
+    MPI_Allreduce(&comp, &sum, 1, MPI_DOUBLE, MPI_SUM, d->cart);
+    return sum > 0.0 ? mx * d->size / sum : 1.0;
+}
+
+int mw_decomp_rebalance(mw_decomp *d, mw_grid *g, double comp) {
+    const int px = d->dims[0], me = d->coords[0];
+    if (px == 1) return 0;
+
+    // Per x-slab plane count and slowest rank (all ranks of a slab share
+    // the x range, so slabs are what can be resized)
+    int *cnt = (int*)calloc((size_t)px, sizeof(int));
+    int *b_old = (int*)malloc((size_t)(px + 1) * sizeof(int));
+    int *b_new = (int*)malloc((size_t)(px + 1) * sizeof(int));
+    double *t = (double*)calloc((size_t)px, sizeof(double));
+    if (!cnt || !b_old || !b_new || !t) MPI_Abort(d->cart, 2);
+    cnt[me] = d->n[0];
+    t[me] = comp;
+    MPI_Allreduce(MPI_IN_PLACE, cnt, px, MPI_INT, MPI_MAX, d->cart);
+    MPI_Allreduce(MPI_IN_PLACE, t, px, MPI_DOUBLE, MPI_MAX, d->cart);
+
+    // Target share proportional to measured planes per second. Boundaries
+    // move by at most half the smaller adjacent slab, so every slab keeps
+    // some of its planes and all migration is between x-neighbours.
+    double speed_sum = 0.0;
+    b_old[0] = 0;
+    for (int i = 0; i < px; ++i) {
+        b_old[i + 1] = b_old[i] + cnt[i];
+        t[i] = cnt[i] / (t[i] > 1e-12 ? t[i] : 1e-12);   // now a speed
+        speed_sum += t[i];
+    }
+    const int total = b_old[px];
+    int moved = 0;
+    double share = 0.0;
+    b_new[0] = 0;
+    b_new[px] = total;
+    for (int i = 1; i < px; ++i) {
+        share += t[i - 1];
+        int want = (int)(total * share / speed_sum + 0.5);
+        const int lim = ((cnt[i - 1] < cnt[i] ? cnt[i - 1] : cnt[i]) - 1) / 2;
+        if (want > b_old[i] + lim) want = b_old[i] + lim;
+        if (want < b_old[i] - lim) want = b_old[i] - lim;
+        b_new[i] = want;
+        if (want != b_old[i]) moved = 1;
+    }
+
+    const int olo = b_old[me], ohi = b_old[me + 1];   // [lo, hi)
+    const int nlo = b_new[me], nhi = b_new[me + 1];
+    free(cnt); free(b_old); free(b_new); free(t);
+    if (!moved) return 0;
+
+    mw_grid ng;
+    if (mw_grid_alloc(&ng, nhi - nlo + 2, g->sy, g->sz) != 0) MPI_Abort(d->cart, 2);
+
+    // Owned planes (global x index gx) live at local index gx - lo + 1
+    const int plane = (int)mw_plane_elems(g);
+    const int left = d->nbr[0][0], right = d->nbr[0][1];
+    MPI_Request req[4];
+    int nreq = 0;
+    if (nlo < olo)
+        MPI_Irecv(&ng.cur[MW_IDX(&ng,1,0,0)], (olo - nlo) * plane, MW_MPI_REAL,
+                  left, 120, d->cart, &req[nreq++]);
+    if (nhi > ohi)
+        MPI_Irecv(&ng.cur[MW_IDX(&ng,ohi - nlo + 1,0,0)], (nhi - ohi) * plane, MW_MPI_REAL,
+                  right, 121, d->cart, &req[nreq++]);
+    if (nlo > olo)
+        MPI_Isend(&g->cur[MW_IDX(g,1,0,0)], (nlo - olo) * plane, MW_MPI_REAL,
+                  left, 121, d->cart, &req[nreq++]);
+    if (nhi < ohi)
+        MPI_Isend(&g->cur[MW_IDX(g,nhi - olo + 1,0,0)], (ohi - nhi) * plane, MW_MPI_REAL,
+                  right, 120, d->cart, &req[nreq++]);
+
+    const int keep_lo = nlo > olo ? nlo : olo, keep_hi = nhi < ohi ? nhi : ohi;
+    if (keep_hi > keep_lo) {
+        memcpy(&ng.cur[MW_IDX(&ng,keep_lo - nlo + 1,0,0)], &g->cur[MW_IDX(g,keep_lo - olo + 1,0,0)],
+               (size_t)(keep_hi - keep_lo) * plane * sizeof(mw_real));
+    }
+    // Fixed ghost planes at the global x ends come along unchanged
+    if (left == MPI_PROC_NULL)
+        memcpy(&ng.cur[MW_IDX(&ng,0,0,0)], &g->cur[MW_IDX(g,0,0,0)], plane * sizeof(mw_real));
+    if (right == MPI_PROC_NULL)
+        memcpy(&ng.cur[MW_IDX(&ng,nhi - nlo + 1,0,0)], &g->cur[MW_IDX(g,ohi - olo + 1,0,0)],
+               plane * sizeof(mw_real));
+    MPI_Waitall(nreq, req, MPI_STATUSES_IGNORE);
+
+    // next needs the same fixed boundary cells; its interior is rewritten
+    memcpy(ng.next, ng.cur, ng.elems * sizeof(mw_real));
+    mw_grid_free(g);
+    *g = ng;
+    set_extent(d, 0, nlo, nhi - nlo);
+    return 1;
+}
@@ -0,0 +1,101 @@
+// miniweather_decomp.h - Cartesian domain decomposition
+#ifndef MINIWEATHER_DECOMP_H
+#define MINIWEATHER_DECOMP_H
+
+#include <mpi.h>
+#include "miniweather_core.h"
+
+// MPI datatype of a grid cell (see MW_PRECISION); halos move in storage
+// precision.
+#if MW_PRECISION == 32
+#define MW_MPI_REAL MPI_FLOAT
+#else
+#define MW_MPI_REAL MPI_DOUBLE
+#endif
+
+// Each direction splits the range of cells the stencil updates: x planes
+// 0..NX-1 (fixed ghost planes at -1 and NX, as in the original slab code),
+// y and z 1..N-2 (the fixed boundary rows act as ghosts). Blocks differ by
+// at most one cell. With one rank in y and z the local block is an x slab
+// of the full NY x NZ grid.
+typedef struct {
+    MPI_Comm cart;
+    int rank, size;
+    int dims[3], coords[3];
+    int lo[3];          // global index of the first owned cell
+    int n[3];           // owned cells; local arrays are n + 2 (one ghost layer)
+    int nbr[3][2];      // lower/upper neighbour, MPI_PROC_NULL at the edge
+    int sum_lo[3], sum_hi[3];  // local index range counted by the checksum
+    int ext[3];         // global array extent (NX, NY, NZ)
+} mw_decomp;
+
+// layout: 1, 2 or 3 directions split (x; x,y; x,y,z). Returns 0 on success,
+// -1 if the layout is invalid or some rank would own no cells.
+int  mw_decomp_create(mw_decomp *d, MPI_Comm comm, int layout,
+                      int nx, int ny, int nz);
+void mw_decomp_free(mw_decomp *d);
+
+// Allocates and initialises the local block described by d.
+int  mw_decomp_grid(const mw_decomp *d, mw_grid *g);
+
+// Halo exchange lives in miniweather_halo.h.
+
+// Load imbalance of a per-rank time: max / mean over all ranks (1 = even).
+double mw_decomp_imbalance(const mw_decomp *d, double comp);
+
+// Moves x-planes between x-neighbours so each x-slab gets a share of NX
+// proportional to its measured speed (planes / comp, slowest rank of the
+// slab). Boundaries move by at most half the smaller adjacent slab per
+// call. g is reallocated for the new extent with cur carried over (ghost
+// layers must be refreshed afterwards). Collective; returns 1 if any
+// planes moved.
+int mw_decomp_rebalance(mw_decomp *d, mw_grid *g, double comp);
+double mw_decomp_checksum(const mw_decomp *d, const mw_grid *g);
+
+// Local statistics over the cells of mw_decomp_checksum. With fused, s
+// already holds the owned block from a fused sweep and only the global
+// boundary layers outside it are added; otherwise s is recomputed in one
+// pass.
+void mw_decomp_stats(const mw_decomp *d, const mw_grid *g, mw_stats *s, int fused);
+
+// Merges every rank's statistics into out on root with one MPI_Reduce of
+// the packed struct (sum and cells added, min/max kept).
+void mw_stats_reduce(const mw_stats *in, mw_stats *out, int root, MPI_Comm comm);
+
+// Lagged convergence check: every K steps the local residual is reduced
+// with a nonblocking allreduce whose result is checked K steps later, so
+// the reduction never stalls the sweep (the run stops one interval late).
+typedef struct {
+    MPI_Comm comm;
+    const char *norm_name;  // echoed as CONVERGE_NORM
+    int norm;               // MW_NORM_*
+    double tol;
+    double interior;        // cells the L2 norm averages over
+    MPI_Request req;
+    double send, recv;
+    double residual;        // last reduced residual (-1: none yet)
+    int converged;
+} mw_conv;
+
+void mw_conv_init(mw_conv *c, MPI_Comm comm, const char *norm_name, int norm, double tol,
+                  double interior);
+
+// At a check step: completes the reduction posted at the previous one (long
+// done by now) and returns 1 if its residual is within tol. Returns 0 if
+// none was posted yet.
+int  mw_conv_check(mw_conv *c);
+
+// Starts the reduction of this rank's residual of the current step.
+void mw_conv_post(mw_conv *c, double local);
+
+// After the loop: completes a reduction still in flight, so residual and
+// converged describe the last check of a run that ended at STEPS.
+void mw_conv_finish(mw_conv *c);
+
+// METRICS suffix " CONVERGE=1 CONVERGE_NORM=... TIME_SAVED=..." for a run
+// of steps_run steps in elapsed seconds that stopped after steps_taken of
+// steps (TIME_SAVED: the skipped steps at that rate).
+void mw_conv_format(const mw_conv *c, char *buf, size_t len, int steps, int steps_taken,
+                    int steps_run, double elapsed);
+
+#endif
@@ -0,0 +1,111 @@
+// miniweather_deep.c - Deep x ghost zones: one halo exchange every k steps
+#include <stdio.h>
+#include <string.h>
+#include "miniweather_deep.h"
+
+int mw_deep_create(mw_deep *p, const mw_decomp *d, mw_grid *g, int k) {
+    memset(p, 0, sizeof *p);
+    p->d = d;
+    p->g = g;
+    p->k = k;
+    if (d->dims[1] != 1 || d->dims[2] != 1 || k < 1 || k > d->n[0]) return -1;
+    if (mw_grid_alloc(g, d->n[0] + 2 * k, d->n[1] + 2, d->n[2] + 2) != 0) return -1;
+    mw_grid_init(g, d->lo[0] - k, d->lo[1] - 1, d->lo[2] - 1);
+    return 0;
+}
+
+void mw_deep_exchange(mw_deep *p) {
+    const mw_decomp *d = p->d;
+    mw_grid *g = p->g;
+    const int k = p->k, lx = d->n[0];
+    const int count = k * (int)mw_plane_elems(g);
+    const int left = d->nbr[0][0], right = d->nbr[0][1];
+
+    MPI_Sendrecv(&g->cur[MW_IDX(g,k,     0,0)], count, MW_MPI_REAL, left,  100,
+                 &g->cur[MW_IDX(g,k+lx,  0,0)], count, MW_MPI_REAL, right, 100,
+                 d->cart, MPI_STATUS_IGNORE);
+
+    MPI_Sendrecv(&g->cur[MW_IDX(g,lx,    0,0)], count, MW_MPI_REAL, right, 101,
+                 &g->cur[MW_IDX(g,0,     0,0)], count, MW_MPI_REAL, left,  101,
+                 d->cart, MPI_STATUS_IGNORE);
+
+    for (int s = 0; s < 2; ++s) {
+        if (d->nbr[0][s] == MPI_PROC_NULL) continue;
+        p->messages += 1.0;
+        p->bytes += (double)count * sizeof(mw_real);
+    }
+}
+
+void mw_deep_steps(mw_deep *p, int n) {
+    const mw_decomp *d = p->d;
+    const int k = p->k, sx = p->g->sx;
+    for (int j = 0; j < n; ++j) {
+        const int lo = d->nbr[0][0] != MPI_PROC_NULL ? j + 1 : k;
+        const int hi = d->nbr[0][1] != MPI_PROC_NULL ? sx - 2 - j : k + d->n[0] - 1;
+        mw_step(p->g, lo, hi);
+        p->swept += hi - lo + 1;
+        p->owned += d->n[0];
+    }
+}
+
+double mw_deep_checksum(const mw_deep *p) {
+    const mw_decomp *d = p->d;
+    const int off = p->k - 1;
+    return mw_checksum_box(p->g, d->sum_lo[0] + off, d->sum_hi[0] + off,
+                           d->sum_lo[1], d->sum_hi[1], d->sum_lo[2], d->sum_hi[2]);
+}
+
+int mw_deep_run(mw_decomp *d, int k, int steps, const char *version, int threads) {
+    const MPI_Comm comm = d->cart;
+    mw_grid g;
+    mw_deep p;
+    int ok = mw_deep_create(&p, d, &g, k) == 0, all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, comm);
+    if (!all_ok) {
+        if (d->rank == 0) fprintf(stderr, "ERROR: --ghost-depth=%d needs --decomp=1 and at least %d x-planes per rank\n", k, k);
+        if (ok) mw_grid_free(&g);
+        return 1;
+    }
+
+    double comm_time = 0.0, comp_time = 0.0;
+    MPI_Barrier(comm);
+    const double t0 = MPI_Wtime();
+    for (int t = 0; t < steps; t += k) {
+        const double c0 = MPI_Wtime();
+        mw_deep_exchange(&p);
+        const double c1 = MPI_Wtime();
+        mw_deep_steps(&p, steps - t < k ? steps - t : k);
+        comp_time += MPI_Wtime() - c1;
+        comm_time += c1 - c0;
+    }
+    const double elapsed = MPI_Wtime() - t0;
+
+    double local_sum = mw_deep_checksum(&p), global_sum = 0.0;
+    MPI_Reduce(&local_sum, &global_sum, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+    double mx[3] = { elapsed, comm_time, comp_time }, max_v[3];
+    MPI_Reduce(mx, max_v, 3, MPI_DOUBLE, MPI_MAX, 0, comm);
+    double sums[5] = { p.messages, p.bytes, p.swept, p.owned, (double)mw_grid_bytes(&g) }, tot[5];
+    MPI_Reduce(sums, tot, 5, MPI_DOUBLE, MPI_SUM, 0, comm);
+
+    if (d->rank == 0) {
+        char who[128];
+        int n = snprintf(who, sizeof who, "VERSION=%s RANKS=%d", version, d->size);
+        if (threads > 0) snprintf(who + n, sizeof who - n, " THREADS=%d", threads);
+        // Redundant compute: planes swept beyond the owned ones, relative to them
+        const int *ext = d->ext;
+        const double cells = (double)ext[0] * ext[1] * ext[2];
+        printf("METRICS: %s DECOMP=%dx%dx%d GRID=%dx%dx%d STEPS=%d TIME=%.6f "
+               "COMM_TIME=%.6f COMP_TIME=%.6f COMM_PCT=%.2f COMP_PCT=%.2f HALO=sendrecv "
+               "GHOST_DEPTH=%d EXCHANGES=%d MESSAGES=%.0f HALO_BYTES=%.3e REDUNDANT_PCT=%.2f "
+               "THROUGHPUT_STEPS=%.2f THROUGHPUT_CELLS=%.2e SIMD=%s PRECISION=%d GRID_MB=%.1f "
+               "CHECKSUM=%.10e\n",
+               who, d->dims[0], d->dims[1], d->dims[2], ext[0], ext[1], ext[2], steps, max_v[0],
+               max_v[1], max_v[2], 100.0 * max_v[1] / max_v[0], 100.0 * max_v[2] / max_v[0],
+               k, (steps + k - 1) / k, tot[0], tot[1],
+               tot[3] > 0.0 ? 100.0 * (tot[2] - tot[3]) / tot[3] : 0.0,
+               steps / max_v[0], cells * steps / max_v[0], mw_simd_name(), MW_PRECISION,
+               tot[4] / 1048576.0, global_sum);
+    }
+    mw_grid_free(&g);
+    return 0;
+}
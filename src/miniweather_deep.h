@@ -0,0 +1,50 @@
+// miniweather_deep.h - Deep x ghost zones: one halo exchange every k steps
+#ifndef MINIWEATHER_DEEP_H
+#define MINIWEATHER_DEEP_H
+
+#include <mpi.h>
+#include "miniweather_core.h"
+#include "miniweather_decomp.h"
+
+// On an x-slab decomposition every rank keeps k ghost planes per side
+// (sx = n + 2k, owned planes k..k+n-1). One exchange refreshes all k of
+// them with the neighbours' outermost owned planes; the next k steps then
+// need no messages: step j (0-based) also updates the ghost planes that
+// are still valid, j+1..sx-2-j, so after k steps the owned planes are
+// exactly those of k single-plane steps. The planes swept beyond the owned
+// ones are the redundant compute paid for k times fewer messages. At a
+// global x edge only plane k-1 (the fixed boundary plane) is used.
+typedef struct {
+    const mw_decomp *d;
+    mw_grid *g;
+    int k;                  // ghost planes per side
+    double messages;        // messages sent by this rank
+    double bytes;           // bytes sent by this rank
+    double swept;           // x-planes swept, redundant ones included
+    double owned;           // owned x-planes times steps taken
+} mw_deep;
+
+// Allocates and initialises g as d's block with k ghost planes per x side
+// (same values as mw_decomp_grid in the planes both have). Returns -1 if d
+// is not an x-slab, k is not in 1..d->n[0] (ghosts must come from the
+// direct neighbour), or g cannot be allocated.
+int  mw_deep_create(mw_deep *p, const mw_decomp *d, mw_grid *g, int k);
+
+// Sends the k outermost owned planes of g->cur to each x neighbour and
+// receives its k into the ghost planes (one MPI_Sendrecv per direction).
+void mw_deep_exchange(mw_deep *p);
+
+// n <= k time steps after an exchange, each sweep one plane narrower per
+// side where a neighbour's ghosts are being consumed.
+void mw_deep_steps(mw_deep *p, int n);
+
+// Local part of the checksum (mw_decomp_checksum of a one-plane grid).
+double mw_deep_checksum(const mw_deep *p);
+
+// Whole --ghost-depth=k run over d: steps steps, one exchange every k, and
+// the METRICS line (rank 0). version is echoed as VERSION=; threads > 0
+// adds THREADS=. Collective over d->cart; returns 1 (after an ERROR on
+// rank 0) if some rank cannot hold k ghost planes.
+int    mw_deep_run(mw_decomp *d, int k, int steps, const char *version, int threads);
+
+#endif
@@ -0,0 +1,270 @@
+// miniweather_ens.c - Ensemble of small independent grids, member innermost
+//
+// The lane loop is plain C with a compile-time trip count; the compiler
+// vectorises it across members. Like the row kernels in miniweather_simd.c
+// it is built once per ISA with per-function target attributes and the
+// variant matching the selected row kernel is used.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "miniweather_ens.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    !defined(__NVCOMPILER) && !defined(_OPENACC)
+  #define MW_HAVE_X86_SIMD 1
+#endif
+
+#define LANES MW_ENS_LANES
+
+int mw_ens_parse_grid(const char *s, int n[3]) {
+    char tail;
+    int k = sscanf(s, "%dx%dx%d%c", &n[0], &n[1], &n[2], &tail);
+    if (k == 1 && strchr(s, 'x') == NULL) n[1] = n[2] = n[0];
+    else if (k != 3) return -1;
+    return (n[0] < 3 || n[1] < 3 || n[2] < 3) ? -1 : 0;
+}
+
+int mw_ens_alloc(mw_ens *e, int sx, int sy, int sz, int members, int first) {
+    memset(e, 0, sizeof *e);
+    e->sx = sx;
+    e->sy = sy;
+    e->sz = sz;
+    e->members = members;
+    e->first = first;
+    e->batches = (members + LANES - 1) / LANES;
+    e->cells = (size_t)sx * sy * sz;
+    const size_t bytes = (size_t)e->batches * e->cells * LANES * sizeof(mw_real);
+    if (bytes == 0) return 0;
+    if (posix_memalign((void**)&e->cur, MW_ALIGN, bytes) != 0) e->cur = NULL;
+    if (posix_memalign((void**)&e->next, MW_ALIGN, bytes) != 0) e->next = NULL;
+    if (!e->cur || !e->next) {
+        mw_ens_free(e);
+        return -1;
+    }
+    return 0;
+}
+
+void mw_ens_free(mw_ens *e) {
+    free(e->cur);
+    free(e->next);
+    e->cur = e->next = NULL;
+}
+
+// Uniform in [-1, 1) from the ensemble index and the cell (splitmix64).
+static double noise(uint64_t member, uint64_t cell) {
+    uint64_t z = member * 0x9E3779B97F4A7C15ull + cell * 0xBF58476D1CE4E5B9ull + 1;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    z ^= z >> 31;
+    return (double)(z >> 11) * 0x1.0p-52 - 1.0;
+}
+
+void mw_ens_init(mw_ens *e, double amp) {
+    const int sx = e->sx, sy = e->sy, sz = e->sz, nb = e->batches;
+    const size_t bstride = e->cells * LANES;
+
+#ifdef _OPENMP
+    #pragma omp parallel for collapse(2) schedule(static)
+#endif
+    for (int b = 0; b < nb; ++b) {
+        for (int x = 0; x < sx; ++x) {
+            for (int y = 0; y < sy; ++y) {
+                for (int z = 0; z < sz; ++z) {
+                    const size_t cell = ((size_t)x * sy + y) * sz + z;
+                    const int inner = x > 0 && x < sx - 1 && y > 0 && y < sy - 1 &&
+                                      z > 0 && z < sz - 1;
+                    mw_real *a = &e->cur[b * bstride + cell * LANES];
+                    mw_real *n = &e->next[b * bstride + cell * LANES];
+                    for (int l = 0; l < LANES; ++l) {
+                        const int m = b * LANES + l;
+                        double v = 0.0;
+                        if (m < e->members) {
+                            v = mw_init_value(x, y, z);
+                            if (inner && e->first + m > 0) v += amp * noise(e->first + m, cell);
+                        }
+                        a[l] = n[l] = (mw_real)v;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Interior of plane x of one batch. Each lane sums its neighbours in the
+// order of mw_stencil_row (x, then y, then z).
+static inline __attribute__((always_inline))
+void ens_plane(const mw_real *restrict g, mw_real *restrict ng, int x, int sy, int sz) {
+    const size_t pz = LANES, py = (size_t)sz * LANES, px = (size_t)sy * sz * LANES;
+    for (int y = 1; y < sy - 1; ++y) {
+        for (int z = 1; z < sz - 1; ++z) {
+            const size_t c = (((size_t)x * sy + y) * sz + z) * LANES;
+            for (int l = 0; l < LANES; ++l) {
+                ng[c + l] = (mw_real)(((double)g[c - px + l] + g[c + px + l] +
+                                       g[c - py + l] + g[c + py + l] +
+                                       g[c - pz + l] + g[c + pz + l]) / 6.0);
+            }
+        }
+    }
+}
+
+typedef void (*ens_plane_fn)(const mw_real *restrict g, mw_real *restrict ng,
+                             int x, int sy, int sz);
+
+static void plane_generic(const mw_real *restrict g, mw_real *restrict ng,
+                          int x, int sy, int sz) {
+    ens_plane(g, ng, x, sy, sz);
+}
+
+#ifdef MW_HAVE_X86_SIMD
+__attribute__((target("avx2")))
+static void plane_avx2(const mw_real *restrict g, mw_real *restrict ng,
+                       int x, int sy, int sz) {
+    ens_plane(g, ng, x, sy, sz);
+}
+
+__attribute__((target("avx512f,prefer-vector-width=512")))
+static void plane_avx512(const mw_real *restrict g, mw_real *restrict ng,
+                         int x, int sy, int sz) {
+    ens_plane(g, ng, x, sy, sz);
+}
+#endif
+
+static ens_plane_fn plane_select(void) {
+#ifdef MW_HAVE_X86_SIMD
+    const char *k = mw_simd_name();
+    if (strcmp(k, "avx512") == 0) return plane_avx512;
+    if (strcmp(k, "avx2") == 0) return plane_avx2;
+#endif
+    return plane_generic;
+}
+
+void mw_ens_step(mw_ens *e) {
+    const ens_plane_fn fn = plane_select();
+    const int sx = e->sx, sy = e->sy, sz = e->sz, nb = e->batches;
+    const size_t bstride = e->cells * LANES;
+    const mw_real *cur = e->cur;
+    mw_real *next = e->next;
+
+#ifdef _OPENMP
+    #pragma omp parallel for collapse(2) schedule(static)
+#endif
+    for (int b = 0; b < nb; ++b) {
+        for (int x = 1; x < sx - 1; ++x) {
+            fn(cur + b * bstride, next + b * bstride, x, sy, sz);
+        }
+    }
+
+    mw_real *tmp = e->cur;
+    e->cur = e->next;
+    e->next = tmp;
+}
+
+void mw_ens_checksums(const mw_ens *e, double *sums) {
+    const int nb = e->batches;
+    const size_t bstride = e->cells * LANES;
+
+    // One batch per thread; every lane adds its cells in x, y, z order
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for (int b = 0; b < nb; ++b) {
+        double s[LANES] = { 0.0 };
+        const mw_real *v = &e->cur[b * bstride];
+        for (size_t c = 0; c < e->cells; ++c) {
+            for (int l = 0; l < LANES; ++l) s[l] += v[c * LANES + l];
+        }
+        for (int l = 0; l < LANES && b * LANES + l < e->members; ++l) sums[b * LANES + l] = s[l];
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Ensemble mode of the drivers
+// ---------------------------------------------------------------------------
+
+static double wtime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int mw_ens_run(const mw_opts *o, MPI_Comm comm, int steps, const char *version, int threads) {
+    int rank = 0, size = 1;
+    if (comm != MPI_COMM_NULL) {
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &size);
+    }
+    int n[3];
+    if (mw_ens_parse_grid(o->ensemble_grid, n) != 0) {
+        if (rank == 0) fprintf(stderr, "ERROR: bad ensemble grid '%s'\n", o->ensemble_grid);
+        return 1;
+    }
+    const int M = o->ensemble;
+    const int first = (int)((long)M * rank / size);
+    const int count = (int)((long)M * (rank + 1) / size) - first;
+
+    mw_ens e;
+    double *local = (double*)malloc((size_t)(count ? count : 1) * sizeof(double));
+    double *sums = rank == 0 ? (double*)malloc((size_t)M * sizeof(double)) : NULL;
+    int *counts = rank == 0 ? (int*)malloc((size_t)size * 2 * sizeof(int)) : NULL;
+    int ok = local && (rank != 0 || (sums && counts)) &&
+             mw_ens_alloc(&e, n[0], n[1], n[2], count, first) == 0, all_ok = ok;
+    if (comm != MPI_COMM_NULL) MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, comm);
+    if (!all_ok) {
+        if (rank == 0) fprintf(stderr, "ERROR: cannot allocate %d ensemble members of %dx%dx%d\n",
+                               M, n[0], n[1], n[2]);
+        return 2;
+    }
+    mw_ens_init(&e, o->ensemble_perturb);
+
+    if (comm != MPI_COMM_NULL) MPI_Barrier(comm);
+    const double t0 = wtime();
+    for (int t = 0; t < steps; ++t) mw_ens_step(&e);
+    double elapsed = wtime() - t0;
+
+    // Per-member checksums in ensemble order on rank 0, with the buffer
+    // size and batch count of all ranks
+    mw_ens_checksums(&e, local);
+    double mine[2] = { 2.0 * e.batches * e.cells * MW_ENS_LANES * sizeof(mw_real), e.batches };
+    double total[2] = { mine[0], mine[1] };
+    if (comm != MPI_COMM_NULL) {
+        MPI_Allreduce(MPI_IN_PLACE, &elapsed, 1, MPI_DOUBLE, MPI_MAX, comm);
+        if (rank == 0) {
+            for (int r = 0; r < size; ++r) {
+                counts[size + r] = (int)((long)M * r / size);
+                counts[r] = (int)((long)M * (r + 1) / size) - counts[size + r];
+            }
+        }
+        MPI_Gatherv(local, count, MPI_DOUBLE, sums, counts, counts ? counts + size : NULL,
+                    MPI_DOUBLE, 0, comm);
+        MPI_Reduce(mine, total, 2, MPI_DOUBLE, MPI_SUM, 0, comm);
+    } else {
+        memcpy(sums, local, (size_t)M * sizeof(double));
+    }
+
+    if (rank == 0) {
+        double sum = 0.0;
+        for (int m = 0; m < M; ++m) {
+            printf("ENSEMBLE: MEMBER=%d CHECKSUM=%.10e\n", m, sums[m]);
+            sum += sums[m];
+        }
+        char who[96];
+        int len = snprintf(who, sizeof who, "VERSION=%s", version);
+        if (comm != MPI_COMM_NULL) len += snprintf(who + len, sizeof who - len, " RANKS=%d", size);
+        if (threads > 0) snprintf(who + len, sizeof who - len, " THREADS=%d", threads);
+        // Aggregate throughput: cell updates of all members per second
+        const double cells = (double)M * e.cells;
+        printf("METRICS: %s SOLVER=ensemble ENSEMBLE=%d GRID=%dx%dx%d STEPS=%d "
+               "TIME=%.6f THROUGHPUT_STEPS=%.2f THROUGHPUT_CELLS=%.2e LANES=%d BATCHES=%.0f "
+               "ENSEMBLE_PERTURB=%.3e GRID_MB=%.1f SIMD=%s PRECISION=%d CHECKSUM=%.10e\n",
+               who, M, n[0], n[1], n[2], steps, elapsed, steps / elapsed,
+               cells * steps / elapsed, MW_ENS_LANES, total[1], o->ensemble_perturb,
+               total[0] / 1048576.0, mw_simd_name(), MW_PRECISION, sum);
+    }
+    mw_ens_free(&e);
+    free(local);
+    free(sums);
+    free(counts);
+    return 0;
+}
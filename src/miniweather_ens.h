@@ -0,0 +1,61 @@
+// miniweather_ens.h - Ensemble of small independent grids, member innermost
+#ifndef MINIWEATHER_ENS_H
+#define MINIWEATHER_ENS_H
+
+#include <mpi.h>
+#include "miniweather_core.h"
+#include "miniweather_opts.h"
+
+// Members are grouped into batches of MW_ENS_LANES (one MW_ALIGN line of
+// cells). A batch stores cell (x,y,z) of all its members next to each
+// other, [x][y][z][lane], so the stencil of one cell is a vector operation
+// across members with the same neighbour offsets for every lane. Each
+// member's sums are taken in the order of mw_stencil_row, so a member is
+// bit-identical to a single-grid run from the same state. Lanes past the
+// last member hold 0 and are swept but never reported.
+#define MW_ENS_LANES MW_ZPAD
+
+typedef struct {
+    int sx, sy, sz;         // member grid, fixed boundary layers included
+    int members;            // members held by this process
+    int first;              // ensemble index of member 0 (seeds the perturbation)
+    int batches;            // members / MW_ENS_LANES, rounded up
+    size_t cells;           // sx * sy * sz
+    mw_real *cur, *next;    // batches x cells x MW_ENS_LANES
+} mw_ens;
+
+// Parses "NXxNYxNZ" (or "N" for a cube) into n; every extent must be at
+// least 3. Returns -1 if malformed.
+int  mw_ens_parse_grid(const char *s, int n[3]);
+
+// Members first..first+members-1 of the ensemble on an sx x sy x sz grid.
+// Returns -1 if the buffers cannot be allocated.
+int  mw_ens_alloc(mw_ens *e, int sx, int sy, int sz, int members, int first);
+void mw_ens_free(mw_ens *e);
+
+// Fills both buffers with mw_init_value of every cell (the state of
+// mw_grid_init(0,0,0)) and adds amp * noise in [-1, 1) to the interior
+// cells of every member but ensemble member 0 (the unperturbed control).
+// The noise depends only on the ensemble index and the cell, not on how
+// members are split over ranks. Batches and x-planes are spread over
+// threads like in mw_ens_step, so most pages are first-touched by the
+// thread sweeping them.
+void mw_ens_init(mw_ens *e, double amp);
+
+// One time step of every member, then swap. Threads split (batch, x-plane)
+// pairs; the lane loop uses the ISA of the row kernel selected by
+// mw_simd_select.
+void mw_ens_step(mw_ens *e);
+
+// Sum over all cells of every member (the CHECKSUM of a single-grid run).
+void mw_ens_checksums(const mw_ens *e, double *sums);
+
+// The drivers' --ensemble mode: o->ensemble members of o->ensemble_grid
+// advanced `steps` steps, split over the ranks of comm in contiguous
+// blocks (MPI_COMM_NULL: all in this process, no MPI calls). Rank 0
+// prints every member's checksum in ensemble order and the METRICS line
+// with VERSION=version, RANKS= for a communicator and THREADS= if
+// threads > 0. Returns 1 for a bad grid, 2 if members cannot be allocated.
+int  mw_ens_run(const mw_opts *o, MPI_Comm comm, int steps, const char *version, int threads);
+
+#endif
@@ -0,0 +1,260 @@
+// miniweather_fields.c - Multi-variable state with a compile-time layout
+//
+// Not part of the core libraries: MW_LAYOUT changes the indexing of every
+// function here, so each layout build compiles this file into its binary.
+#include <stdlib.h>
+#include <string.h>
+#include "miniweather_fields.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    !defined(__NVCOMPILER) && !defined(_OPENACC)
+  #define MW_HAVE_X86_SIMD 1
+#endif
+
+#define NV MW_NVARS
+#define B  MW_FIELDS_BLOCK
+
+// SoA buffers are offset like mw_grid's so z = 1 of every row is aligned
+// for the row kernels; the interleaved layouts align the start of a row.
+#if MW_LAYOUT == MW_LAYOUT_SOA
+#define FIELDS_OFF (MW_ZPAD - 1)
+#else
+#define FIELDS_OFF 0
+#endif
+
+const char *mw_fields_layout_name(void) {
+#if MW_LAYOUT == MW_LAYOUT_SOA
+    return "soa";
+#elif MW_LAYOUT == MW_LAYOUT_AOS
+    return "aos";
+#else
+    return "aosoa";
+#endif
+}
+
+const char *mw_fields_var_name(int v) {
+    static const char *names[NV] = { "rho", "u", "v", "w", "theta" };
+    return v >= 0 && v < NV ? names[v] : "?";
+}
+
+double mw_fields_scale(int v) {
+    static const double scale[NV] = { 1.0, 0.5, 0.25, -0.5, 2.0 };
+    return scale[v];
+}
+
+static mw_real *alloc_buffer(size_t elems) {
+    void *p = NULL;
+    if (posix_memalign(&p, MW_ALIGN, (elems + MW_ZPAD) * sizeof(mw_real)) != 0) return NULL;
+    return (mw_real*)p + FIELDS_OFF;
+}
+
+static void free_buffer(mw_real *b) {
+    if (b) free(b - FIELDS_OFF);
+}
+
+int mw_fields_alloc(mw_fields *f, const mw_decomp *d) {
+    memset(f, 0, sizeof *f);
+    f->sx = d->n[0] + 2;
+    f->sy = d->n[1] + 2;
+    f->sz = d->n[2] + 2;
+    f->zs = (f->sz + B - 1) / B * B;
+    f->elems = (size_t)NV * f->sx * f->sy * f->zs;
+    f->cur = alloc_buffer(f->elems);
+    f->next = alloc_buffer(f->elems);
+    if (!f->cur || !f->next) {
+        mw_fields_free(f);
+        return -1;
+    }
+
+    // Same values as mw_grid_init(g, lo - 1) per variable, pads included
+    const int sx = f->sx, sy = f->sy, sz = f->sz, zs = f->zs;
+    const int gx0 = d->lo[0] - 1, gy0 = d->lo[1] - 1, gz0 = d->lo[2] - 1;
+    mw_real *restrict a = f->cur, *restrict b = f->next;
+#ifdef _OPENMP
+    #pragma omp parallel for collapse(2) schedule(static)
+#endif
+    for (int x = 0; x < sx; ++x) {
+        for (int y = 0; y < sy; ++y) {
+            for (int v = 0; v < NV; ++v) {
+                for (int z = 0; z < zs; ++z) {
+                    const size_t i = MW_FIDX(f, v, x, y, z);
+                    a[i] = b[i] = z < sz ? (mw_real)(mw_fields_scale(v) *
+                                                     mw_init_value(gx0 + x, gy0 + y, gz0 + z)) : 0;
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+void mw_fields_free(mw_fields *f) {
+    free_buffer(f->cur);
+    free_buffer(f->next);
+    f->cur = f->next = NULL;
+}
+
+#if MW_LAYOUT != MW_LAYOUT_SOA
+// Interior of row (x, y), every variable. Each cell sums its neighbours in
+// the order of mw_stencil_row (x, then y, then z).
+static inline __attribute__((always_inline))
+void fields_row(const mw_real *restrict g, mw_real *restrict ng, int x, int y,
+                int sy, int sz, int zs) {
+    const size_t px = (size_t)sy * zs * NV, py = (size_t)zs * NV;
+    const size_t r = ((size_t)x * sy + y) * zs * NV;
+#define CELL(i, zm, zp) \
+    ng[i] = (mw_real)(((double)g[(i) - px] + g[(i) + px] + g[(i) - py] + g[(i) + py] + \
+                       g[zm] + g[zp]) / 6.0)
+#if MW_LAYOUT == MW_LAYOUT_AOS
+    // The interior is one contiguous run of cells x variables; z neighbours
+    // are MW_NVARS elements away
+    for (size_t i = r + NV; i < r + (size_t)(sz - 1) * NV; ++i) CELL(i, i - NV, i + NV);
+#else
+    // Full blocks sweep all lanes with in-block z neighbours, then redo the
+    // first and last lane, whose z-1 / z+1 lives in the previous / next
+    // block. Partial blocks (the ends of the row) go lane by lane.
+    for (int k = 0; k < zs / B; ++k) {
+        const int l0 = k == 0 ? 1 : 0;
+        const int l1 = sz - 1 - k * B < B ? sz - 1 - k * B : B;
+        for (int v = 0; v < NV; ++v) {
+            const size_t q = r + (size_t)k * B * NV + (size_t)v * B;
+            const size_t qm = q - B * NV + B - 1, qp = q + B * NV;
+            if (l0 == 0 && l1 == B) {
+                for (int l = 0; l < B; ++l) CELL(q + l, q + l - 1, q + l + 1);
+                CELL(q, qm, q + 1);
+                CELL(q + B - 1, q + B - 2, qp);
+            } else {
+                for (int l = l0; l < l1; ++l) {
+                    CELL(q + l, l > 0 ? q + l - 1 : qm, l < B - 1 ? q + l + 1 : qp);
+                }
+            }
+        }
+    }
+#endif
+#undef CELL
+}
+
+typedef void (*fields_row_fn)(const mw_real *restrict g, mw_real *restrict ng,
+                              int x, int y, int sy, int sz, int zs);
+
+static void row_generic(const mw_real *restrict g, mw_real *restrict ng,
+                        int x, int y, int sy, int sz, int zs) {
+    fields_row(g, ng, x, y, sy, sz, zs);
+}
+
+#ifdef MW_HAVE_X86_SIMD
+__attribute__((target("avx2")))
+static void row_avx2(const mw_real *restrict g, mw_real *restrict ng,
+                     int x, int y, int sy, int sz, int zs) {
+    fields_row(g, ng, x, y, sy, sz, zs);
+}
+
+__attribute__((target("avx512f,prefer-vector-width=512")))
+static void row_avx512(const mw_real *restrict g, mw_real *restrict ng,
+                       int x, int y, int sy, int sz, int zs) {
+    fields_row(g, ng, x, y, sy, sz, zs);
+}
+#endif
+
+// Variant matching the row kernel picked by mw_simd_select
+static fields_row_fn row_select(void) {
+#ifdef MW_HAVE_X86_SIMD
+    const char *k = mw_simd_name();
+    if (strcmp(k, "avx512") == 0) return row_avx512;
+    if (strcmp(k, "avx2") == 0) return row_avx2;
+#endif
+    return row_generic;
+}
+#endif
+
+void mw_fields_step(mw_fields *f) {
+    const mw_real *restrict g = f->cur;
+    mw_real *restrict ng = f->next;
+    const int sx = f->sx, sy = f->sy, sz = f->sz, zs = f->zs;
+
+#if MW_LAYOUT == MW_LAYOUT_SOA
+    const mw_row_fn row = mw_row_kernel;
+    const size_t px = (size_t)sy * zs, vs = (size_t)sx * px;
+#ifdef _OPENMP
+    #pragma omp parallel for collapse(3) schedule(static)
+#endif
+    for (int v = 0; v < NV; ++v) {
+        for (int x = 1; x < sx - 1; ++x) {
+            for (int y = 1; y < sy - 1; ++y) {
+                row(g + v * vs, ng + v * vs, ((size_t)x * sy + y) * zs, px, zs, 1, sz - 1);
+            }
+        }
+    }
+#else
+    const fields_row_fn row = row_select();
+#ifdef _OPENMP
+    #pragma omp parallel for collapse(2) schedule(static)
+#endif
+    for (int x = 1; x < sx - 1; ++x) {
+        for (int y = 1; y < sy - 1; ++y) row(g, ng, x, y, sy, sz, zs);
+    }
+#endif
+
+    mw_real *tmp = f->cur;
+    f->cur = f->next;
+    f->next = tmp;
+}
+
+double mw_fields_checksum(const mw_fields *f, const mw_decomp *d, int v) {
+    const mw_real *restrict g = f->cur;
+    double sum = 0.0;
+#ifdef _OPENMP
+    #pragma omp parallel for collapse(3) reduction(+:sum)
+#endif
+    for (int x = d->sum_lo[0]; x <= d->sum_hi[0]; ++x) {
+        for (int y = d->sum_lo[1]; y <= d->sum_hi[1]; ++y) {
+            for (int z = d->sum_lo[2]; z <= d->sum_hi[2]; ++z) {
+                sum += g[MW_FIDX(f, v, x, y, z)];
+            }
+        }
+    }
+    return sum;
+}
+
+int mw_fields_halo_create(mw_fields_halo *h, const mw_decomp *d, mw_fields *f) {
+    memset(h, 0, sizeof *h);
+    h->d = d;
+    h->f = f;
+    h->face = MPI_DATATYPE_NULL;
+    if (d->dims[1] != 1 || d->dims[2] != 1) return -1;
+
+    const int plane = f->sy * f->zs;
+#if MW_LAYOUT == MW_LAYOUT_SOA
+    const MPI_Aint vs = (MPI_Aint)f->sx * plane * (MPI_Aint)sizeof(mw_real);
+    MPI_Type_create_hvector(NV, plane, vs, MW_MPI_REAL, &h->face);
+#else
+    MPI_Type_contiguous(NV * plane, MW_MPI_REAL, &h->face);
+#endif
+    MPI_Type_commit(&h->face);
+
+    for (int s = 0; s < 2; ++s) {
+        if (d->nbr[0][s] != MPI_PROC_NULL) h->bytes += (double)NV * plane * sizeof(mw_real);
+    }
+    return 0;
+}
+
+void mw_fields_halo_free(mw_fields_halo *h) {
+    if (h->face != MPI_DATATYPE_NULL) MPI_Type_free(&h->face);
+}
+
+void mw_fields_exchange(mw_fields_halo *h) {
+    const double t0 = MPI_Wtime();
+    const mw_fields *f = h->f;
+    const int *nbr = h->d->nbr[0];
+    mw_real *g = f->cur;
+    MPI_Request req[4];
+
+    // Tag = direction of travel: 0 towards lower x, 1 towards upper x
+    MPI_Irecv(&g[MW_FIDX(f, 0, 0, 0, 0)], 1, h->face, nbr[0], 1, h->d->cart, &req[0]);
+    MPI_Irecv(&g[MW_FIDX(f, 0, f->sx - 1, 0, 0)], 1, h->face, nbr[1], 0, h->d->cart, &req[1]);
+    MPI_Isend(&g[MW_FIDX(f, 0, 1, 0, 0)], 1, h->face, nbr[0], 0, h->d->cart, &req[2]);
+    MPI_Isend(&g[MW_FIDX(f, 0, f->sx - 2, 0, 0)], 1, h->face, nbr[1], 1, h->d->cart, &req[3]);
+    MPI_Waitall(4, req, MPI_STATUSES_IGNORE);
+
+    h->time += MPI_Wtime() - t0;
+    h->count++;
+}
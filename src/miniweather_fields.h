@@ -0,0 +1,96 @@
+// miniweather_fields.h - Multi-variable state with a compile-time layout
+#ifndef MINIWEATHER_FIELDS_H
+#define MINIWEATHER_FIELDS_H
+
+#include <mpi.h>
+#include "miniweather_core.h"
+#include "miniweather_decomp.h"
+
+// Prognostic variables of the state, in storage order.
+enum { MW_VAR_RHO, MW_VAR_U, MW_VAR_V, MW_VAR_W, MW_VAR_THETA, MW_NVARS };
+
+// Memory layout, fixed at build time with -DMW_LAYOUT=MW_LAYOUT_...
+//   SOA    one padded grid per variable: [var][x][y][z]
+//   AOS    the variables of a cell side by side: [x][y][z][var]
+//   AOSOA  z-rows cut into blocks of MW_FIELDS_BLOCK cells (one MW_ALIGN
+//          line), each block holding every variable in turn:
+//          [x][y][z / B][var][z % B]
+// Rows are padded to zs cells (a multiple of MW_FIELDS_BLOCK) in all three,
+// so an x-plane of one variable is sy * zs cells and an x-plane of the
+// state MW_NVARS times that; pad cells hold 0 and are never read.
+#define MW_LAYOUT_SOA   0
+#define MW_LAYOUT_AOS   1
+#define MW_LAYOUT_AOSOA 2
+#ifndef MW_LAYOUT
+#define MW_LAYOUT MW_LAYOUT_SOA
+#endif
+
+#define MW_FIELDS_BLOCK MW_ZPAD
+
+typedef struct {
+    int sx, sy, sz;
+    int zs;             // padded row length
+    size_t elems;       // MW_NVARS * sx * sy * zs
+    mw_real *cur, *next;
+} mw_fields;
+
+#if MW_LAYOUT == MW_LAYOUT_SOA
+#define MW_FIDX(f,v,x,y,z) \
+    ( (((size_t)(v) * (f)->sx + (x)) * (f)->sy + (y)) * (f)->zs + (z) )
+#elif MW_LAYOUT == MW_LAYOUT_AOS
+#define MW_FIDX(f,v,x,y,z) \
+    ( (((size_t)(x) * (f)->sy + (y)) * (f)->zs + (z)) * MW_NVARS + (v) )
+#elif MW_LAYOUT == MW_LAYOUT_AOSOA
+#define MW_FIDX(f,v,x,y,z) \
+    ( ((size_t)(x) * (f)->sy + (y)) * (f)->zs * MW_NVARS + \
+      (size_t)((z) / MW_FIELDS_BLOCK) * MW_FIELDS_BLOCK * MW_NVARS + \
+      (size_t)(v) * MW_FIELDS_BLOCK + (z) % MW_FIELDS_BLOCK )
+#else
+#error "MW_LAYOUT must be MW_LAYOUT_SOA, MW_LAYOUT_AOS or MW_LAYOUT_AOSOA"
+#endif
+
+const char *mw_fields_layout_name(void);
+const char *mw_fields_var_name(int v);
+
+// Local block of d (n + 2 cells per direction, like mw_decomp_grid).
+// Variable v starts as mw_fields_scale(v) times the scalar initial state,
+// so with power-of-two scales every variable stays exactly that multiple
+// of a scalar run and variable 0 is bit-identical to it. Threads fill
+// (x, y) rows with a static schedule, so pages are first-touched near the
+// threads sweeping them. Returns -1 if the buffers cannot be allocated.
+int  mw_fields_alloc(mw_fields *f, const mw_decomp *d);
+void mw_fields_free(mw_fields *f);
+double mw_fields_scale(int v);
+
+// One time step of every variable over planes 1..sx-2, interior y/z, then
+// swap. Each variable diffuses with the 6-point stencil in the summation
+// order of mw_stencil_row, so results do not depend on the layout. SoA
+// rows go through mw_row_kernel; the interleaved layouts sweep all
+// variables of a row in one pass.
+void mw_fields_step(mw_fields *f);
+
+// Sum of variable v over the checksum box of d (mw_decomp_checksum of a
+// scalar grid).
+double mw_fields_checksum(const mw_fields *f, const mw_decomp *d, int v);
+
+// Fused halo: each x-face of the state, all variables, is one message.
+// In the interleaved layouts a face is contiguous; in SoA it is described
+// by a datatype of MW_NVARS strided planes, so MPI gathers it without a
+// pack buffer. Needs an x-slab decomposition (d->dims[1] == d->dims[2] == 1).
+typedef struct {
+    const mw_decomp *d;
+    mw_fields *f;
+    MPI_Datatype face;
+    double bytes;       // payload sent per exchange by this rank
+    double time;        // accumulated seconds in mw_fields_exchange
+    int count;          // exchanges so far
+} mw_fields_halo;
+
+// Returns -1 if the decomposition is not an x-slab.
+int  mw_fields_halo_create(mw_fields_halo *h, const mw_decomp *d, mw_fields *f);
+void mw_fields_halo_free(mw_fields_halo *h);
+
+// Refreshes both x ghost planes of f->cur.
+void mw_fields_exchange(mw_fields_halo *h);
+
+#endif
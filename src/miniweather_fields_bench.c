@@ -0,0 +1,134 @@
+// miniweather_fields_bench.c - Multi-variable state: layout bandwidth and fused halo cost
+//
+// Built once per layout (miniweather_fields_soa, _aos, _aosoa). Every step
+// exchanges the x ghost planes of all variables in one message per
+// neighbour and then sweeps every variable; the METRICS line splits the
+// time into sweep bandwidth and halo cost so the layouts can be compared
+// with scripts/bench.py (make fields_bench).
+#include <stdio.h>
+#include <string.h>
+#include <mpi.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "miniweather_core.h"
+#include "miniweather_decomp.h"
+#include "miniweather_fields.h"
+
+#ifndef NX
+#define NX 64
+#endif
+#ifndef NY
+#define NY 64
+#endif
+#ifndef NZ
+#define NZ 64
+#endif
+#ifndef STEPS
+#define STEPS 20
+#endif
+
+int main(int argc, char **argv) {
+    // Funneled: halos are exchanged by the master thread between sweeps
+    int provided = MPI_THREAD_SINGLE;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+    MPI_Comm comm = MPI_COMM_WORLD;
+
+    int rank = 0, size = 1;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // Only the row kernel is selectable; the grid is compile-time as in
+    // the other drivers
+    const char *simd = "auto";
+    for (int i = 1; i < argc; ++i) {
+        if (strncmp(argv[i], "--simd=", 7) == 0) {
+            simd = argv[i] + 7;
+        } else {
+            if (rank == 0) fprintf(stderr, "ERROR: unknown option %s\n", argv[i]);
+            MPI_Abort(comm, 1);
+        }
+    }
+    if (!mw_simd_select(simd)) {
+        if (rank == 0) fprintf(stderr, "ERROR: SIMD kernel '%s' not available\n", simd);
+        MPI_Abort(comm, 1);
+    }
+
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+
+    mw_decomp d;
+    if (mw_decomp_create(&d, comm, 1, NX, NY, NZ) != 0) {
+        if (rank == 0) fprintf(stderr, "ERROR: cannot split %d x-planes over %d ranks\n", NX, size);
+        MPI_Abort(comm, 1);
+    }
+
+    mw_fields f;
+    int ok = mw_fields_alloc(&f, &d) == 0, all_ok = 0;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, comm);
+    if (!all_ok) {
+        if (rank == 0) fprintf(stderr, "ERROR: cannot allocate %d fields\n", MW_NVARS);
+        MPI_Abort(comm, 2);
+    }
+
+    mw_fields_halo h;
+    if (mw_fields_halo_create(&h, &d, &f) != 0) {
+        if (rank == 0) fprintf(stderr, "ERROR: fused halo needs an x-slab decomposition\n");
+        MPI_Abort(comm, 1);
+    }
+
+    MPI_Barrier(comm);
+    double comp_time = 0.0;
+    const double t0 = MPI_Wtime();
+    for (int step = 0; step < STEPS; ++step) {
+        mw_fields_exchange(&h);
+        const double c0 = MPI_Wtime();
+        mw_fields_step(&f);
+        comp_time += MPI_Wtime() - c0;
+    }
+    const double elapsed = MPI_Wtime() - t0;
+
+    double local[4] = { elapsed, comp_time, h.time, h.bytes }, maxv[4];
+    MPI_Reduce(local, maxv, 4, MPI_DOUBLE, MPI_MAX, 0, comm);
+    double bytes = 2.0 * f.elems * sizeof(mw_real), total_bytes = 0.0;
+    MPI_Reduce(&bytes, &total_bytes, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+
+    double sums[MW_NVARS], total[MW_NVARS];
+    for (int v = 0; v < MW_NVARS; ++v) sums[v] = mw_fields_checksum(&f, &d, v);
+    MPI_Reduce(sums, total, MW_NVARS, MPI_DOUBLE, MPI_SUM, 0, comm);
+
+    if (rank == 0) {
+        const double max_elapsed = maxv[0], max_comp = maxv[1], max_halo = maxv[2];
+        const double cells = (double)NX * NY * NZ;
+        // Modelled traffic: every variable streams both buffers once per sweep
+        const double sweep_bytes = MW_NVARS * cells * mw_bytes_per_update(1) * STEPS;
+        const double halo_per = h.count > 0 ? max_halo / h.count : 0.0;
+        double checksum = 0.0;
+        for (int v = 0; v < MW_NVARS; ++v) {
+            printf("FIELDS: VAR=%s SCALE=%.2f CHECKSUM=%.10e\n",
+                   mw_fields_var_name(v), mw_fields_scale(v), total[v]);
+            checksum += total[v];
+        }
+        printf("METRICS: VERSION=fields LAYOUT=%s VARS=%d BLOCK=%d RANKS=%d THREADS=%d "
+               "GRID=%dx%dx%d STEPS=%d TIME=%.6f COMP_TIME=%.6f COMM_TIME=%.6f COMM_PCT=%.2f "
+               "SWEEP_GBS=%.2f HALO_TIME=%.3e HALO_BYTES=%.0f HALO_GBS=%.2f "
+               "THROUGHPUT_CELLS=%.2e SIMD=%s PRECISION=%d GRID_MB=%.1f "
+               "CHECKSUM_RHO=%.10e CHECKSUM=%.10e\n",
+               mw_fields_layout_name(), MW_NVARS, MW_FIELDS_BLOCK, size, threads,
+               NX, NY, NZ, STEPS, max_elapsed, max_comp, max_halo,
+               100.0 * max_halo / max_elapsed,
+               max_comp > 0.0 ? sweep_bytes / max_comp / 1e9 : 0.0,
+               halo_per, maxv[3], halo_per > 0.0 ? maxv[3] / halo_per / 1e9 : 0.0,
+               cells * STEPS / max_elapsed, mw_simd_name(), MW_PRECISION,
+               total_bytes / 1048576.0,
+               total[MW_VAR_RHO], checksum);
+    }
+
+    mw_fields_halo_free(&h);
+    mw_fields_free(&f);
+    mw_decomp_free(&d);
+    MPI_Finalize();
+    return 0;
+}
@@ -0,0 +1,831 @@
+// miniweather_halo.c - Pluggable halo transport for the decomposed grid
+//
+// Every backend moves the same faces: whole x-planes (contiguous in the
+// grid) and the interior of the y/z faces. Tags follow the blocking code:
+// 100 + 2*dir travels towards the lower neighbour, 101 + 2*dir towards the
+// upper one.
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "miniweather_halo.h"
+
+typedef struct {
+    const char *name;
+    int  packed;                    // y/z faces go through sbuf/rbuf
+    int  overlaps;                  // start returns before the faces have moved
+    int  (*setup)(mw_halo *h);
+    void (*start)(mw_halo *h);
+    void (*complete)(mw_halo *h);   // the blocking part, timed by mw_halo_end
+    void (*exchange)(mw_halo *h);   // blocking variant; NULL = start + complete
+    void (*teardown)(mw_halo *h);
+} halo_ops;
+
+// Packed y (dir 1) or z (dir 2) face: interior x times interior of the
+// remaining direction.
+static size_t face_elems(const mw_decomp *d, int dir) {
+    return (size_t)d->n[0] * d->n[dir == 1 ? 2 : 1];
+}
+
+static int has_nbr(const mw_decomp *d, int dir) {
+    return d->nbr[dir][0] != MPI_PROC_NULL || d->nbr[dir][1] != MPI_PROC_NULL;
+}
+
+// Which of the grid's buffers is the current time level. All ranks swap in
+// lockstep, so neighbours always agree on it.
+static int cur_index(const mw_halo *h) {
+    return h->g->cur == h->buf[0] ? 0 : 1;
+}
+
+// Face of direction dir (1 = y, 2 = z) at local index `layer`, interior x
+// and interior of the remaining direction, packed x-major.
+static void face_pack(const mw_grid *g, int dir, int layer, mw_real *buf) {
+    const size_t px = mw_plane_elems(g);
+    const size_t sd = (dir == 1) ? (size_t)g->zs : 1;
+    const size_t so = (dir == 1) ? 1 : (size_t)g->zs;
+    const int no = (dir == 1) ? g->sz - 2 : g->sy - 2;
+    const int nx = g->sx - 2;
+    const mw_real *c = g->cur;
+
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int x = 0; x < nx; ++x) {
+        const size_t base = (size_t)(x + 1) * px + (size_t)layer * sd;
+        mw_real *b = buf + (size_t)x * no;
+        for (int k = 0; k < no; ++k) b[k] = c[base + (size_t)(k + 1) * so];
+    }
+}
+
+static void face_unpack(mw_grid *g, int dir, int layer, const mw_real *buf) {
+    const size_t px = mw_plane_elems(g);
+    const size_t sd = (dir == 1) ? (size_t)g->zs : 1;
+    const size_t so = (dir == 1) ? 1 : (size_t)g->zs;
+    const int no = (dir == 1) ? g->sz - 2 : g->sy - 2;
+    const int nx = g->sx - 2;
+    mw_real *c = g->cur;
+
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int x = 0; x < nx; ++x) {
+        const size_t base = (size_t)(x + 1) * px + (size_t)layer * sd;
+        const mw_real *b = buf + (size_t)x * no;
+        for (int k = 0; k < no; ++k) c[base + (size_t)(k + 1) * so] = b[k];
+    }
+}
+
+static void pack_faces(mw_halo *h) {
+    const mw_decomp *d = h->d;
+    for (int dir = 1; dir < 3; ++dir) {
+        if (h->msg[dir][0]) face_pack(h->g, dir, 1, h->sbuf[dir][0]);
+        if (h->msg[dir][1]) face_pack(h->g, dir, d->n[dir], h->sbuf[dir][1]);
+    }
+}
+
+static void unpack_faces(mw_halo *h) {
+    const mw_decomp *d = h->d;
+    for (int dir = 1; dir < 3; ++dir) {
+        if (h->msg[dir][0]) face_unpack(h->g, dir, 0, h->rbuf[dir][0]);
+        if (h->msg[dir][1]) face_unpack(h->g, dir, d->n[dir] + 1, h->rbuf[dir][1]);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// sendrecv: MPI_Sendrecv when blocking, Isend/Irecv when overlapped
+// ---------------------------------------------------------------------------
+
+static int sendrecv_setup(mw_halo *h) {
+    (void)h;
+    return 0;
+}
+
+static void sendrecv_exchange(mw_halo *h) {
+    const mw_decomp *d = h->d;
+    mw_grid *g = h->g;
+    const int lx = d->n[0];
+    const int plane = (int)mw_plane_elems(g);
+    const int left = d->nbr[0][0], right = d->nbr[0][1];
+
+    MPI_Sendrecv(&g->cur[MW_IDX(g,1,   0,0)], plane, MW_MPI_REAL, left,  100,
+                 &g->cur[MW_IDX(g,lx+1,0,0)], plane, MW_MPI_REAL, right, 100,
+                 d->cart, MPI_STATUS_IGNORE);
+
+    MPI_Sendrecv(&g->cur[MW_IDX(g,lx,0,0)], plane, MW_MPI_REAL, right, 101,
+                 &g->cur[MW_IDX(g,0, 0,0)], plane, MW_MPI_REAL, left,  101,
+                 d->cart, MPI_STATUS_IGNORE);
+
+    pack_faces(h);
+    for (int dir = 1; dir < 3; ++dir) {
+        if (!has_nbr(d, dir)) continue;
+        const int lo = d->nbr[dir][0], hi = d->nbr[dir][1];
+        const int count = (int)face_elems(d, dir);
+        const int tag = 100 + 2 * dir;
+        mw_real **sb = h->sbuf[dir], **rb = h->rbuf[dir];
+
+        MPI_Sendrecv(sb[0], count, MW_MPI_REAL, lo, tag,
+                     rb[1], count, MW_MPI_REAL, hi, tag,
+                     d->cart, MPI_STATUS_IGNORE);
+        MPI_Sendrecv(sb[1], count, MW_MPI_REAL, hi, tag + 1,
+                     rb[0], count, MW_MPI_REAL, lo, tag + 1,
+                     d->cart, MPI_STATUS_IGNORE);
+    }
+    unpack_faces(h);
+}
+
+// Posts the receives of buffer b, then packs and posts the sends, for the
+// faces marked in msg. With init != 0 the requests are persistent (stored
+// in preq[b], not started).
+static void post_all(mw_halo *h, int b, int init, MPI_Request *req, int *nreq) {
+    const mw_decomp *d = h->d;
+    const mw_grid *g = h->g;
+    mw_real *c = h->buf[b];
+    const int lx = d->n[0];
+    const int plane = (int)mw_plane_elems(g);
+    const int left  = h->msg[0][0] ? d->nbr[0][0] : MPI_PROC_NULL;
+    const int right = h->msg[0][1] ? d->nbr[0][1] : MPI_PROC_NULL;
+    int (*recv)(void*, int, MPI_Datatype, int, int, MPI_Comm, MPI_Request*) =
+        init ? MPI_Recv_init : MPI_Irecv;
+    int (*send)(const void*, int, MPI_Datatype, int, int, MPI_Comm, MPI_Request*) =
+        init ? MPI_Send_init : MPI_Isend;
+
+    *nreq = 0;
+    if (left != MPI_PROC_NULL)
+        recv(&c[MW_IDX(g,0,0,0)], plane, MW_MPI_REAL, left, 101, d->cart, &req[(*nreq)++]);
+    if (right != MPI_PROC_NULL)
+        recv(&c[MW_IDX(g,lx+1,0,0)], plane, MW_MPI_REAL, right, 100, d->cart, &req[(*nreq)++]);
+    for (int dir = 1; dir < 3; ++dir) {
+        const int count = (int)face_elems(d, dir);
+        for (int s = 0; s < 2; ++s) {
+            if (!h->msg[dir][s]) continue;
+            recv(h->rbuf[dir][s], count, MW_MPI_REAL, d->nbr[dir][s],
+                 100 + 2 * dir + (s == 0), d->cart, &req[(*nreq)++]);
+        }
+    }
+
+    if (!init) pack_faces(h);
+
+    if (left != MPI_PROC_NULL)
+        send(&c[MW_IDX(g,1,0,0)], plane, MW_MPI_REAL, left, 100, d->cart, &req[(*nreq)++]);
+    if (right != MPI_PROC_NULL)
+        send(&c[MW_IDX(g,lx,0,0)], plane, MW_MPI_REAL, right, 101, d->cart, &req[(*nreq)++]);
+    for (int dir = 1; dir < 3; ++dir) {
+        const int count = (int)face_elems(d, dir);
+        for (int s = 0; s < 2; ++s) {
+            if (!h->msg[dir][s]) continue;
+            send(h->sbuf[dir][s], count, MW_MPI_REAL, d->nbr[dir][s],
+                 100 + 2 * dir + (s == 1), d->cart, &req[(*nreq)++]);
+        }
+    }
+}
+
+static void sendrecv_start(mw_halo *h) {
+    post_all(h, cur_index(h), 0, h->req, &h->nreq);
+}
+
+static void sendrecv_complete(mw_halo *h) {
+    MPI_Waitall(h->nreq, h->req, MPI_STATUSES_IGNORE);
+    h->nreq = 0;
+}
+
+static void sendrecv_teardown(mw_halo *h) {
+    (void)h;
+}
+
+// ---------------------------------------------------------------------------
+// persistent: requests built once per grid buffer (the swap alternates them)
+// ---------------------------------------------------------------------------
+
+static int persistent_setup(mw_halo *h) {
+    for (int b = 0; b < 2; ++b) post_all(h, b, 1, h->preq[b], &h->npreq);
+    return 0;
+}
+
+static void persistent_start(mw_halo *h) {
+    h->active = cur_index(h);
+    pack_faces(h);
+    MPI_Startall(h->npreq, h->preq[h->active]);
+}
+
+static void persistent_complete(mw_halo *h) {
+    MPI_Waitall(h->npreq, h->preq[h->active], MPI_STATUSES_IGNORE);
+}
+
+static void persistent_teardown(mw_halo *h) {
+    for (int b = 0; b < 2; ++b) {
+        for (int i = 0; i < h->npreq; ++i) {
+            if (h->preq[b][i] != MPI_REQUEST_NULL) MPI_Request_free(&h->preq[b][i]);
+        }
+    }
+    h->npreq = 0;
+}
+
+// ---------------------------------------------------------------------------
+// neighbor: one MPI_Neighbor_alltoallw on the Cartesian communicator. Faces
+// are described by datatypes over the grid, so nothing is packed. The cart
+// neighbour order is (x-, x+, y-, y+, z-, z+); data sent to x- arrives in
+// that rank's x+ slot. Sends are addressed from plane 1 so the send and
+// receive buffer arguments never alias.
+// ---------------------------------------------------------------------------
+
+static int neighbor_setup(mw_halo *h) {
+    const mw_decomp *d = h->d;
+    const mw_grid *g = h->g;
+    const size_t px = mw_plane_elems(g);
+    const size_t sbase = MW_IDX(g,1,0,0);
+
+    for (int dir = 0; dir < 3; ++dir) {
+        MPI_Datatype t;
+        if (dir == 0) {
+            MPI_Type_contiguous((int)px, MW_MPI_REAL, &t);
+        } else if (dir == 1) {
+            MPI_Type_vector(d->n[0], d->n[2], (int)px, MW_MPI_REAL, &t);
+        } else {
+            MPI_Datatype col;
+            MPI_Type_vector(d->n[1], 1, g->zs, MW_MPI_REAL, &col);
+            MPI_Type_create_hvector(d->n[0], 1, (MPI_Aint)(px * sizeof(mw_real)), col, &t);
+            MPI_Type_free(&col);
+        }
+        MPI_Type_commit(&t);
+
+        for (int s = 0; s < 2; ++s) {
+            const int k = 2 * dir + s;
+            const int snd = (s == 0) ? 1 : d->n[dir];
+            const int rcv = (s == 0) ? 0 : d->n[dir] + 1;
+            size_t si, ri;
+            if (dir == 0)      { si = MW_IDX(g,snd,0,0); ri = MW_IDX(g,rcv,0,0); }
+            else if (dir == 1) { si = MW_IDX(g,1,snd,1); ri = MW_IDX(g,1,rcv,1); }
+            else               { si = MW_IDX(g,1,1,snd); ri = MW_IDX(g,1,1,rcv); }
+
+            h->ftype[k]  = t;
+            h->counts[k] = (d->nbr[dir][s] != MPI_PROC_NULL) ? 1 : 0;
+            h->sdisp[k]  = (MPI_Aint)((si - sbase) * sizeof(mw_real));
+            h->rdisp[k]  = (MPI_Aint)(ri * sizeof(mw_real));
+        }
+    }
+    return 0;
+}
+
+static void neighbor_exchange(mw_halo *h) {
+    mw_real *c = h->g->cur;
+    MPI_Neighbor_alltoallw(c + MW_IDX(h->g,1,0,0), h->counts, h->sdisp, h->ftype,
+                           c, h->counts, h->rdisp, h->ftype, h->d->cart);
+}
+
+static void neighbor_start(mw_halo *h) {
+    mw_real *c = h->g->cur;
+    MPI_Ineighbor_alltoallw(c + MW_IDX(h->g,1,0,0), h->counts, h->sdisp, h->ftype,
+                            c, h->counts, h->rdisp, h->ftype, h->d->cart, &h->req[0]);
+    h->nreq = 1;
+}
+
+static void neighbor_teardown(mw_halo *h) {
+    // x-, y-, z- own the type shared with the upper slot
+    for (int k = 0; k < 6; k += 2) {
+        if (h->ftype[k] != MPI_DATATYPE_NULL) MPI_Type_free(&h->ftype[k]);
+        h->ftype[k + 1] = MPI_DATATYPE_NULL;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// rma: each rank MPI_Puts its faces straight into the neighbours' memory,
+// x planes into the ghost planes of the matching grid buffer, y/z faces into
+// the rbuf landing area (lower half from the lower neighbour). One PSCW
+// epoch per split direction: post/start/put in begin, complete/wait in end.
+// ---------------------------------------------------------------------------
+
+static MPI_Win *rma_win(mw_halo *h, int dir) {
+    return dir == 0 ? &h->xwin[h->active] : &h->fwin[dir];
+}
+
+static int rma_setup(mw_halo *h) {
+    const mw_decomp *d = h->d;
+    const mw_grid *g = h->g;
+    const size_t px = mw_plane_elems(g);
+    MPI_Group all;
+    MPI_Comm_group(d->cart, &all);
+
+    for (int dir = 0; dir < 3; ++dir) {
+        if (d->dims[dir] == 1) continue;
+        int ranks[2], n = 0;
+        for (int s = 0; s < 2; ++s) {
+            if (d->nbr[dir][s] != MPI_PROC_NULL) ranks[n++] = d->nbr[dir][s];
+        }
+        MPI_Group_incl(all, n, ranks, &h->group[dir]);
+
+        if (dir == 0) {
+            for (int b = 0; b < 2; ++b) {
+                MPI_Win_create(h->buf[b], (MPI_Aint)(g->elems * sizeof(mw_real)),
+                               sizeof(mw_real), MPI_INFO_NULL, d->cart, &h->xwin[b]);
+            }
+        } else {
+            MPI_Win_create(h->rbuf[dir][0], (MPI_Aint)(2 * face_elems(d, dir) * sizeof(mw_real)),
+                           sizeof(mw_real), MPI_INFO_NULL, d->cart, &h->fwin[dir]);
+        }
+    }
+    MPI_Group_free(&all);
+
+    // Planes are the same size on both sides; only the left rank's
+    // thickness is needed to address its upper ghost plane.
+    int left_n = 0;
+    MPI_Sendrecv(&d->n[0], 1, MPI_INT, d->nbr[0][1], 102,
+                 &left_n, 1, MPI_INT, d->nbr[0][0], 102,
+                 d->cart, MPI_STATUS_IGNORE);
+    h->left_ghost = (MPI_Aint)((size_t)(left_n + 1) * px);
+    return 0;
+}
+
+static void rma_start(mw_halo *h) {
+    const mw_decomp *d = h->d;
+    const mw_grid *g = h->g;
+    const int plane = (int)mw_plane_elems(g);
+    const int lx = d->n[0];
+
+    h->active = cur_index(h);
+    for (int dir = 0; dir < 3; ++dir) {
+        if (d->dims[dir] > 1) MPI_Win_post(h->group[dir], 0, *rma_win(h, dir));
+    }
+    pack_faces(h);
+
+    for (int dir = 0; dir < 3; ++dir) {
+        if (d->dims[dir] == 1) continue;
+        MPI_Win win = *rma_win(h, dir);
+        const int lo = d->nbr[dir][0], hi = d->nbr[dir][1];
+        MPI_Win_start(h->group[dir], 0, win);
+        if (dir == 0) {
+            if (lo != MPI_PROC_NULL)
+                MPI_Put(&g->cur[MW_IDX(g,1,0,0)], plane, MW_MPI_REAL, lo,
+                        h->left_ghost, plane, MW_MPI_REAL, win);
+            if (hi != MPI_PROC_NULL)
+                MPI_Put(&g->cur[MW_IDX(g,lx,0,0)], plane, MW_MPI_REAL, hi,
+                        0, plane, MW_MPI_REAL, win);
+        } else {
+            const int count = (int)face_elems(d, dir);
+            if (lo != MPI_PROC_NULL)
+                MPI_Put(h->sbuf[dir][0], count, MW_MPI_REAL, lo,
+                        count, count, MW_MPI_REAL, win);
+            if (hi != MPI_PROC_NULL)
+                MPI_Put(h->sbuf[dir][1], count, MW_MPI_REAL, hi,
+                        0, count, MW_MPI_REAL, win);
+        }
+    }
+}
+
+static void rma_complete(mw_halo *h) {
+    const mw_decomp *d = h->d;
+    for (int dir = 0; dir < 3; ++dir) {
+        if (d->dims[dir] > 1) MPI_Win_complete(*rma_win(h, dir));
+    }
+    for (int dir = 0; dir < 3; ++dir) {
+        if (d->dims[dir] > 1) MPI_Win_wait(*rma_win(h, dir));
+    }
+}
+
+static void rma_teardown(mw_halo *h) {
+    for (int b = 0; b < 2; ++b) {
+        if (h->xwin[b] != MPI_WIN_NULL) MPI_Win_free(&h->xwin[b]);
+    }
+    for (int dir = 0; dir < 3; ++dir) {
+        if (h->fwin[dir] != MPI_WIN_NULL) MPI_Win_free(&h->fwin[dir]);
+        if (h->group[dir] != MPI_GROUP_NULL) MPI_Group_free(&h->group[dir]);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// shm: both grid buffers of every rank live in one MPI_Win_allocate_shared
+// window per node, so a ghost face from an on-node neighbour is a single
+// copy out of its current buffer instead of a trip through the MPI layer.
+// A zero-byte handshake with each on-node neighbour orders the copy after
+// the neighbour's previous sweep; the neighbour cannot overwrite the buffer
+// being read before the next handshake, because that buffer only becomes
+// its write target one step later. Off-node faces use Isend/Irecv.
+// ---------------------------------------------------------------------------
+
+// Copies the face of a neighbour grid (geometry ns = sx, sy, sz, zs) at its
+// local index src_layer into g->cur at dst_layer. x faces are whole planes;
+// y/z faces cover the interior of the other two directions.
+static void face_copy(mw_grid *g, int dir, int dst_layer,
+                      const mw_real *src, const int *ns, int src_layer) {
+    const int nsy = ns[1], nzs = ns[3];
+    mw_real *c = g->cur;
+
+    if (dir == 0) {
+        memcpy(&c[MW_IDX(g,dst_layer,0,0)], src + (size_t)src_layer * nsy * nzs,
+               mw_plane_elems(g) * sizeof(mw_real));
+        return;
+    }
+
+    const int nx = g->sx - 2;
+#ifdef _OPENMP
+    #pragma omp parallel for
+#endif
+    for (int x = 1; x <= nx; ++x) {
+        if (dir == 1) {
+            const mw_real *s = src + ((size_t)x * nsy + src_layer) * nzs;
+            mw_real *t = &c[MW_IDX(g,x,dst_layer,0)];
+            for (int z = 1; z < g->sz - 1; ++z) t[z] = s[z];
+        } else {
+            for (int y = 1; y < g->sy - 1; ++y) {
+                c[MW_IDX(g,x,y,dst_layer)] = src[((size_t)x * nsy + y) * nzs + src_layer];
+            }
+        }
+    }
+}
+
+static int shm_setup(mw_halo *h) {
+    const mw_decomp *d = h->d;
+    mw_grid *g = h->g;
+    if (!g->next) return -1;   // moves both buffers into the window
+    MPI_Comm_split_type(d->cart, MPI_COMM_TYPE_SHARED, 0, MPI_INFO_NULL, &h->node);
+
+    MPI_Group cart_group, node_group;
+    MPI_Comm_group(d->cart, &cart_group);
+    MPI_Comm_group(h->node, &node_group);
+
+    // Per-rank segments page aligned rather than packed back to back
+    MPI_Info info;
+    MPI_Info_create(&info);
+    MPI_Info_set(info, "alloc_shared_noncontig", "true");
+    const size_t bytes = mw_grid_buffer_bytes(g);
+    void *mem = NULL;
+    MPI_Win_allocate_shared((MPI_Aint)(2 * bytes), 1, info, h->node, &mem, &h->shm_win);
+    MPI_Info_free(&info);
+
+    mw_real *a = mw_grid_place(mem);
+    mw_real *b = mw_grid_place((char*)mem + bytes);
+    mw_grid win = *g;
+    win.cur = a;
+    win.next = b;
+    mw_grid_touch(&win);
+    memcpy(a, g->cur, g->elems * sizeof(mw_real));
+    memcpy(b, g->next, g->elems * sizeof(mw_real));
+    mw_grid_free(g);
+    g->cur  = h->buf[0] = a;
+    g->next = h->buf[1] = b;
+
+    const int mine[4] = { g->sx, g->sy, g->sz, g->zs };
+    for (int dir = 0; dir < 3; ++dir) {
+        MPI_Sendrecv(mine, 4, MPI_INT, d->nbr[dir][1], 103,
+                     h->ngeom[dir][0], 4, MPI_INT, d->nbr[dir][0], 103,
+                     d->cart, MPI_STATUS_IGNORE);
+        MPI_Sendrecv(mine, 4, MPI_INT, d->nbr[dir][0], 104,
+                     h->ngeom[dir][1], 4, MPI_INT, d->nbr[dir][1], 104,
+                     d->cart, MPI_STATUS_IGNORE);
+
+        for (int s = 0; s < 2; ++s) {
+            if (d->nbr[dir][s] == MPI_PROC_NULL) continue;
+            int nr;
+            MPI_Group_translate_ranks(cart_group, 1, &d->nbr[dir][s], node_group, &nr);
+            if (nr == MPI_UNDEFINED) continue;
+
+            // The segment size may be rounded up; recompute the split
+            const int *ns = h->ngeom[dir][s];
+            mw_grid ng;
+            ng.elems = (size_t)ns[0] * ns[1] * ns[3];
+            MPI_Aint size;
+            int unit;
+            void *base;
+            MPI_Win_shared_query(h->shm_win, nr, &size, &unit, &base);
+            h->nbuf[dir][s][0] = mw_grid_place(base);
+            h->nbuf[dir][s][1] = mw_grid_place((char*)base + mw_grid_buffer_bytes(&ng));
+            h->msg[dir][s] = 0;
+        }
+    }
+    MPI_Group_free(&cart_group);
+    MPI_Group_free(&node_group);
+
+    MPI_Win_lock_all(MPI_MODE_NOCHECK, h->shm_win);
+    return 0;
+}
+
+// Synchronous for the on-node faces: the handshake tells the neighbours
+// this rank is done writing the buffer they copy from, and must come
+// before anyone writes its next buffer. Moving it into complete would let
+// an overlapped neighbour sweep into that buffer while it is still being
+// read, so shm cannot hide on-node faces behind the interior sweep.
+static void shm_start(mw_halo *h) {
+    const mw_decomp *d = h->d;
+    const int b = cur_index(h);
+    MPI_Request hs[12];
+    int nhs = 0;
+
+    // Off-node faces are messaging time; node_time starts after posting them
+    post_all(h, b, 0, h->req, &h->nreq);
+
+    const double t0 = MPI_Wtime();
+    MPI_Win_sync(h->shm_win);
+    for (int dir = 0; dir < 3; ++dir) {
+        for (int s = 0; s < 2; ++s) {
+            if (!h->nbuf[dir][s][0]) continue;
+            MPI_Irecv(NULL, 0, MPI_BYTE, d->nbr[dir][s], 110, d->cart, &hs[nhs++]);
+            MPI_Isend(NULL, 0, MPI_BYTE, d->nbr[dir][s], 110, d->cart, &hs[nhs++]);
+        }
+    }
+    const double tw = MPI_Wtime();
+    MPI_Waitall(nhs, hs, MPI_STATUSES_IGNORE);
+    h->wait_time += MPI_Wtime() - tw;
+    MPI_Win_sync(h->shm_win);
+
+    // From the lower neighbour its last owned layer, from the upper its first
+    for (int dir = 0; dir < 3; ++dir) {
+        for (int s = 0; s < 2; ++s) {
+            if (!h->nbuf[dir][s][0]) continue;
+            const int *ns = h->ngeom[dir][s];
+            face_copy(h->g, dir, s == 0 ? 0 : d->n[dir] + 1, h->nbuf[dir][s][b], ns,
+                      s == 0 ? ns[dir] - 2 : 1);
+        }
+    }
+    if (nhs) h->node_time += MPI_Wtime() - t0;
+}
+
+static void shm_teardown(mw_halo *h) {
+    if (h->shm_win != MPI_WIN_NULL) {
+        mw_grid *g = h->g;
+        mw_grid priv;
+        if (mw_grid_alloc(&priv, g->sx, g->sy, g->sz) != 0) MPI_Abort(h->d->cart, 2);
+        memcpy(priv.cur, g->cur, g->elems * sizeof(mw_real));
+        memcpy(priv.next, g->next, g->elems * sizeof(mw_real));
+        *g = priv;
+
+        MPI_Win_unlock_all(h->shm_win);
+        MPI_Win_free(&h->shm_win);
+    }
+    if (h->node != MPI_COMM_NULL) MPI_Comm_free(&h->node);
+}
+
+static const halo_ops backends[MW_HALO_COUNT] = {
+    { "sendrecv",   1, 1, sendrecv_setup,   sendrecv_start,   sendrecv_complete,
+      sendrecv_exchange, sendrecv_teardown },
+    { "persistent", 1, 1, persistent_setup, persistent_start, persistent_complete,
+      NULL, persistent_teardown },
+    { "neighbor",   0, 1, neighbor_setup,   neighbor_start,   sendrecv_complete,
+      neighbor_exchange, neighbor_teardown },
+    { "rma",        1, 1, rma_setup,        rma_start,        rma_complete,
+      NULL, rma_teardown },
+    { "shm",        1, 0, shm_setup,        shm_start,        sendrecv_complete,
+      NULL, shm_teardown },
+};
+
+int mw_halo_parse(const char *name) {
+    for (int k = 0; k < MW_HALO_COUNT; ++k) {
+        if (strcmp(name, backends[k].name) == 0) return k;
+    }
+    return -1;
+}
+
+const char *mw_halo_name(mw_halo_kind kind) {
+    return backends[kind].name;
+}
+
+int mw_halo_overlaps(mw_halo_kind kind) {
+    return backends[kind].overlaps;
+}
+
+int mw_halo_create(mw_halo *h, mw_halo_kind kind, mw_decomp *d, mw_grid *g) {
+    memset(h, 0, sizeof(*h));
+    h->kind = kind;
+    h->d = d;
+    h->g = g;
+    h->buf[0] = g->cur;
+    h->buf[1] = g->next ? g->next : g->cur;   // in place: one level only
+    h->node = MPI_COMM_NULL;
+    h->shm_win = MPI_WIN_NULL;
+    for (int dir = 0; dir < 3; ++dir) {
+        for (int s = 0; s < 2; ++s) h->msg[dir][s] = d->nbr[dir][s] != MPI_PROC_NULL;
+    }
+    for (int i = 0; i < 2; ++i) h->xwin[i] = MPI_WIN_NULL;
+    for (int i = 0; i < 3; ++i) {
+        h->fwin[i] = MPI_WIN_NULL;
+        h->group[i] = MPI_GROUP_NULL;
+    }
+    for (int k = 0; k < 6; ++k) h->ftype[k] = MPI_DATATYPE_NULL;
+    for (int b = 0; b < 2; ++b) {
+        for (int i = 0; i < 12; ++i) h->preq[b][i] = MPI_REQUEST_NULL;
+    }
+
+    // Both halves of a direction in one block (the rma landing window)
+    int ok = 1;
+    for (int dir = 1; dir < 3; ++dir) {
+        if (d->dims[dir] == 1) continue;
+        const size_t elems = face_elems(d, dir);
+        mw_real *s = (mw_real*)malloc(2 * elems * sizeof(mw_real));
+        mw_real *r = (mw_real*)malloc(2 * elems * sizeof(mw_real));
+        if (!s || !r) ok = 0;
+        h->sbuf[dir][0] = s;
+        h->rbuf[dir][0] = r;
+        h->sbuf[dir][1] = s ? s + elems : NULL;
+        h->rbuf[dir][1] = r ? r + elems : NULL;
+    }
+
+    int all_ok = 0;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, d->cart);
+    if (!all_ok || backends[kind].setup(h) != 0) {
+        mw_halo_free(h);
+        return -1;
+    }
+    return 0;
+}
+
+void mw_halo_free(mw_halo *h) {
+    backends[h->kind].teardown(h);
+    for (int dir = 0; dir < 3; ++dir) {
+        free(h->sbuf[dir][0]);
+        free(h->rbuf[dir][0]);
+        h->sbuf[dir][0] = h->sbuf[dir][1] = NULL;
+        h->rbuf[dir][0] = h->rbuf[dir][1] = NULL;
+    }
+}
+
+void mw_halo_exchange(mw_halo *h) {
+    const halo_ops *ops = &backends[h->kind];
+    if (ops->exchange) {
+        ops->exchange(h);
+    } else {
+        mw_halo_begin(h);
+        mw_halo_end(h);
+    }
+}
+
+void mw_halo_begin(mw_halo *h) {
+    backends[h->kind].start(h);
+}
+
+void mw_halo_end(mw_halo *h) {
+    const double t0 = MPI_Wtime();
+    backends[h->kind].complete(h);
+    h->wait_time += MPI_Wtime() - t0;
+
+    if (backends[h->kind].packed) unpack_faces(h);
+}
+
+// Sweeps one box, folding the new level into s when one is given.
+static void sweep_box(mw_grid *g, int x0, int x1, int y0, int y1, int z0, int z1,
+                      mw_stats *s) {
+    if (s) mw_stencil_box_stats(g, x0, x1, y0, y1, z0, z1, s);
+    else   mw_stencil_box(g, x0, x1, y0, y1, z0, z1);
+}
+
+void mw_step_overlap(mw_halo *h, double *comp, double *comm) {
+    mw_step_overlap_stats(h, comp, comm, NULL);
+}
+
+void mw_step_overlap_stats(mw_halo *h, double *comp, double *comm, mw_stats *s) {
+    const mw_decomp *d = h->d;
+    mw_grid *g = h->g;
+    int lo[3], hi[3];
+    for (int i = 0; i < 3; ++i) {
+        lo[i] = (d->nbr[i][0] != MPI_PROC_NULL) ? 2 : 1;
+        hi[i] = (d->nbr[i][1] != MPI_PROC_NULL) ? d->n[i] - 1 : d->n[i];
+    }
+    const int lx = d->n[0], ly = d->n[1], lz = d->n[2];
+
+    double t = MPI_Wtime();
+    mw_halo_begin(h);
+    double t1 = MPI_Wtime();
+    *comm += t1 - t;
+
+    sweep_box(g, lo[0], hi[0], lo[1], hi[1], lo[2], hi[2], s);
+    t = MPI_Wtime();
+    *comp += t - t1;
+
+    mw_halo_end(h);
+    t1 = MPI_Wtime();
+    *comm += t1 - t;
+
+    // Boundary shell around the interior box, each cell exactly once:
+    // x end planes in full, then y rows and z columns of the inner planes.
+    const int xa = lo[0] - 1 < lx ? lo[0] - 1 : lx;
+    const int xb = hi[0] + 1 > lo[0] ? hi[0] + 1 : lo[0];
+    sweep_box(g, 1, xa, 1, ly, 1, lz, s);
+    sweep_box(g, xb, lx, 1, ly, 1, lz, s);
+
+    const int ya = lo[1] - 1 < ly ? lo[1] - 1 : ly;
+    const int yb = hi[1] + 1 > lo[1] ? hi[1] + 1 : lo[1];
+    sweep_box(g, lo[0], hi[0], 1, ya, 1, lz, s);
+    sweep_box(g, lo[0], hi[0], yb, ly, 1, lz, s);
+
+    const int za = lo[2] - 1 < lz ? lo[2] - 1 : lz;
+    const int zb = hi[2] + 1 > lo[2] ? hi[2] + 1 : lo[2];
+    sweep_box(g, lo[0], hi[0], lo[1], hi[1], 1, za, s);
+    sweep_box(g, lo[0], hi[0], lo[1], hi[1], zb, lz, s);
+
+    mw_grid_swap(g);
+    *comp += MPI_Wtime() - t1;
+}
+
+// Part p of np of a box's (x,y) rows, in contiguous chunks, swept by the
+// calling thread alone.
+static void sweep_part(mw_grid *g, int x0, int x1, int y0, int y1, int z0, int z1,
+                       int p, int np) {
+    if (x1 < x0 || y1 < y0 || z1 < z0) return;
+    const int ny = y1 - y0 + 1;
+    const long rows = (long)(x1 - x0 + 1) * ny;
+    const long r0 = rows * p / np, r1 = rows * (p + 1) / np;
+    const int sy = g->sy, zs = g->zs;
+    const size_t px = (size_t)sy * zs;
+    const mw_row_fn row = mw_row_kernel;
+    for (long r = r0; r < r1; ++r) {
+        const int x = x0 + (int)(r / ny), y = y0 + (int)(r % ny);
+        row(g->cur, g->next, ((size_t)x * sy + y) * zs, px, zs, z0, z1 + 1);
+    }
+}
+
+void mw_step_comm_thread(mw_halo *h, int compute, double *comp, double *comm,
+                         double *exposed) {
+    const mw_decomp *d = h->d;
+    mw_grid *g = h->g;
+    int lo[3], hi[3];
+    for (int i = 0; i < 3; ++i) {
+        lo[i] = (d->nbr[i][0] != MPI_PROC_NULL) ? 2 : 1;
+        hi[i] = (d->nbr[i][1] != MPI_PROC_NULL) ? d->n[i] - 1 : d->n[i];
+    }
+    const int lx = d->n[0], ly = d->n[1], lz = d->n[2];
+    const int xa = lo[0] - 1 < lx ? lo[0] - 1 : lx, xb = hi[0] + 1 > lo[0] ? hi[0] + 1 : lo[0];
+    const int ya = lo[1] - 1 < ly ? lo[1] - 1 : ly, yb = hi[1] + 1 > lo[1] ? hi[1] + 1 : lo[1];
+    const int za = lo[2] - 1 < lz ? lo[2] - 1 : lz, zb = hi[2] + 1 > lo[2] ? hi[2] + 1 : lo[2];
+
+    const double t0 = MPI_Wtime();
+    double arrived = t0, swept = t0;
+
+#ifdef _OPENMP
+    #pragma omp parallel num_threads(compute + 1)
+#endif
+    {
+        int tid = 0, nt = 1;
+#ifdef _OPENMP
+        tid = omp_get_thread_num();
+        nt = omp_get_num_threads();
+#endif
+        // Thread 0 owns the exchange; with no other thread it also computes
+        const int workers = nt > 1 ? nt - 1 : 1;
+        const int w = nt > 1 ? tid - 1 : 0;
+        if (tid == 0) {
+            mw_halo_begin(h);
+            mw_halo_end(h);
+            arrived = MPI_Wtime();
+        }
+        if (w >= 0) {
+            sweep_part(g, lo[0], hi[0], lo[1], hi[1], lo[2], hi[2], w, workers);
+            const double t = MPI_Wtime();
+#ifdef _OPENMP
+            #pragma omp critical(mw_comm_thread)
+#endif
+            if (t > swept) swept = t;
+        }
+#ifdef _OPENMP
+        #pragma omp barrier
+#endif
+        // Boundary shell as in mw_step_overlap, split over the compute threads
+        if (w >= 0) {
+            sweep_part(g, 1, xa, 1, ly, 1, lz, w, workers);
+            sweep_part(g, xb, lx, 1, ly, 1, lz, w, workers);
+            sweep_part(g, lo[0], hi[0], 1, ya, 1, lz, w, workers);
+            sweep_part(g, lo[0], hi[0], yb, ly, 1, lz, w, workers);
+            sweep_part(g, lo[0], hi[0], lo[1], hi[1], 1, za, w, workers);
+            sweep_part(g, lo[0], hi[0], lo[1], hi[1], zb, lz, w, workers);
+        }
+    }
+
+    mw_grid_swap(g);
+    const double wait = arrived > swept ? arrived - swept : 0.0;
+    *comm += arrived - t0;
+    *exposed += wait;
+    *comp += MPI_Wtime() - t0 - wait;
+}
+
+int mw_halo_rebalance(mw_halo *h, double comp) {
+    const mw_halo_kind kind = h->kind;
+    mw_decomp *d = h->d;
+    mw_grid *g = h->g;
+    const double wait = h->wait_time, node = h->node_time;
+
+    mw_halo_free(h);
+    const int moved = mw_decomp_rebalance(d, g, comp);
+    if (mw_halo_create(h, kind, d, g) != 0) MPI_Abort(d->cart, 2);
+    h->wait_time = wait;
+    h->node_time = node;
+    return moved;
+}
+
+mw_halo_kind mw_halo_compare(mw_decomp *d, mw_grid *g, int reps, int overlap,
+                             double times[MW_HALO_COUNT]) {
+    mw_halo_kind best = MW_HALO_SENDRECV;
+    for (int k = 0; k < MW_HALO_COUNT; ++k) {
+        mw_halo h;
+        times[k] = -1.0;
+        if (mw_halo_create(&h, (mw_halo_kind)k, d, g) != 0) continue;
+
+        for (int r = 0; r < 2; ++r) mw_halo_exchange(&h);
+        MPI_Barrier(d->cart);
+        const double t0 = MPI_Wtime();
+        for (int r = 0; r < reps; ++r) mw_halo_exchange(&h);
+        const double local = (MPI_Wtime() - t0) / reps;
+        MPI_Allreduce(&local, &times[k], 1, MPI_DOUBLE, MPI_MAX, d->cart);
+        mw_halo_free(&h);
+
+        if (overlap && !backends[k].overlaps) continue;
+        if (times[best] < 0.0 || times[k] < times[best]) best = (mw_halo_kind)k;
+    }
+    return best;
+}
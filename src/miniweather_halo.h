@@ -0,0 +1,126 @@
+// miniweather_halo.h - Pluggable halo transport for the decomposed grid
+#ifndef MINIWEATHER_HALO_H
+#define MINIWEATHER_HALO_H
+
+#include <mpi.h>
+#include "miniweather_core.h"
+#include "miniweather_decomp.h"
+
+// Transport backends. All of them refresh the same ghost cells with the
+// same values, so the result of a run does not depend on the choice.
+//   sendrecv    MPI_Sendrecv per face (nonblocking Isend/Irecv when overlapped)
+//   persistent  MPI_Send_init/MPI_Recv_init built once, MPI_Startall per step
+//   neighbor    MPI_Neighbor_alltoallw on the Cartesian communicator with
+//               face datatypes, no packing
+//   rma         MPI_Put into the neighbours' ghost layers, PSCW epochs
+//   shm         grid buffers live in an MPI shared-memory window; faces of
+//               on-node neighbours are copied straight out of their memory,
+//               off-node neighbours fall back to Isend/Irecv
+typedef enum {
+    MW_HALO_SENDRECV,
+    MW_HALO_PERSISTENT,
+    MW_HALO_NEIGHBOR,
+    MW_HALO_RMA,
+    MW_HALO_SHM,
+    MW_HALO_COUNT
+} mw_halo_kind;
+
+typedef struct mw_halo mw_halo;
+
+struct mw_halo {
+    mw_halo_kind kind;
+    mw_decomp *d;
+    mw_grid *g;
+    mw_real *buf[2];            // the grid's two buffers (cur twice in place), fixed for its lifetime
+    int msg[3][2];              // face travels as an MPI message
+    mw_real *sbuf[3][2], *rbuf[3][2];  // [dir][lower/upper] packed y/z faces
+    MPI_Request req[12];        // outstanding traffic of the current exchange
+    int nreq;
+    MPI_Request preq[2][12];    // persistent: one request set per grid buffer
+    int npreq;
+    MPI_Datatype ftype[6];      // neighbor: face types in cart neighbour order
+    MPI_Aint sdisp[6], rdisp[6];
+    int counts[6];
+    MPI_Win xwin[2];            // rma: one window per grid buffer (x planes)
+    MPI_Win fwin[3];            // rma: y/z landing buffers rbuf[dir]
+    MPI_Group group[3];         // rma: neighbours of each direction
+    int active;                 // grid buffer (0/1) of the exchange in progress
+    MPI_Aint left_ghost;        // rma: upper ghost plane offset on the left rank
+    MPI_Comm node;              // shm: ranks sharing this node
+    MPI_Win shm_win;            // shm: window holding both grid buffers
+    const mw_real *nbuf[3][2][2];  // shm: [dir][side][buffer] on-node neighbour grids
+    int ngeom[3][2][4];         // shm: neighbour sx, sy, sz, zs
+    double node_time;           // shm: time spent on on-node faces
+    double wait_time;           // accumulated time blocked completing exchanges
+};
+
+// Parses "sendrecv", "persistent", "neighbor", "rma" or "shm"; -1 if unknown.
+int mw_halo_parse(const char *name);
+const char *mw_halo_name(mw_halo_kind kind);
+
+// 1 if mw_halo_begin returns with the faces still in flight, so that
+// mw_step_overlap hides them behind the interior sweep. shm copies its
+// on-node faces inside begin and is rejected with --overlap.
+int mw_halo_overlaps(mw_halo_kind kind);
+
+// Sets up the backend for grid g (collective over d->cart). The transport
+// keeps pointers to d and g; g must stay allocated until mw_halo_free. The
+// shm backend moves g's buffers into its window (contents kept) and back
+// into private memory on mw_halo_free, so g->cur/next change across both;
+// it needs both buffers and fails on an in-place grid (mw_grid_inplace).
+// Returns 0 on success, -1 if any rank failed to allocate.
+int  mw_halo_create(mw_halo *h, mw_halo_kind kind, mw_decomp *d, mw_grid *g);
+void mw_halo_free(mw_halo *h);
+
+// Refreshes the six ghost faces of g->cur. Directions with no neighbours
+// are skipped. Time spent on on-node shared-memory faces is added to
+// node_time; everything else is messaging.
+void mw_halo_exchange(mw_halo *h);
+
+// Exchange split in two: begin starts all faces, end completes them
+// (accumulating wait_time). Between the two only owned cells of g->cur may
+// be read and nothing in g->cur written.
+void mw_halo_begin(mw_halo *h);
+void mw_halo_end(mw_halo *h);
+
+// Overlapped step: starts the halos, updates the cells that do not touch a
+// neighbour's ghost layer while messages are in flight, completes the
+// exchange, finishes the boundary shell and swaps. Bit-identical to
+// mw_halo_exchange + mw_step. Compute and halo times are added to *comp
+// and *comm.
+void mw_step_overlap(mw_halo *h, double *comp, double *comm);
+
+// Same, folding the new level of every swept cell into s (see
+// mw_step_stats).
+void mw_step_overlap_stats(mw_halo *h, double *comp, double *comm, mw_stats *s);
+
+// Step with a dedicated communication thread: a team of compute + 1
+// threads, where thread 0 (the caller's thread, so MPI_THREAD_FUNNELED
+// suffices) starts the halos and progresses them to completion inside MPI
+// while the other threads sweep the cells that do not touch a neighbour's
+// ghost layer; the compute threads then finish the boundary shell and the
+// grid is swapped. Bit-identical to mw_halo_exchange + mw_step. Adds the
+// exchange's duration to *comm, the part of it the compute threads waited
+// for (arrival after the interior was done) to *exposed, and the rest of
+// the step to *comp. Call outside a parallel region.
+void mw_step_comm_thread(mw_halo *h, int compute, double *comp, double *comm,
+                         double *exposed);
+
+// mw_decomp_rebalance with the transport rebuilt around the resized grid;
+// accumulated times are kept. Returns 1 if any planes moved.
+int mw_halo_rebalance(mw_halo *h, double comp);
+
+// Exchanges timed per backend by the comparison mode.
+#ifndef MW_HALO_COMPARE_REPS
+#define MW_HALO_COMPARE_REPS 20
+#endif
+
+// Times `reps` exchanges (after a warm-up) with every backend on d/g and
+// stores the slowest rank's seconds per exchange in times[kind]. Ghost
+// layers of g->cur are refreshed, nothing else is touched. Returns the
+// fastest backend, among those that overlap (mw_halo_overlaps) if overlap
+// is set.
+mw_halo_kind mw_halo_compare(mw_decomp *d, mw_grid *g, int reps, int overlap,
+                             double times[MW_HALO_COUNT]);
+
+#endif
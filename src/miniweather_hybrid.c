@@ -1,7 +1,22 @@
 // miniweather_hybrid.c - MPI + OpenMP hybrid with metrics
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include <string.h>
 #include <mpi.h>
+#include "miniweather_core.h"
+#include "miniweather_decomp.h"
+#include "miniweather_halo.h"
+#include "miniweather_ckpt.h"
+#include "miniweather_snap.h"
+#include "miniweather_numa.h"
+#include "miniweather_pmu.h"
+#include "miniweather_roof.h"
+#include "miniweather_opts.h"
+#include "miniweather_mg.h"
+#include "miniweather_ens.h"
+#include "miniweather_deep.h"
+#include "miniweather_tasks.h"
 
 #ifdef _OPENMP
   #include <omp.h>
@@ -20,167 +35,593 @@
 #define STEPS 20
 #endif
 
-#define IDX(x,y,z,sx) ( ((x) * (NY) + (y)) * (NZ) + (z) )
+int main(int argc, char **argv) {
+    // Serialized: the task-graph step calls MPI from whichever thread runs
+    // a halo task, never from two at once (the communication thread mode
+    // only needs funneled: its MPI thread is the master)
+    int provided = MPI_THREAD_SINGLE;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_SERIALIZED, &provided);
+    MPI_Comm comm = MPI_COMM_WORLD;
 
-static void init_local(double *grid, int lx, int gx0) {
-    const int sx = lx + 2;
+    int rank = 0, size = 1;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
 
-    #pragma omp parallel for collapse(3)
-    for (int x = 0; x < sx; ++x) {
-        for (int y = 0; y < NY; ++y) {
-            for (int z = 0; z < NZ; ++z) {
-                int gx = gx0 + (x - 1);
-                if (gx < 0) gx = 0;
-                grid[IDX(x,y,z,sx)] = (double)(gx + y + z);
-            }
-        }
+    mw_opts opts;
+    mw_opts_defaults(&opts);
+    int bad = mw_opts_parse(&opts, argc, argv,
+                            MW_CAP_STATS | MW_CAP_CPU | MW_CAP_TILE | MW_CAP_MPI |
+                            MW_CAP_HYBRID | MW_CAP_DEEP);
+    if (bad) {
+        if (rank == 0) fprintf(stderr, "ERROR: unknown or unsupported option %s\n", argv[bad]);
+        MPI_Abort(comm, 1);
     }
-}
 
-static void halo_exchange(double *grid, int lx, int left, int right, MPI_Comm comm) {
-    const int sx = lx + 2;
-    const int face_elems = NY * NZ;
+    // Run modes that replace the time loop take only their own options
+    const char *mode = NULL;
+    bad = mw_opts_check_mode(&opts, argc, argv, &mode);
+    if (bad) {
+        if (rank == 0) fprintf(stderr, "ERROR: %s cannot be combined with %s\n", mode, argv[bad]);
+        MPI_Abort(comm, 1);
+    }
+    if (opts.mg && opts.converge <= 0.0) {
+        if (rank == 0) fprintf(stderr, "ERROR: --mg needs --converge=TOL\n");
+        MPI_Abort(comm, 1);
+    }
+    if (opts.ghost_depth > 0 && strcmp(opts.halo, "sendrecv") != 0) {
+        if (rank == 0) fprintf(stderr, "ERROR: --ghost-depth needs --halo=sendrecv\n");
+        MPI_Abort(comm, 1);
+    }
 
-    MPI_Sendrecv(&grid[IDX(1,    0,0,sx)], face_elems, MPI_DOUBLE, left,  100,
-                 &grid[IDX(lx+1, 0,0,sx)], face_elems, MPI_DOUBLE, right, 100,
-                 comm, MPI_STATUS_IGNORE);
+    if (!mw_simd_select(opts.simd)) {
+        if (rank == 0) fprintf(stderr, "ERROR: SIMD kernel '%s' not available\n", opts.simd);
+        MPI_Abort(comm, 1);
+    }
 
-    MPI_Sendrecv(&grid[IDX(lx, 0,0,sx)], face_elems, MPI_DOUBLE, right, 101,
-                 &grid[IDX(0,  0,0,sx)], face_elems, MPI_DOUBLE, left,  101,
-                 comm, MPI_STATUS_IGNORE);
-}
+    if (opts.thp && !mw_grid_hugepages(1)) {
+        if (rank == 0) fprintf(stderr, "ERROR: transparent huge pages not supported\n");
+        MPI_Abort(comm, 1);
+    }
 
-static void step_update(double *restrict g, double *restrict ng, int lx) {
-    const int sx = lx + 2;
+    // In place: one grid buffer plus rolling planes, plain x-ordered sweep only
+    if (opts.inplace && (opts.overlap || opts.rebalance > 0 ||
+                         opts.tile_y > 0 || opts.tile_z > 0 || opts.autotune ||
+                         !mw_grid_inplace(1))) {
+        if (rank == 0) fprintf(stderr, "ERROR: --inplace cannot be combined with --overlap, --rebalance, --tile-y/z or --autotune\n");
+        MPI_Abort(comm, 1);
+    }
 
-    #pragma omp parallel for collapse(3)
-    for (int x = 1; x <= lx; ++x) {
-        for (int y = 1; y < NY - 1; ++y) {
-            for (int z = 1; z < NZ - 1; ++z) {
-                double xm = g[IDX(x-1,y,z,sx)];
-                double xp = g[IDX(x+1,y,z,sx)];
-                double ym = g[IDX(x,y-1,z,sx)];
-                double yp = g[IDX(x,y+1,z,sx)];
-                double zm = g[IDX(x,y,z-1,sx)];
-                double zp = g[IDX(x,y,z+1,sx)];
-                ng[IDX(x,y,z,sx)] = (xm + xp + ym + yp + zm + zp) / 6.0;
-            }
+    // Task graph: plain steps between checkpoints and snapshots only, over
+    // its own tiles
+    if (opts.tasks && (opts.overlap || opts.inplace || opts.rebalance > 0 ||
+                       opts.fused_stats || opts.converge > 0.0 || opts.mg ||
+                       opts.tile_y > 0 || opts.tile_z > 0 || opts.autotune)) {
+        if (rank == 0) fprintf(stderr, "ERROR: --tasks cannot be combined with --overlap, --inplace, --rebalance, --fused-stats, --converge, --mg, --tile-y/z or --autotune\n");
+        MPI_Abort(comm, 1);
+    }
+    if (opts.tasks && provided < MPI_THREAD_SERIALIZED) {
+        if (rank == 0) fprintf(stderr, "ERROR: --tasks needs MPI_THREAD_SERIALIZED (library provides %d)\n", provided);
+        MPI_Abort(comm, 1);
+    }
+
+    // The overlapped step sweeps interior and shell boxes untiled
+    if (opts.overlap && (opts.tile_y > 0 || opts.tile_z > 0 || opts.autotune)) {
+        if (rank == 0) fprintf(stderr, "ERROR: --overlap cannot be combined with --tile-y/z or --autotune\n");
+        MPI_Abort(comm, 1);
+    }
+
+    // Communication thread: same restrictions (it sweeps row chunks),
+    // funneled MPI
+    if (opts.comm_thread && (opts.tasks || opts.overlap || opts.inplace || opts.rebalance > 0 ||
+                             opts.fused_stats || opts.converge > 0.0 || opts.mg ||
+                             opts.tile_y > 0 || opts.tile_z > 0 || opts.autotune)) {
+        if (rank == 0) fprintf(stderr, "ERROR: --comm-thread cannot be combined with --tasks, --overlap, --inplace, --rebalance, --fused-stats, --converge, --mg, --tile-y/z or --autotune\n");
+        MPI_Abort(comm, 1);
+    }
+    if (opts.comm_thread && provided < MPI_THREAD_FUNNELED) {
+        if (rank == 0) fprintf(stderr, "ERROR: --comm-thread needs MPI_THREAD_FUNNELED (library provides %d)\n", provided);
+        MPI_Abort(comm, 1);
+    }
+
+#ifdef _OPENMP
+    int threads = omp_get_max_threads();
+#else
+    int threads = 1;
+#endif
+
+    // Ensemble: many small independent grids instead of the decomposed one
+    if (opts.ensemble > 0) {
+        const int rc = mw_ens_run(&opts, comm, STEPS, "hybrid", threads);
+        if (rc != 0) MPI_Abort(comm, rc);
+        MPI_Finalize();
+        return 0;
+    }
+
+    // Cartesian split over 1, 2 or 3 directions; ranks may be renumbered
+    mw_decomp d;
+    if (mw_decomp_create(&d, comm, opts.decomp, NX, NY, NZ) != 0) {
+        if (rank == 0) {
+            fprintf(stderr, "ERROR: cannot split %dx%dx%d over %d ranks in %d direction(s)\n",
+                    NX, NY, NZ, size, opts.decomp);
+        }
+        MPI_Abort(comm, 1);
+    }
+    comm = d.cart;
+    rank = d.rank;
+
+    // Deep ghost zones replace the halo transport and the time loop
+    if (opts.ghost_depth > 0) {
+        const int rc = mw_deep_run(&d, opts.ghost_depth, STEPS, "hybrid", threads);
+        if (rc != 0) MPI_Abort(comm, rc);
+        mw_decomp_free(&d);
+        MPI_Finalize();
+        return 0;
+    }
+
+    mw_grid g;
+    if (mw_decomp_grid(&d, &g) != 0) {
+        if (rank == 0) fprintf(stderr, "Allocation failed\n");
+        MPI_Abort(comm, 2);
+    }
+
+    // Resume from a checkpoint; the writer may have used any rank count
+    int start_step = 0;
+    if (opts.restart) {
+        int rc = mw_ckpt_read(opts.checkpoint_file, &d, &g, &start_step);
+        if (rc != 0) {
+            if (rank == 0) fprintf(stderr, "ERROR: cannot restart from '%s' (%s)\n",
+                                   opts.checkpoint_file,
+                                   rc == -2 ? "different grid or precision" : "unreadable");
+            MPI_Abort(comm, 1);
         }
+        if (rank == 0) printf("RESTART: FILE=%s STEP=%d\n", opts.checkpoint_file, start_step);
     }
 
-    #pragma omp parallel for collapse(3)
-    for (int x = 1; x <= lx; ++x) {
-        for (int y = 1; y < NY - 1; ++y) {
-            for (int z = 1; z < NZ - 1; ++z) {
-                g[IDX(x,y,z,sx)] = ng[IDX(x,y,z,sx)];
+    // Halo transport; "auto" runs the comparison and keeps the fastest
+    const int halo_auto = strcmp(opts.halo, "auto") == 0;
+    int halo_kind = halo_auto ? MW_HALO_SENDRECV : mw_halo_parse(opts.halo);
+    if (halo_kind < 0) {
+        if (rank == 0) fprintf(stderr, "ERROR: unknown halo backend '%s'\n", opts.halo);
+        MPI_Abort(comm, 1);
+    }
+    // shm copies on-node faces inside the begin phase: nothing to overlap
+    if (opts.overlap && !halo_auto && !mw_halo_overlaps((mw_halo_kind)halo_kind)) {
+        if (rank == 0) fprintf(stderr, "ERROR: --overlap cannot be combined with --halo=%s\n", opts.halo);
+        MPI_Abort(comm, 1);
+    }
+    if (opts.halo_compare || halo_auto) {
+        double halo_times[MW_HALO_COUNT];
+        mw_halo_kind best = mw_halo_compare(&d, &g, MW_HALO_COMPARE_REPS, opts.overlap,
+                                            halo_times);
+        if (rank == 0) {
+            for (int k = 0; k < MW_HALO_COUNT; ++k) {
+                printf("HALO_COMPARE: BACKEND=%s DECOMP=%dx%dx%d TIME_PER_EXCHANGE=%.6e\n",
+                       mw_halo_name((mw_halo_kind)k), d.dims[0], d.dims[1], d.dims[2],
+                       halo_times[k]);
             }
         }
+        if (halo_auto) halo_kind = best;
     }
-}
 
-int main(int argc, char **argv) {
-    MPI_Init(&argc, &argv);
-    MPI_Comm comm = MPI_COMM_WORLD;
+    mw_halo h;
+    if (mw_halo_create(&h, (mw_halo_kind)halo_kind, &d, &g) != 0) {
+        if (rank == 0) fprintf(stderr, "ERROR: cannot set up halo backend '%s'\n",
+                               mw_halo_name((mw_halo_kind)halo_kind));
+        MPI_Abort(comm, 2);
+    }
 
-    int rank = 0, size = 1;
-    MPI_Comm_rank(comm, &rank);
-    MPI_Comm_size(comm, &size);
+    // Thread split of the communication thread mode: thread 0 exchanges,
+    // `compute` threads sweep (default: the rest of the team)
+    const int compute = opts.compute_threads > 0 ? opts.compute_threads : threads - 1;
+    if (opts.comm_thread && compute < 1) {
+        if (rank == 0) fprintf(stderr, "ERROR: --comm-thread needs at least one compute thread (OMP_NUM_THREADS >= 2 or --compute-threads)\n");
+        MPI_Abort(comm, 1);
+    }
 
-    if (size > NX) {
+    // Optional y/z cache tiling; rank 0 tunes on its slab so all ranks agree
+    int tile[2] = { opts.tile_y, opts.tile_z };
+    if (opts.autotune) {
         if (rank == 0) {
-            fprintf(stderr, "ERROR: size (%d) > NX (%d)\n", size, NX);
+            int cached = mw_autotune_tiles(&g, 1, d.n[0], opts.tile_cache, NX, NY, NZ,
+                                       threads, opts.autotune > 1, &tile[0], &tile[1]);
+            printf("AUTOTUNE: TILE=%dx%d SOURCE=%s FILE=%s\n",
+                   tile[0], tile[1], cached ? "cache" : "search", opts.tile_cache);
         }
-        MPI_Abort(comm, 1);
+        MPI_Bcast(tile, 2, MPI_INT, 0, comm);
+    }
+
+    mw_tasks tasks;
+    if (opts.tasks && mw_tasks_create(&tasks, &h, opts.task_x, opts.task_y) != 0) {
+        fprintf(stderr, "ERROR: cannot set up the task graph on rank %d\n", rank);
+        MPI_Abort(comm, 2);
     }
 
-    const int base = NX / size;
-    const int rem  = NX % size;
-    const int lx  = base + ((rank == size - 1) ? rem : 0);
-    const int gx0 = rank * base;
+    // Placement of every rank's threads and grid, printed by rank 0
+    if (opts.numa_report) mw_numa_print_all(&g, comm);
 
-    const size_t slab_elems = (size_t)(lx + 2) * NY * NZ;
-    double *grid     = (double*)malloc(slab_elems * sizeof(double));
-    double *new_grid = (double*)malloc(slab_elems * sizeof(double));
+    // Optional snapshots: every rank hands its block to its own writer
+    // thread (plain file I/O, no MPI calls off the main thread)
+    const int snap_codec = mw_snap_parse(opts.snapshot_codec);
+    if (snap_codec < 0) {
+        if (rank == 0) fprintf(stderr, "ERROR: unknown snapshot codec '%s'\n", opts.snapshot_codec);
+        MPI_Abort(comm, 1);
+    }
+    mw_snap snap;
+    if (opts.snapshot > 0 &&
+        mw_snap_open(&snap, opts.snapshot_prefix, rank, (mw_snap_codec)snap_codec,
+                     opts.snapshot_stride) != 0) {
+        fprintf(stderr, "ERROR: cannot start snapshot writer on rank %d\n", rank);
+        MPI_Abort(comm, 2);
+    }
 
-    if (!grid || !new_grid) {
-        if (rank == 0) fprintf(stderr, "Allocation failed\n");
+    // Machine peaks for the roofline, summed over ranks
+    mw_roof roof_sum = { 0.0, 0.0 };
+    if (opts.roofline && mw_roof_probe_all(&roof_sum, (size_t)opts.roofline_mb << 20, comm) != 0) {
+        if (rank == 0) fprintf(stderr, "ERROR: cannot allocate %d MiB per rank for the bandwidth probe\n",
+                               opts.roofline_mb);
         MPI_Abort(comm, 2);
     }
 
-    init_local(grid, lx, gx0);
+    // Convergence mode: the residual of every K-th step, reduced behind the
+    // sweep and checked K steps later
+    const int conv_norm = mw_norm_parse(opts.converge_norm);
+    if (conv_norm < 0 || opts.converge_every < 1) {
+        if (rank == 0) fprintf(stderr, "ERROR: bad convergence norm '%s' or interval %d\n",
+                               opts.converge_norm, opts.converge_every);
+        MPI_Abort(comm, 1);
+    }
+    const int conv_every = opts.converge > 0.0 ? opts.converge_every : 0;
+
+    // Multigrid: V-cycles to the tolerance replace the time loop
+    if (opts.mg) {
+        const int rc = mw_mg_run(&g, &h, &opts, conv_norm, STEPS, "hybrid", threads);
+        if (rc != 0) MPI_Abort(comm, rc);
+        mw_halo_free(&h);
+        mw_grid_free(&g);
+        mw_decomp_free(&d);
+        MPI_Finalize();
+        return 0;
+    }
+    mw_conv conv;
+    mw_conv_init(&conv, comm, opts.converge_norm, conv_norm, opts.converge,
+                 (double)(NX-2) * (NY-2) * (NZ-2));
+    double conv_local = 0.0;
+    int steps_taken = STEPS;
 
-    const int left  = (rank == 0)        ? MPI_PROC_NULL : rank - 1;
-    const int right = (rank == size - 1) ? MPI_PROC_NULL : rank + 1;
+    // Fused statistics: the last step (and every --stats-every step) folds
+    // the new level into stats while sweeping; stats_step is the step they
+    // describe
+    mw_stats stats;
+    mw_stats_clear(&stats);
+    int stats_step = -1;
 
-#ifdef _OPENMP
-    int threads = omp_get_max_threads();
-#else
-    int threads = 1;
-#endif
+    // Hardware counters of every thread around sweeps and halo exchanges
+    mw_pmu pmu;
+    if (opts.pmu) mw_pmu_open(&pmu);
 
     // Timing variables
     double comm_time = 0.0;
     double comp_time = 0.0;
+    double ckpt_time = 0.0;
+    double comm_exposed = 0.0;   // communication thread: exchange the sweep waited for
 
     MPI_Barrier(comm);
     const double t0 = MPI_Wtime();
 
-    for (int t = 0; t < STEPS; ++t) {
-        double t_comm_start = MPI_Wtime();
-        halo_exchange(grid, lx, left, right, comm);
-        double t_comm_end = MPI_Wtime();
-        comm_time += (t_comm_end - t_comm_start);
-        
-        double t_comp_start = MPI_Wtime();
-        step_update(grid, new_grid, lx);
-        double t_comp_end = MPI_Wtime();
-        comp_time += (t_comp_end - t_comp_start);
-    }
+    // Rebalancing windows: compute imbalance of the first and last window
+    double window_start = 0.0;
+    double imb_before = -1.0, imb_after = -1.0;
 
-    MPI_Barrier(comm);
-    const double t1 = MPI_Wtime();
-    const double local_elapsed = t1 - t0;
+    for (int t = start_step; t < STEPS; ++t) {
+        const double comp0 = comp_time, comm0 = comm_time;
+        const int conv_check = conv_every > 0 && (t + 1) % conv_every == 0;
+        const int stats_now = opts.fused_stats && (t + 1 == STEPS ||
+                              (opts.stats_every > 0 && (t + 1) % opts.stats_every == 0));
+        if (stats_now) mw_stats_clear(&stats);
+        if (opts.tasks) {
+            // One task graph up to the next checkpoint or snapshot step
+            int w = STEPS - t;
+            if (opts.checkpoint > 0 && opts.checkpoint - t % opts.checkpoint < w)
+                w = opts.checkpoint - t % opts.checkpoint;
+            if (opts.snapshot > 0 && opts.snapshot - t % opts.snapshot < w)
+                w = opts.snapshot - t % opts.snapshot;
+            if (opts.pmu) mw_pmu_begin(&pmu);
+            mw_tasks_run(&tasks, w, &comp_time, &comm_time);
+            if (opts.pmu) mw_pmu_end(&pmu, MW_PMU_COMP);
+            t += w - 1;
+        } else if (opts.comm_thread) {
+            if (opts.pmu) mw_pmu_begin(&pmu);
+            mw_step_comm_thread(&h, compute, &comp_time, &comm_time, &comm_exposed);
+            if (opts.pmu) mw_pmu_end(&pmu, MW_PMU_COMP);
+        } else if (opts.overlap) {
+            if (opts.pmu) mw_pmu_begin(&pmu);
+            if (stats_now) mw_step_overlap_stats(&h, &comp_time, &comm_time, &stats);
+            else           mw_step_overlap(&h, &comp_time, &comm_time);
+            if (conv_check) {
+                // The split sweep has no fused residual: one extra pass
+                const double t_res = MPI_Wtime();
+                conv_local = mw_residual(&g, 1, d.n[0], conv_norm);
+                comp_time += MPI_Wtime() - t_res;
+            }
+            if (opts.pmu) mw_pmu_end(&pmu, MW_PMU_COMP);
+        } else {
+            if (opts.pmu) mw_pmu_begin(&pmu);
+            double t_comm_start = MPI_Wtime();
+            mw_halo_exchange(&h);
+            double t_comm_end = MPI_Wtime();
+            if (opts.pmu) mw_pmu_end(&pmu, MW_PMU_COMM);
+            comm_time += (t_comm_end - t_comm_start);
+
+            if (opts.pmu) mw_pmu_begin(&pmu);
+            double t_comp_start = MPI_Wtime();
+            if (conv_check)     conv_local = mw_step_residual(&g, 1, d.n[0], conv_norm);
+            else if (stats_now) mw_step_stats(&g, 1, d.n[0], &stats);
+            else                mw_step_tiled(&g, 1, d.n[0], tile[0], tile[1]);
+            double t_comp_end = MPI_Wtime();
+            if (opts.pmu) mw_pmu_end(&pmu, MW_PMU_COMP);
+            comp_time += (t_comp_end - t_comp_start);
+        }
+        if (opts.pmu) mw_pmu_trace_step(&pmu, t + 1, comp_time - comp0, comm_time - comm0);
+
+        // Global boundary layers complete the fused statistics (a plain
+        // residual step cannot fuse both and takes one extra pass)
+        if (stats_now) {
+            mw_decomp_stats(&d, &g, &stats, opts.overlap || !conv_check);
+            stats_step = t + 1;
+            if (opts.stats_every > 0) {
+                mw_stats all;
+                mw_stats_reduce(&stats, &all, 0, comm);
+                if (rank == 0) mw_stats_print(t + 1, &all);
+            }
+        }
 
-    double local_sum = 0.0;
-    {
-        const int sx = lx + 2;
-        #pragma omp parallel for collapse(3) reduction(+:local_sum)
-        for (int x = 1; x <= lx; ++x) {
-            for (int y = 0; y < NY; ++y) {
-                for (int z = 0; z < NZ; ++z) {
-                    local_sum += grid[IDX(x,y,z,sx)];
+        // Every K steps: measure the window's compute imbalance and move
+        // x-planes towards the faster slabs if it exceeds the threshold
+        if (opts.rebalance > 0 && (t + 1) % opts.rebalance == 0) {
+            const double window = comp_time - window_start;
+            const double imb = mw_decomp_imbalance(&d, window);
+            if (imb_before < 0.0) imb_before = imb;
+            imb_after = imb;
+            if (t + 1 < STEPS && imb > opts.rebalance_threshold) {
+                const int moved = mw_halo_rebalance(&h, window);
+                if (rank == 0) {
+                    printf("REBALANCE: STEP=%d IMBALANCE=%.3f MIGRATED=%d\n",
+                           t + 1, imb, moved);
                 }
             }
+            window_start = comp_time;
+        }
+
+        // Every N steps: collective write of the whole state to one file
+        if (opts.checkpoint > 0 && (t + 1) % opts.checkpoint == 0) {
+            double t_ckpt_start = MPI_Wtime();
+            if (mw_ckpt_write(opts.checkpoint_file, &d, &g, t + 1) != 0) {
+                if (rank == 0) fprintf(stderr, "ERROR: cannot write checkpoint '%s'\n",
+                                       opts.checkpoint_file);
+                MPI_Abort(comm, 2);
+            }
+            ckpt_time += MPI_Wtime() - t_ckpt_start;
+        }
+
+        if (opts.snapshot > 0 && (t + 1) % opts.snapshot == 0) {
+            const int org[3] = { d.lo[0] - 1, d.lo[1] - 1, d.lo[2] - 1 };
+            mw_snap_write(&snap, &g, d.sum_lo, d.sum_hi, org, t + 1);
+        }
+
+        // Check the residual reduced over the last interval, then start
+        // this interval's reduction behind the sweep
+        if (conv_check) {
+            if (mw_conv_check(&conv)) {
+                steps_taken = t + 1;
+                break;
+            }
+            mw_conv_post(&conv, conv_local);
         }
     }
+    mw_conv_finish(&conv);
 
+    // Queued snapshots still count: the run ends when they are on disk
+    double snap_bytes = 0.0, snap_write = 0.0, snap_stall = 0.0;
+    if (opts.snapshot > 0) {
+        mw_snap_close(&snap);
+        snap_bytes = snap.bytes;
+        snap_write = snap.write_time;
+        snap_stall = snap.stall_time;
+    }
+
+    MPI_Barrier(comm);
+    const double t1 = MPI_Wtime();
+    const double local_elapsed = t1 - t0;
+
+    // Communication left on the critical path: all of it when blocking,
+    // only the time stalled completing the exchange when overlapped, and
+    // the time the sweep waited for the communication thread. The task
+    // graph has no such number: a halo task's wait is not a stall of the
+    // graph (other tiles run meanwhile), and a thread idles for want of
+    // any ready tile, halo-dependent or not, so it is not reported there
+    // (TASK_IDLE_PCT is the graph's measure of lost time)
+    const double exposed_time = opts.comm_thread ? comm_exposed :
+                                opts.overlap ? h.wait_time : comm_time;
+
+    // Halo time split by path: shared-memory copies from on-node neighbours
+    // and MPI messaging. Only shm tells the two apart; the other backends
+    // message on-node neighbours too, so they report no split
+    const double node_time = h.node_time;
+    const double net_time = comm_time - node_time;
+
+    // Without rebalancing windows both report the whole-run imbalance
+    const double run_imb = mw_decomp_imbalance(&d, comp_time);
+    if (imb_before < 0.0) imb_before = imb_after = run_imb;
+
+    // Checksum: by-product of the last sweep in fused mode (one pass after
+    // the loop only if the run converged before STEPS), merged over ranks
+    // with one packed reduction
+    mw_stats all_stats;
     double global_sum = 0.0;
+    if (opts.fused_stats) {
+        if (stats_step != steps_taken) mw_decomp_stats(&d, &g, &stats, 0);
+        mw_stats_reduce(&stats, &all_stats, 0, comm);
+        global_sum = all_stats.sum;
+    } else {
+        double local_sum = mw_decomp_checksum(&d, &g);
+        MPI_Reduce(&local_sum, &global_sum, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+    }
+
+    // Memory per rank: grid buffers and peak RSS, total and busiest rank
+    const double mem_local[2] = { (double)mw_grid_bytes(&g), mw_peak_rss() };
+    double mem_total[2] = { 0.0, 0.0 }, mem_max[2] = { 0.0, 0.0 };
+    MPI_Reduce(mem_local, mem_total, 2, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Reduce(mem_local, mem_max, 2, MPI_DOUBLE, MPI_MAX, 0, comm);
+
     double max_elapsed = 0.0;
     double max_comm_time = 0.0;
     double max_comp_time = 0.0;
+    double max_exposed_time = 0.0;
+    double max_node_time = 0.0;
+    double max_net_time = 0.0;
+    double max_ckpt_time = 0.0;
+    double total_snap_bytes = 0.0;
+    double max_snap_write = 0.0;
+    double max_snap_stall = 0.0;
     
-    MPI_Reduce(&local_sum, &global_sum, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
     MPI_Reduce(&local_elapsed, &max_elapsed, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
     MPI_Reduce(&comm_time, &max_comm_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
     MPI_Reduce(&comp_time, &max_comp_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(&exposed_time, &max_exposed_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(&node_time, &max_node_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(&net_time, &max_net_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(&ckpt_time, &max_ckpt_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(&snap_bytes, &total_snap_bytes, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Reduce(&snap_write, &max_snap_write, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(&snap_stall, &max_snap_stall, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+
+    // Counters reduced over ranks; rank 0 collects the per-step trace
+    char pmu_str[1024] = " PMU=0";
+    if (opts.pmu) {
+        mw_pmu_report(&pmu, comm, max_comp_time, opts.pmu_trace, pmu_str, sizeof pmu_str);
+        mw_pmu_close(&pmu);
+    }
+
+    // Task graph: tile, halo and idle seconds of every thread, printed by
+    // rank 0, plus the mean and worst idle share for METRICS
+    char task_str[160] = " TASKS=0";
+    if (opts.tasks) {
+        double *mine = (double*)malloc((size_t)threads * 4 * sizeof(double));
+        double *all = rank == 0 ? (double*)malloc((size_t)size * threads * 4 * sizeof(double)) : NULL;
+        if (!mine || (rank == 0 && !all)) MPI_Abort(comm, 2);
+        for (int t = 0; t < threads; ++t) {
+            mine[4*t+0] = mw_tasks_tile_time(&tasks, t);
+            mine[4*t+1] = mw_tasks_halo_time(&tasks, t);
+            mine[4*t+2] = mw_tasks_idle_time(&tasks, t);
+            mine[4*t+3] = tasks.wall;
+        }
+        MPI_Gather(mine, threads * 4, MPI_DOUBLE, all, threads * 4, MPI_DOUBLE, 0, comm);
+        if (rank == 0) {
+            double idle_sum = 0.0, idle_max = 0.0;
+            for (int r = 0; r < size; ++r) {
+                for (int t = 0; t < threads; ++t) {
+                    const double *v = &all[((size_t)r * threads + t) * 4];
+                    const double pct = v[3] > 0.0 ? 100.0 * v[2] / v[3] : 0.0;
+                    printf("TASKS: RANK=%d THREAD=%d TILE_TIME=%.6f HALO_TIME=%.6f IDLE_TIME=%.6f IDLE_PCT=%.2f\n",
+                           r, t, v[0], v[1], v[2], pct);
+                    idle_sum += pct;
+                    if (pct > idle_max) idle_max = pct;
+                }
+            }
+            snprintf(task_str, sizeof task_str,
+                     " TASKS=1 TASK_TILE=%dx%d TASK_TILES=%d TASK_IDLE_PCT=%.2f TASK_IDLE_MAX_PCT=%.2f",
+                     tasks.tx, tasks.ty, tasks.ntx * tasks.nty, idle_sum / (size * threads), idle_max);
+        }
+        free(mine);
+        free(all);
+        mw_tasks_free(&tasks);
+    }
+
+    // Communication thread: share of the exchange time (summed over ranks)
+    // hidden behind the interior sweep
+    char comm_str[128] = " COMM_THREAD=0";
+    if (opts.comm_thread) {
+        const double mine[2] = { comm_time, comm_exposed };
+        double sum[2] = { 0.0, 0.0 };
+        MPI_Reduce(mine, sum, 2, MPI_DOUBLE, MPI_SUM, 0, comm);
+        const double exposed_pct = sum[0] > 0.0 ? 100.0 * sum[1] / sum[0] : 0.0;
+        snprintf(comm_str, sizeof comm_str,
+                 " COMM_THREAD=1 COMPUTE_THREADS=%d COMM_HIDDEN_PCT=%.2f COMM_EXPOSED_PCT=%.2f",
+                 compute, 100.0 - exposed_pct, exposed_pct);
+    }
 
     if (rank == 0) {
         size_t total_cells = (size_t)NX * NY * NZ;
-        double throughput_steps = STEPS / max_elapsed;
-        double throughput_cells = (total_cells * STEPS) / max_elapsed;
+        const int steps_run = steps_taken - start_step;   // fewer after a restart or convergence
+        double throughput_steps = steps_run / max_elapsed;
+        double throughput_cells = (total_cells * steps_run) / max_elapsed;
         double comm_pct = 100.0 * max_comm_time / max_elapsed;
         double comp_pct = 100.0 * max_comp_time / max_elapsed;
+        // Aggregate snapshot bandwidth: all ranks' bytes over the busiest writer
+        double snap_bw = max_snap_write > 0.0 ? total_snap_bytes / max_snap_write : 0.0;
         
-        printf("METRICS: VERSION=hybrid RANKS=%d THREADS=%d GRID=%dx%dx%d STEPS=%d TIME=%.6f "
-               "COMM_TIME=%.6f COMP_TIME=%.6f COMM_PCT=%.2f COMP_PCT=%.2f "
-               "THROUGHPUT_STEPS=%.2f THROUGHPUT_CELLS=%.2e CHECKSUM=%.10e\n",
-               size, threads, NX, NY, NZ, STEPS, max_elapsed,
-               max_comm_time, max_comp_time, comm_pct, comp_pct,
-               throughput_steps, throughput_cells, global_sum);
+        // Position of the sweep under the measured roofs
+        char roof_str[256] = " ROOFLINE=0";
+        if (opts.roofline) {
+            int n = snprintf(roof_str, sizeof roof_str, " ROOFLINE=1");
+            mw_roof_format(roof_str + n, sizeof roof_str - n, &roof_sum, throughput_cells,
+                           mw_bytes_per_update(1), mw_flops_per_update());
+        }
+
+        // Steps taken and the time the skipped ones would have cost at this rate
+        char conv_str[192] = " CONVERGE=0";
+        if (conv_every > 0) {
+            mw_conv_format(&conv, conv_str, sizeof conv_str, STEPS, steps_taken, steps_run,
+                           max_elapsed);
+        }
+
+        char node_str[80] = "";
+        if (h.kind == MW_HALO_SHM) {
+            snprintf(node_str, sizeof node_str, " COMM_NODE_TIME=%.6f COMM_NET_TIME=%.6f",
+                     max_node_time, max_net_time);
+        }
+
+        char exposed_str[40] = "";
+        if (!opts.tasks) snprintf(exposed_str, sizeof exposed_str, " EXPOSED_COMM_TIME=%.6f", max_exposed_time);
+
+        char stats_str[128] = " FUSED_STATS=0";
+        if (opts.fused_stats) {
+            snprintf(stats_str, sizeof stats_str, " FUSED_STATS=1 MIN=%.6e MAX=%.6e MEAN=%.10e",
+                     all_stats.min, all_stats.max, all_stats.sum / all_stats.cells);
+        }
+
+        // Relative checksum drift against a (double precision) reference run
+        char drift[48] = "";
+        if (opts.ref_checksum != 0.0) {
+            snprintf(drift, sizeof drift, " CHECKSUM_DRIFT=%.3e",
+                     fabs(global_sum - opts.ref_checksum) / fabs(opts.ref_checksum));
+        }
+
+        printf("METRICS: VERSION=hybrid RANKS=%d DECOMP=%dx%dx%d THREADS=%d GRID=%dx%dx%d STEPS=%d TIME=%.6f "
+               "COMM_TIME=%.6f%s "
+               "COMP_TIME=%.6f COMM_PCT=%.2f COMP_PCT=%.2f "
+               "HALO=%s OVERLAP=%d%s "
+               "REBALANCE=%d IMBALANCE_BEFORE=%.3f IMBALANCE_AFTER=%.3f "
+               "CHECKPOINT=%d CHECKPOINT_TIME=%.6f RESTART_STEP=%d "
+               "SNAPSHOT=%d SNAPSHOT_CODEC=%s SNAPSHOT_BYTES=%.3e SNAPSHOT_BW=%.2e SNAPSHOT_STALL_TIME=%.6f "
+               "THROUGHPUT_STEPS=%.2f THROUGHPUT_CELLS=%.2e SIMD=%s TILE=%dx%d PRECISION=%d INPLACE=%d GRID_MB=%.1f PEAK_RSS_MB=%.1f "
+               "PEAK_RSS_MAX_MB=%.1f CHECKSUM=%.10e%s%s%s%s%s%s%s\n",
+               size, d.dims[0], d.dims[1], d.dims[2], threads, NX, NY, NZ, STEPS, max_elapsed,
+               max_comm_time, node_str,
+               max_comp_time, comm_pct, comp_pct,
+               mw_halo_name(h.kind), opts.overlap, exposed_str,
+               opts.rebalance, imb_before, imb_after,
+               opts.checkpoint, max_ckpt_time, start_step,
+               opts.snapshot, opts.snapshot_codec, total_snap_bytes, snap_bw, max_snap_stall,
+               throughput_steps, throughput_cells, mw_simd_name(), tile[0], tile[1], MW_PRECISION,
+               opts.inplace, mem_total[0] / 1048576.0, mem_total[1] / 1048576.0,
+               mem_max[1] / 1048576.0, global_sum, stats_str, drift, pmu_str, roof_str, conv_str,
+               task_str, comm_str);
     }
 
-    free(new_grid);
-    free(grid);
+    mw_halo_free(&h);
+    mw_grid_free(&g);
+    mw_decomp_free(&d);
     MPI_Finalize();
     return 0;
 }
\ No newline at end of file
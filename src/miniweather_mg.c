@@ -0,0 +1,424 @@
+// miniweather_mg.c - Geometric multigrid V-cycles for the steady state
+//
+// Level l has spacing h = 2^l. The error equation on a coarse level is
+// (6 e - sum of neighbours) / h^2 = f; every level stores f scaled by
+// h^2 / 6, so the Jacobi update is the fine-level row kernel plus f.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "miniweather_mg.h"
+
+// Ghost layers of a coarse error from the per-direction extrapolation
+// factors. Faces are filled x, y, z over growing ranges so edges and
+// corners are set too; faces shared with a neighbouring rank are then
+// overwritten by the exchange.
+static void fill_ghosts(mw_mg *mg, int l) {
+    mw_grid *g = mg->lev[l];
+    mw_real *restrict e = g->cur;
+    const int nx = g->sx - 2, ny = g->sy - 2, nz = g->sz - 2;
+    const double *k = mg->ghost[l];
+
+    for (int y = 1; y <= ny; ++y) {
+        for (int z = 1; z <= nz; ++z) {
+            e[MW_IDX(g, 0, y, z)] = (mw_real)(k[0] * e[MW_IDX(g, 1, y, z)]);
+            e[MW_IDX(g, nx + 1, y, z)] = (mw_real)(k[0] * e[MW_IDX(g, nx, y, z)]);
+        }
+    }
+    for (int x = 0; x <= nx + 1; ++x) {
+        for (int z = 1; z <= nz; ++z) {
+            e[MW_IDX(g, x, 0, z)] = (mw_real)(k[1] * e[MW_IDX(g, x, 1, z)]);
+            e[MW_IDX(g, x, ny + 1, z)] = (mw_real)(k[1] * e[MW_IDX(g, x, ny, z)]);
+        }
+    }
+    for (int x = 0; x <= nx + 1; ++x) {
+        for (int y = 0; y <= ny + 1; ++y) {
+            e[MW_IDX(g, x, y, 0)] = (mw_real)(k[2] * e[MW_IDX(g, x, y, 1)]);
+            e[MW_IDX(g, x, y, nz + 1)] = (mw_real)(k[2] * e[MW_IDX(g, x, y, nz)]);
+        }
+    }
+}
+
+// Ghost layers of level l's cur: fixed data on level 0, extrapolated
+// error on coarse levels, then whatever the neighbouring ranks own.
+static void exchange(mw_mg *mg, int l) {
+    if (l > 0) fill_ghosts(mg, l);
+    if (mg->exchange) mg->exchange(mg->ctx, l, mg->lev[l]);
+}
+
+// Jacobi update of level l into next, relaxed by w towards it row by row
+// while the row is still in L1: w = MW_MG_OMEGA smooths, w = 1 and
+// `minus_u` leave the scaled residual (update - u) for the restriction.
+static void relax(mw_mg *mg, int l, double w, int minus_u) {
+    mw_grid *grid = mg->lev[l];
+    const mw_real *restrict g = grid->cur;
+    mw_real *restrict ng = grid->next;
+    const mw_real *restrict f = mg->f[l];
+    const int sy = grid->sy, zs = grid->zs, z_hi = grid->sz - 2;
+    const size_t px = (size_t)sy * zs;
+    const mw_row_fn row = mw_row_kernel;
+
+#ifdef _OPENMP
+    #pragma omp parallel for collapse(2) schedule(static)
+#endif
+    for (int x = 1; x <= grid->sx - 2; ++x) {
+        for (int y = 1; y <= sy - 2; ++y) {
+            const size_t i0 = ((size_t)x * sy + y) * zs;
+            row(g, ng, i0, px, zs, 1, z_hi + 1);
+            for (int z = 1; z <= z_hi; ++z) {
+                const size_t i = i0 + z;
+                const double u = g[i];
+                const double j = (double)ng[i] + (f ? f[i] : 0.0);
+                ng[i] = (mw_real)(minus_u ? j - u : u + w * (j - u));
+            }
+        }
+    }
+}
+
+static void smooth(mw_mg *mg, int l, int sweeps) {
+    for (int s = 0; s < sweeps; ++s) {
+        exchange(mg, l);
+        relax(mg, l, MW_MG_OMEGA, 0);
+        mw_grid_swap(mg->lev[l]);
+    }
+}
+
+// Fine cells (and weights) a coarse cell c draws on in one direction.
+static inline int restrict_weights(int vertex, int c, int idx[3], double w[3]) {
+    if (vertex) {
+        idx[0] = 2 * c - 1; idx[1] = 2 * c; idx[2] = 2 * c + 1;
+        w[0] = 0.25; w[1] = 0.5; w[2] = 0.25;
+        return 3;
+    }
+    idx[0] = 2 * c - 1; idx[1] = 2 * c;
+    w[0] = w[1] = 0.5;
+    return 2;
+}
+
+// Coarse cells (and weights) fine cell i interpolates from in one direction;
+// index 0 and n+1 are the coarse ghost layers.
+static inline void prolong_weights(int vertex, int i, int idx[2], double w[2]) {
+    if (vertex) {
+        idx[0] = i / 2;
+        idx[1] = (i + 1) / 2;
+        w[0] = w[1] = (i & 1) ? 0.5 : 0.0;
+        if (!(i & 1)) w[0] = 1.0;
+    } else {
+        idx[0] = (i + 1) / 2;
+        idx[1] = (i & 1) ? idx[0] - 1 : idx[0] + 1;
+        w[0] = 0.75;
+        w[1] = 0.25;
+    }
+}
+
+// Coarse right-hand side: the restricted scaled residual, times 4 for the
+// coarse h^2. The residual is staged in next (interior only, so the fixed
+// ghost cells there survive); the coarse error starts at 0.
+static void restrict_residual(mw_mg *mg, int l) {
+    const mw_grid *fg = mg->lev[l];
+    mw_grid *cg = mg->lev[l + 1];
+    const int *vx = mg->vertex[l + 1];
+
+    exchange(mg, l);
+    relax(mg, l, 1.0, 1);
+
+    const mw_real *restrict q = fg->next;
+    mw_real *restrict fc = mg->f[l + 1];
+    memset(cg->cur, 0, cg->elems * sizeof(mw_real));
+#ifdef _OPENMP
+    #pragma omp parallel for collapse(2) schedule(static)
+#endif
+    for (int cx = 1; cx <= cg->sx - 2; ++cx) {
+        for (int cy = 1; cy <= cg->sy - 2; ++cy) {
+            int ix[3], iy[3], iz[3];
+            double wx[3], wy[3], wz[3];
+            const int nx = restrict_weights(vx[0], cx, ix, wx);
+            const int ny = restrict_weights(vx[1], cy, iy, wy);
+            for (int cz = 1; cz <= cg->sz - 2; ++cz) {
+                const int nz = restrict_weights(vx[2], cz, iz, wz);
+                double sum = 0.0;
+                for (int a = 0; a < nx; ++a) {
+                    for (int b = 0; b < ny; ++b) {
+                        const size_t r = MW_IDX(fg, ix[a], iy[b], 0);
+                        double s = 0.0;
+                        for (int c = 0; c < nz; ++c) s += wz[c] * q[r + iz[c]];
+                        sum += wx[a] * wy[b] * s;
+                    }
+                }
+                fc[MW_IDX(cg, cx, cy, cz)] = (mw_real)(4.0 * sum);
+            }
+        }
+    }
+}
+
+static void prolong(mw_mg *mg, int l) {
+    mw_grid *fg = mg->lev[l];
+    const mw_grid *cg = mg->lev[l + 1];
+    const int *vx = mg->vertex[l + 1];
+    mw_real *restrict u = fg->cur;
+    const mw_real *restrict e = cg->cur;
+    const int sy = fg->sy, zs = fg->zs;
+
+    exchange(mg, l + 1);
+#ifdef _OPENMP
+    #pragma omp parallel for collapse(2) schedule(static)
+#endif
+    for (int x = 1; x <= fg->sx - 2; ++x) {
+        for (int y = 1; y <= sy - 2; ++y) {
+            int cx[2], cy[2], cz[2];
+            double wx[2], wy[2], wz[2];
+            prolong_weights(vx[0], x, cx, wx);
+            prolong_weights(vx[1], y, cy, wy);
+            for (int z = 1; z <= fg->sz - 2; ++z) {
+                prolong_weights(vx[2], z, cz, wz);
+                double v = 0.0;
+                for (int a = 0; a < 2; ++a) {
+                    for (int b = 0; b < 2; ++b) {
+                        const size_t r = MW_IDX(cg, cx[a], cy[b], 0);
+                        v += wx[a] * wy[b] * (wz[0] * e[r + cz[0]] + wz[1] * e[r + cz[1]]);
+                    }
+                }
+                const size_t i = ((size_t)x * sy + y) * zs + z;
+                u[i] = (mw_real)(u[i] + v);
+            }
+        }
+    }
+}
+
+static void vcycle(mw_mg *mg, int l) {
+    if (l == mg->levels - 1) {
+        smooth(mg, l, l == 0 ? mg->sweeps : MW_MG_COARSE);
+        return;
+    }
+    smooth(mg, l, mg->sweeps);
+    restrict_residual(mg, l);
+    vcycle(mg, l + 1);
+    prolong(mg, l);
+    smooth(mg, l, mg->sweeps);
+}
+
+int mw_mg_depth(const mw_grid *g) {
+    int n[3] = { g->sx - 2, g->sy - 2, g->sz - 2 };
+    int levels = 1;
+    while (levels < MW_MG_MAX_LEVELS && n[0] >= 4 && n[1] >= 4 && n[2] >= 4) {
+        for (int k = 0; k < 3; ++k) n[k] /= 2;
+        ++levels;
+    }
+    return levels;
+}
+
+int mw_mg_create(mw_mg *mg, mw_grid *g, int levels, int sweeps) {
+    memset(mg, 0, sizeof(*mg));
+    mg->levels = levels < 1 ? 1 : levels > MW_MG_MAX_LEVELS ? MW_MG_MAX_LEVELS : levels;
+    mg->sweeps = sweeps;
+    mg->lev[0] = g;
+    if (!g->next) return -1;
+
+    // Distance from the outermost interior centre to the fixed boundary
+    // cell, in cells of the level: 1 on the fine grid, then 1/4 cell less
+    // per cell-centred halving (towards 1/2) and unchanged relative to
+    // the coarse ghost per vertex-centred one
+    double dist[3] = { 1.0, 1.0, 1.0 };
+    for (int l = 1; l < mg->levels; ++l) {
+        const mw_grid *fg = mg->lev[l - 1];
+        const int n[3] = { fg->sx - 2, fg->sy - 2, fg->sz - 2 };
+        mw_grid *cg = &mg->coarse[l];
+        if (mw_grid_alloc(cg, n[0] / 2 + 2, n[1] / 2 + 2, n[2] / 2 + 2) != 0) {
+            mw_mg_free(mg);
+            return -1;
+        }
+        mg->lev[l] = cg;
+        for (int k = 0; k < 3; ++k) {
+            mg->vertex[l][k] = n[k] & 1;
+            dist[k] = ((mg->vertex[l][k] ? 1.0 : 0.5) + dist[k]) / 2.0;
+            mg->ghost[l][k] = (dist[k] - 1.0) / dist[k];
+        }
+        mg->fmem[l] = calloc(1, mw_grid_buffer_bytes(cg));
+        if (!mg->fmem[l]) {
+            mw_mg_free(mg);
+            return -1;
+        }
+        mg->f[l] = mw_grid_place(mg->fmem[l]);
+    }
+    return 0;
+}
+
+void mw_mg_free(mw_mg *mg) {
+    for (int l = 1; l < MW_MG_MAX_LEVELS; ++l) {
+        if (mg->lev[l]) mw_grid_free(mg->lev[l]);
+        free(mg->fmem[l]);
+        mg->lev[l] = NULL;
+        mg->fmem[l] = NULL;
+        mg->f[l] = NULL;
+    }
+}
+
+void mw_mg_vcycle(mw_mg *mg) {
+    vcycle(mg, 0);
+}
+
+// Global step residual of level 0 without changing cur (next is scratch).
+static double fine_residual(mw_mg *mg, int norm) {
+    mw_grid *g = mg->lev[0];
+    exchange(mg, 0);
+    const double r = mw_stencil_box_residual(g, 1, g->sx - 2, 1, g->sy - 2, 1, g->sz - 2, norm);
+    return mg->norm(mg->ctx, r, norm);
+}
+
+int mw_mg_solve(mw_mg *mg, double tol, int norm, int max_cycles, double *residual) {
+    int cycles = 0;
+    double r = fine_residual(mg, norm);
+    while (r > tol && cycles < max_cycles) {
+        mw_mg_vcycle(mg);
+        ++cycles;
+        r = fine_residual(mg, norm);
+    }
+    *residual = r;
+    return cycles;
+}
+
+int mw_mg_jacobi(mw_mg *mg, double tol, int norm, int every, int max_steps,
+                 double *residual) {
+    mw_grid *g = mg->lev[0];
+    double r = -1.0;
+    int t = 0;
+    while (t < max_steps) {
+        exchange(mg, 0);
+        ++t;
+        if (t % every == 0 || t == max_steps) {
+            r = mg->norm(mg->ctx, mw_step_residual(g, 1, g->sx - 2, norm), norm);
+            if (r <= tol) break;
+        } else {
+            mw_step(g, 1, g->sx - 2);
+        }
+    }
+    *residual = r;
+    return t;
+}
+
+// ---------------------------------------------------------------------------
+// Multigrid mode of the drivers
+// ---------------------------------------------------------------------------
+
+static double wtime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Ghost layers of the levels: the run's halo on the fine grid, a sendrecv
+// halo on every coarse level (same ranks, coarse extents). Without a halo
+// the grid is the whole domain and nothing is exchanged or reduced.
+typedef struct {
+    mw_halo *fine;
+    mw_decomp d[MW_MG_MAX_LEVELS];
+    mw_halo h[MW_MG_MAX_LEVELS];
+    double interior;
+} run_comm;
+
+static void run_exchange(void *ctx, int level, mw_grid *g) {
+    run_comm *c = (run_comm*)ctx;
+    (void)g;
+    mw_halo_exchange(level == 0 ? c->fine : &c->h[level]);
+}
+
+static double run_norm(void *ctx, double local, int norm) {
+    const run_comm *c = (const run_comm*)ctx;
+    double r = local;
+    if (c->fine) {
+        MPI_Allreduce(&local, &r, 1, MPI_DOUBLE, norm == MW_NORM_L2 ? MPI_SUM : MPI_MAX,
+                      c->fine->d->cart);
+    }
+    return norm == MW_NORM_L2 ? sqrt(r / c->interior) : r;
+}
+
+// Slowest rank's seconds since t0.
+static double run_elapsed(const mw_decomp *d, double t0) {
+    double dt = wtime() - t0;
+    if (d) MPI_Allreduce(MPI_IN_PLACE, &dt, 1, MPI_DOUBLE, MPI_MAX, d->cart);
+    return dt;
+}
+
+static double run_checksum(const mw_decomp *d, const mw_grid *g) {
+    if (!d) return mw_checksum(g, 0, g->sx - 1);
+    const double local = mw_decomp_checksum(d, g);
+    double sum = 0.0;
+    MPI_Reduce(&local, &sum, 1, MPI_DOUBLE, MPI_SUM, 0, d->cart);
+    return sum;
+}
+
+int mw_mg_run(mw_grid *g, mw_halo *h, const mw_opts *o, int norm, int steps,
+              const char *version, int threads) {
+    mw_decomp *d = h ? h->d : NULL;
+    const int rank = d ? d->rank : 0;
+    const int *ext = d ? d->ext : (const int[3]){ g->sx, g->sy, g->sz };
+    int levels = mw_mg_depth(g), ok, all_ok;
+    if (d) MPI_Allreduce(MPI_IN_PLACE, &levels, 1, MPI_INT, MPI_MIN, d->cart);
+
+    mw_mg mg;
+    run_comm rc;
+    rc.fine = h;
+    rc.interior = (double)(ext[0] - 2) * (ext[1] - 2) * (ext[2] - 2);
+    ok = all_ok = mw_mg_create(&mg, g, levels, o->mg_sweeps) == 0;
+    if (d) MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, d->cart);
+    if (!all_ok) {
+        if (rank == 0) fprintf(stderr, "ERROR: cannot allocate %d multigrid levels\n", levels);
+        return 2;
+    }
+    for (int l = 1; d && l < mg.levels; ++l) {
+        rc.d[l] = *d;
+        rc.d[l].n[0] = mg.lev[l]->sx - 2;
+        rc.d[l].n[1] = mg.lev[l]->sy - 2;
+        rc.d[l].n[2] = mg.lev[l]->sz - 2;
+        if (mw_halo_create(&rc.h[l], MW_HALO_SENDRECV, &rc.d[l], mg.lev[l]) != 0) {
+            if (rank == 0) fprintf(stderr, "ERROR: cannot set up multigrid level %d halos\n", l);
+            return 2;
+        }
+    }
+    mg.exchange = d ? run_exchange : NULL;
+    mg.norm = run_norm;
+    mg.ctx = &rc;
+
+    double residual;
+    if (d) MPI_Barrier(d->cart);
+    double t0 = wtime();
+    const int cycles = mw_mg_solve(&mg, o->converge, norm, o->mg_cycles, &residual);
+    const double elapsed = run_elapsed(d, t0);
+    const double sum = run_checksum(d, g);
+
+    char cmp_str[192] = "";
+    if (o->mg_compare) {
+        double jres;
+        if (d) mw_grid_init(g, d->lo[0] - 1, d->lo[1] - 1, d->lo[2] - 1);
+        else   mw_grid_init(g, 0, 0, 0);
+        if (d) MPI_Barrier(d->cart);
+        t0 = wtime();
+        const int jsteps = mw_mg_jacobi(&mg, o->converge, norm, o->converge_every,
+                                        o->mg_jacobi_max, &jres);
+        const double jtime = run_elapsed(d, t0);
+        snprintf(cmp_str, sizeof cmp_str,
+                 " JACOBI_STEPS=%d JACOBI_TIME=%.6f JACOBI_RESIDUAL=%.3e JACOBI_CONVERGED=%d SPEEDUP=%.2f",
+                 jsteps, jtime, jres, jres <= o->converge, elapsed > 0.0 ? jtime / elapsed : 0.0);
+    }
+
+    if (rank == 0) {
+        char who[128];
+        int n = snprintf(who, sizeof who, "VERSION=%s", version);
+        if (d) n += snprintf(who + n, sizeof who - n, " RANKS=%d", d->size);
+        if (threads > 0) n += snprintf(who + n, sizeof who - n, " THREADS=%d", threads);
+        if (d) snprintf(who + n, sizeof who - n, " DECOMP=%dx%dx%d",
+                        d->dims[0], d->dims[1], d->dims[2]);
+        char halo_str[32] = "";
+        if (h) snprintf(halo_str, sizeof halo_str, " HALO=%s", mw_halo_name(h->kind));
+        printf("METRICS: %s SOLVER=mg GRID=%dx%dx%d STEPS=%d TIME=%.6f MG_LEVELS=%d "
+               "MG_SWEEPS=%d MG_CYCLES=%d CONVERGE_NORM=%s CONVERGE_TOL=%.3e RESIDUAL=%.3e "
+               "CONVERGED=%d%s SIMD=%s PRECISION=%d CHECKSUM=%.10e%s\n",
+               who, ext[0], ext[1], ext[2], steps, elapsed, mg.levels, o->mg_sweeps, cycles,
+               o->converge_norm, o->converge, residual, residual <= o->converge, halo_str,
+               mw_simd_name(), MW_PRECISION, sum, cmp_str);
+    }
+    for (int l = 1; d && l < mg.levels; ++l) mw_halo_free(&rc.h[l]);
+    mw_mg_free(&mg);
+    return 0;
+}
@@ -0,0 +1,85 @@
+// miniweather_mg.h - Geometric multigrid V-cycles for the steady state
+#ifndef MINIWEATHER_MG_H
+#define MINIWEATHER_MG_H
+
+#include "miniweather_core.h"
+#include "miniweather_decomp.h"
+#include "miniweather_halo.h"
+#include "miniweather_opts.h"
+
+// The steady state of the time loop solves the discrete Laplace problem
+// u = mean of the six neighbours with the fixed boundary cells as Dirichlet
+// data. Jacobi moves information one cell per step; a V-cycle smooths with
+// the same 6-point row kernel (damped by MW_MG_OMEGA), restricts the
+// residual to a grid with half the cells per direction, solves the error
+// equation there recursively and interpolates the correction back.
+//
+// Every direction halves its interior extent n (rounding down) per level.
+// An even n coarsens cell centred (coarse cell c averages fine cells 2c-1
+// and 2c; prolongation weights 3/4, 1/4), an odd n vertex centred (coarse
+// cell c sits on fine cell 2c; full weighting 1/4, 1/2, 1/4 and linear
+// prolongation), so any size coarsens without ragged cells. The ghost
+// layers of a coarse error extrapolate linearly to 0 at the fixed boundary
+// cells, which need not sit on a coarse ghost centre. Every rank coarsens
+// only its own block, so coarse levels keep the decomposition of the fine
+// grid; ghost layers shared with other ranks come from the exchange
+// callback.
+#define MW_MG_MAX_LEVELS 16
+#define MW_MG_OMEGA      (6.0 / 7.0)   // damped Jacobi, best smoother weight in 3-D
+#define MW_MG_COARSE     32            // smoothing sweeps on the coarsest level
+
+typedef struct {
+    int levels;
+    mw_grid *lev[MW_MG_MAX_LEVELS];    // lev[0] is the caller's grid
+    mw_grid coarse[MW_MG_MAX_LEVELS];  // storage of levels 1..levels-1
+    mw_real *f[MW_MG_MAX_LEVELS];      // h^2/6 times the right-hand side (NULL on level 0)
+    void *fmem[MW_MG_MAX_LEVELS];
+    int vertex[MW_MG_MAX_LEVELS][3];   // direction coarsened vertex centred (odd parent extent)
+    double ghost[MW_MG_MAX_LEVELS][3]; // ghost cell = ghost * its interior neighbour
+    int sweeps;                        // pre- and post-smoothing sweeps per level
+
+    // Refreshes the ghost layers of level's cur from the neighbouring
+    // ranks (NULL: single block, nothing to exchange).
+    void (*exchange)(void *ctx, int level, mw_grid *g);
+    // Global residual in norm (MW_NORM_*) from this rank's part as
+    // mw_step_residual returns it: the max, or the root mean square over
+    // all interior cells for the sum of squares.
+    double (*norm)(void *ctx, double local, int norm);
+    void *ctx;
+} mw_mg;
+
+// Levels this block supports: halvings while every interior extent is at
+// least 4, plus the fine level, capped at MW_MG_MAX_LEVELS. MPI callers
+// take the minimum over ranks.
+int  mw_mg_depth(const mw_grid *g);
+
+// Sets up `levels` levels below and including g (which must have both
+// buffers, see mw_grid_inplace). Returns -1 if a level cannot be allocated.
+int  mw_mg_create(mw_mg *mg, mw_grid *g, int levels, int sweeps);
+void mw_mg_free(mw_mg *mg);
+
+// One V-cycle on level 0; g->cur holds the improved solution.
+void mw_mg_vcycle(mw_mg *mg);
+
+// Runs V-cycles until the step residual (the change a Jacobi step would
+// make, as in the convergence mode) is at most tol or max_cycles have run.
+// Returns the cycles run; *residual gets the last global residual.
+int  mw_mg_solve(mw_mg *mg, double tol, int norm, int max_cycles, double *residual);
+
+// Plain Jacobi steps to the same tolerance for comparison, checked every
+// `every` steps and stopping after max_steps. Returns the steps taken.
+int  mw_mg_jacobi(mw_mg *mg, double tol, int norm, int every, int max_steps,
+                  double *residual);
+
+// The drivers' --mg mode: V-cycles on g from its initial state to
+// o->converge, then with o->mg_compare plain Jacobi from the same state,
+// and the METRICS line (rank 0). g is the whole grid when h is NULL,
+// otherwise this rank's block of h->d, exchanged through h on the fine
+// level and through sendrecv halos on the coarse ones (every rank coarsens
+// its own block, so the level count is the smallest any rank supports).
+// version and steps are echoed as VERSION= and STEPS=; threads > 0 adds
+// THREADS=. Collective over h->d->cart; returns 2 on allocation failure.
+int  mw_mg_run(mw_grid *g, mw_halo *h, const mw_opts *o, int norm, int steps,
+               const char *version, int threads);
+
+#endif
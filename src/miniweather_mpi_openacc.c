@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <mpi.h>
 #include <openacc.h>
+#include "miniweather_core.h"
+#include "miniweather_opts.h"
 
 #ifndef NX
 #define NX 256
@@ -16,27 +18,13 @@
 #define STEPS 100
 #endif
 
-// sx is passed but not needed in the stride; kept for clarity with local slab
-#define IDX(x,y,z,sx) (((x) * (NY) + (y)) * (NZ) + (z))
-
-void init_local(double *grid, int lx, int gx0) {
-    const int sx = lx + 2;
-    
-    #pragma acc parallel loop collapse(3) present(grid)
-    for (int x = 0; x < sx; x++) {
-        for (int y = 0; y < NY; y++) {
-            for (int z = 0; z < NZ; z++) {
-                int gx = gx0 + (x - 1);
-                if (gx < 0) gx = 0;
-                grid[IDX(x,y,z,sx)] = (double)(gx + y + z);
-            }
-        }
-    }
-}
-
-void halo_exchange(double *grid, int lx, int left, int right, MPI_Comm comm) {
-    const int sx = lx + 2;
-    const int face_elems = NY * NZ;
+// Exchanges the k outermost owned x-planes (planes k..k+lx-1 are owned,
+// k ghost planes per side) with both neighbours.
+void halo_exchange(mw_grid *g, int lx, int k, int left, int right, MPI_Comm comm) {
+    double *grid = g->cur;
+    const int face_elems = k * (int)mw_plane_elems(g);
+    const size_t lo_send = MW_IDX(g,k,0,0),  hi_send = MW_IDX(g,lx,0,0);
+    const size_t lo_recv = MW_IDX(g,0,0,0),  hi_recv = MW_IDX(g,lx+k,0,0);
     
     double *send_left  = (double*)malloc(face_elems * sizeof(double));
     double *send_right = (double*)malloc(face_elems * sizeof(double));
@@ -49,12 +37,12 @@ void halo_exchange(double *grid, int lx, int left, int right, MPI_Comm comm) {
     }
     
     // Copy halo data from GPU to CPU
-    #pragma acc update host(grid[IDX(1,0,0,sx):face_elems])
-    #pragma acc update host(grid[IDX(lx,0,0,sx):face_elems])
+    #pragma acc update host(grid[lo_send:face_elems])
+    #pragma acc update host(grid[hi_send:face_elems])
     
     for (int i = 0; i < face_elems; i++) {
-        send_left[i]  = grid[IDX(1,0,0,sx)  + i];
-        send_right[i] = grid[IDX(lx,0,0,sx) + i];
+        send_left[i]  = grid[lo_send + i];
+        send_right[i] = grid[hi_send + i];
     }
     
     // MPI exchange
@@ -66,14 +54,16 @@ void halo_exchange(double *grid, int lx, int left, int right, MPI_Comm comm) {
                  recv_left,  face_elems, MPI_DOUBLE, left,  101,
                  comm, MPI_STATUS_IGNORE);
     
-    // Copy received halos back to GPU (via host copy first)
-    for (int i = 0; i < face_elems; i++) {
-        grid[IDX(0,    0, 0, sx) + i] = recv_left[i];
-        grid[IDX(lx+1, 0, 0, sx) + i] = recv_right[i];
+    // Copy received halos back to GPU (via host copy first). Nothing
+    // arrives at a global edge: the fixed boundary plane stays as it is
+    if (left != MPI_PROC_NULL) {
+        for (int i = 0; i < face_elems; i++) grid[lo_recv + i] = recv_left[i];
+        #pragma acc update device(grid[lo_recv:face_elems])
+    }
+    if (right != MPI_PROC_NULL) {
+        for (int i = 0; i < face_elems; i++) grid[hi_recv + i] = recv_right[i];
+        #pragma acc update device(grid[hi_recv:face_elems])
     }
-    
-    #pragma acc update device(grid[IDX(0,0,0,sx):face_elems])
-    #pragma acc update device(grid[IDX(lx+1,0,0,sx):face_elems])
     
     free(send_left);
     free(send_right);
@@ -81,32 +71,10 @@ void halo_exchange(double *grid, int lx, int left, int right, MPI_Comm comm) {
     free(recv_right);
 }
 
-void step_update(double *restrict g, double *restrict ng, int lx) {
-    const int sx = lx + 2;
-    
-    #pragma acc parallel loop collapse(3) present(g, ng)
-    for (int x = 1; x <= lx; x++) {
-        for (int y = 1; y < NY-1; y++) {
-            for (int z = 1; z < NZ-1; z++) {
-                double xm = g[IDX(x-1,y,z,sx)];
-                double xp = g[IDX(x+1,y,z,sx)];
-                double ym = g[IDX(x,y-1,z,sx)];
-                double yp = g[IDX(x,y+1,z,sx)];
-                double zm = g[IDX(x,y,z-1,sx)];
-                double zp = g[IDX(x,y,z+1,sx)];
-                ng[IDX(x,y,z,sx)] = (xm + xp + ym + yp + zm + zp) / 6.0;
-            }
-        }
-    }
-    
-    #pragma acc parallel loop collapse(3) present(g, ng)
-    for (int x = 1; x <= lx; x++) {
-        for (int y = 1; y < NY-1; y++) {
-            for (int z = 1; z < NZ-1; z++) {
-                g[IDX(x,y,z,sx)] = ng[IDX(x,y,z,sx)];
-            }
-        }
-    }
+// Elementwise merge of packed mw_stats for MPI_Reduce.
+static void stats_op(void *in, void *inout, int *len, MPI_Datatype *type) {
+    (void)type;
+    for (int i = 0; i < *len; ++i) mw_stats_merge((mw_stats*)inout + i, (const mw_stats*)in + i);
 }
 
 int main(int argc, char **argv) {
@@ -116,6 +84,14 @@ int main(int argc, char **argv) {
     int rank, size;
     MPI_Comm_rank(comm, &rank);
     MPI_Comm_size(comm, &size);
+
+    mw_opts opts;
+    mw_opts_defaults(&opts);
+    int bad = mw_opts_parse(&opts, argc, argv, MW_CAP_STATS | MW_CAP_DEEP);
+    if (bad) {
+        if (rank == 0) fprintf(stderr, "ERROR: unknown or unsupported option %s\n", argv[bad]);
+        MPI_Abort(comm, 1);
+    }
     
     // Set GPU device based on rank
     int num_devices = acc_get_num_devices(acc_device_nvidia);
@@ -137,23 +113,32 @@ int main(int argc, char **argv) {
     const int rem  = NX % size;
     const int lx   = base + ((rank == size-1) ? rem : 0);
     const int gx0  = rank * base;
+
+    // Ghost depth k: one exchange of k planes, then k steps that also sweep
+    // the still-valid ghost planes (redundant compute instead of messages)
+    const int k = opts.ghost_depth > 0 ? opts.ghost_depth : 1;
+    if (k > base || (k > 1 && opts.fused_stats)) {
+        if (rank == 0) fprintf(stderr, "ERROR: --ghost-depth=%d needs at least %d x-planes per rank and no --fused-stats\n", k, k);
+        MPI_Abort(comm, 1);
+    }
     
-    const size_t slab_elems = (size_t)(lx + 2) * NY * NZ;
-    double *grid     = (double*)malloc(slab_elems * sizeof(double));
-    double *new_grid = (double*)malloc(slab_elems * sizeof(double));
-    
-    if (!grid || !new_grid) {
+    // Allocate on host and GPU
+    mw_grid g;
+    if (mw_grid_alloc(&g, lx + 2 * k, NY, NZ) != 0) {
         if (rank == 0) fprintf(stderr, "Allocation failed\n");
         MPI_Abort(comm, 2);
     }
     
-    // Copy to GPU
-    #pragma acc enter data create(grid[0:slab_elems], new_grid[0:slab_elems])
-    
-    init_local(grid, lx, gx0);
+    mw_grid_init(&g, gx0 - k, 0, 0);
     
     const int left  = (rank == 0)        ? MPI_PROC_NULL : rank - 1;
     const int right = (rank == size - 1) ? MPI_PROC_NULL : rank + 1;
+    const int nmsg  = (left != MPI_PROC_NULL) + (right != MPI_PROC_NULL);
+    double messages = 0.0, swept = 0.0;
+    
+    // With --fused-stats the last step's kernel also reduces the field
+    mw_stats stats;
+    mw_stats_clear(&stats);
     
     // Timing variables
     double comm_time   = 0.0;
@@ -163,15 +148,24 @@ int main(int argc, char **argv) {
     double t0 = MPI_Wtime();
     
     for (int t = 0; t < STEPS; t++) {
-        // Time communication (includes GPU-CPU transfers)
-        double t_comm_start = MPI_Wtime();
-        halo_exchange(grid, lx, left, right, comm);
-        double t_comm_end = MPI_Wtime();
-        comm_time += (t_comm_end - t_comm_start);
+        // Time communication (includes GPU-CPU transfers), every k steps
+        const int j = t % k;
+        if (j == 0) {
+            double t_comm_start = MPI_Wtime();
+            halo_exchange(&g, lx, k, left, right, comm);
+            double t_comm_end = MPI_Wtime();
+            comm_time += (t_comm_end - t_comm_start);
+            messages += nmsg;
+        }
         
-        // Time computation (GPU kernels)
+        // Time computation (GPU kernels); step j of the window sweeps one
+        // plane less per side of the neighbours' ghosts
+        const int lo = left  != MPI_PROC_NULL ? j + 1 : k;
+        const int hi = right != MPI_PROC_NULL ? lx + 2 * k - 2 - j : k + lx - 1;
+        swept += hi - lo + 1;
         double t_comp_start = MPI_Wtime();
-        step_update(grid, new_grid, lx);
+        if (opts.fused_stats && t == STEPS - 1) mw_step_stats(&g, lo, hi, &stats);
+        else                                    mw_step(&g, lo, hi);
         #pragma acc wait
         double t_comp_end = MPI_Wtime();
         comp_time += (t_comp_end - t_comp_start);
@@ -181,27 +175,40 @@ int main(int argc, char **argv) {
     double t1 = MPI_Wtime();
     double elapsed = t1 - t0;
     
-    // Checksum on GPU (internal slab cells only)
-    double local_sum = 0.0;
-    const int sx = lx + 2;
-    #pragma acc parallel loop collapse(3) reduction(+:local_sum) present(grid)
-    for (int x = 1; x <= lx; x++) {
-        for (int y = 0; y < NY; y++) {
-            for (int z = 0; z < NZ; z++) {
-                local_sum += grid[IDX(x,y,z,sx)];
-            }
-        }
+    // Checksum on GPU (internal slab cells only): when fused, the y/z
+    // boundary shell is added and the statistics go in one packed reduction
+    double global_sum    = 0.0;
+    mw_stats all_stats;
+    if (opts.fused_stats) {
+        const int olo[3] = { k, 0, 0 }, ohi[3] = { k + lx - 1, NY-1, NZ-1 };
+        const int ilo[3] = { k, 1, 1 }, ihi[3] = { k + lx - 1, NY-2, NZ-2 };
+        mw_stats_shell(&g, olo, ohi, ilo, ihi, &stats);
+        MPI_Datatype type;
+        MPI_Op op;
+        MPI_Type_contiguous(4, MPI_DOUBLE, &type);
+        MPI_Type_commit(&type);
+        MPI_Op_create(stats_op, 1, &op);
+        MPI_Reduce(&stats, &all_stats, 1, type, op, 0, comm);
+        MPI_Op_free(&op);
+        MPI_Type_free(&type);
+        global_sum = all_stats.sum;
+    } else {
+        double local_sum = mw_checksum(&g, k, k + lx - 1);
+        MPI_Reduce(&local_sum, &global_sum, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
     }
     
-    double global_sum    = 0.0;
     double max_elapsed   = 0.0;
     double max_comm_time = 0.0;
     double max_comp_time = 0.0;
     
-    MPI_Reduce(&local_sum,  &global_sum,    1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD, 0);
-    MPI_Reduce(&elapsed,    &max_elapsed,   1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD, 0);
-    MPI_Reduce(&comm_time,  &max_comm_time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD, 0);
-    MPI_Reduce(&comp_time,  &max_comp_time, 1, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD, 0);
+    MPI_Reduce(&elapsed,    &max_elapsed,   1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(&comm_time,  &max_comm_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+    MPI_Reduce(&comp_time,  &max_comp_time, 1, MPI_DOUBLE, MPI_MAX, 0, comm);
+
+    // Messages sent and planes swept beyond the owned ones, over all ranks
+    double owned = (double)lx * STEPS;
+    double deep_local[3] = { messages, swept, owned }, deep[3];
+    MPI_Reduce(deep_local, deep, 3, MPI_DOUBLE, MPI_SUM, 0, comm);
     
     if (rank == 0) {
         size_t total_cells = (size_t)NX * NY * NZ;
@@ -212,16 +219,16 @@ int main(int argc, char **argv) {
         
         printf("METRICS: VERSION=mpi_openacc RANKS=%d GPUS=%d GRID=%dx%dx%d STEPS=%d TIME=%.6f "
                "COMM_TIME=%.6f COMP_TIME=%.6f COMM_PCT=%.2f COMP_PCT=%.2f "
-               "THROUGHPUT_STEPS=%.2f THROUGHPUT_CELLS=%.2e CHECKSUM=%.10e\n",
+               "GHOST_DEPTH=%d EXCHANGES=%d MESSAGES=%.0f REDUNDANT_PCT=%.2f "
+               "THROUGHPUT_STEPS=%.2f THROUGHPUT_CELLS=%.2e CHECKSUM=%.10e FUSED_STATS=%d MIN=%.6e MAX=%.6e\n",
                size, size, NX, NY, NZ, STEPS, max_elapsed,
                max_comm_time, max_comp_time, comm_pct, comp_pct,
-               throughput_steps, throughput_cells, global_sum);
+               k, (STEPS + k - 1) / k, deep[0], 100.0 * (deep[1] - deep[2]) / deep[2],
+               throughput_steps, throughput_cells, global_sum, opts.fused_stats,
+               opts.fused_stats ? all_stats.min : 0.0, opts.fused_stats ? all_stats.max : 0.0);
     }
     
-    #pragma acc exit data delete(grid[0:slab_elems], new_grid[0:slab_elems])
-    
-    free(new_grid);
-    free(grid);
+    mw_grid_free(&g);
     MPI_Finalize();
     return 0;
 }
\ No newline at end of file
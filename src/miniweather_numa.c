@@ -0,0 +1,159 @@
+// miniweather_numa.c - Thread-to-core and page-to-node placement report
+//
+// Uses the raw getcpu/move_pages system calls so the build needs no libnuma.
+#define _GNU_SOURCE
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "miniweather_numa.h"
+
+#define MW_NUMA_MAX_NODES 64
+
+static const char *bind_name(void) {
+#ifdef _OPENMP
+    switch (omp_get_proc_bind()) {
+    case omp_proc_bind_false:  return "false";
+    case omp_proc_bind_true:   return "true";
+    case omp_proc_bind_master: return "master";
+    case omp_proc_bind_close:  return "close";
+    case omp_proc_bind_spread: return "spread";
+    }
+#endif
+    return "none";
+}
+
+// Node of each row's first cell; -1 where the kernel does not say.
+static void row_nodes(void **pages, int *status, size_t n) {
+    for (size_t i = 0; i < n; ++i) status[i] = -1;
+#ifdef SYS_move_pages
+    if (syscall(SYS_move_pages, 0, (unsigned long)n, pages, NULL, status, 0) != 0) {
+        for (size_t i = 0; i < n; ++i) status[i] = -1;
+    }
+#else
+    (void)pages;
+#endif
+}
+
+// Appends printf-style text to buf at *pos, never past len.
+static void put(char *buf, size_t len, size_t *pos, const char *fmt, ...) {
+    if (*pos >= len) return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *pos, len - *pos, fmt, ap);
+    va_end(ap);
+    if (n > 0) *pos += (size_t)n;
+}
+
+void mw_numa_report(const mw_grid *g, char *buf, size_t len) {
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    int *cpu = (int*)malloc((size_t)threads * sizeof(int));
+    int *node = (int*)malloc((size_t)threads * sizeof(int));
+
+    const int sx = g->sx, sy = g->sy;
+    const size_t rows = (sx > 2 && sy > 2) ? (size_t)(sx - 2) * (sy - 2) : 0;
+    int *owner = (int*)malloc((rows ? rows : 1) * sizeof(int));
+    int *status = (int*)malloc((rows ? rows : 1) * sizeof(int));
+    void **pages = (void**)malloc((rows ? rows : 1) * sizeof(void*));
+    if (!cpu || !node || !owner || !status || !pages) {
+        snprintf(buf, len, "BIND=%s THREADS=%d ROWS=-1", bind_name(), threads);
+        free(cpu); free(node); free(owner); free(status); free(pages);
+        return;
+    }
+
+    // Where each thread runs, and which rows the sweep's schedule gives it
+#ifdef _OPENMP
+    #pragma omp parallel
+#endif
+    {
+        int t = 0;
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+#endif
+        unsigned c = 0, n = 0;
+#ifdef SYS_getcpu
+        if (syscall(SYS_getcpu, &c, &n, NULL) == 0) {
+            cpu[t] = (int)c;
+            node[t] = (int)n;
+        } else
+#endif
+        {
+            cpu[t] = node[t] = -1;
+        }
+
+#ifdef _OPENMP
+        #pragma omp for collapse(2) schedule(static)
+#endif
+        for (int x = 1; x <= sx - 2; ++x) {
+            for (int y = 1; y <= sy - 2; ++y) {
+                const size_t r = (size_t)(x - 1) * (sy - 2) + (y - 1);
+                owner[r] = t;
+                pages[r] = (void*)&g->cur[MW_IDX(g, x, y, 0)];
+            }
+        }
+    }
+
+    row_nodes(pages, status, rows);
+    size_t local = 0, known = 0, unknown = 0;
+    size_t per_node[MW_NUMA_MAX_NODES] = { 0 };
+    for (size_t r = 0; r < rows; ++r) {
+        const int s = status[r];
+        if (s < 0 || s >= MW_NUMA_MAX_NODES) { unknown++; continue; }
+        known++;
+        per_node[s]++;
+        if (s == node[owner[r]]) local++;
+    }
+
+    size_t pos = 0;
+    put(buf, len, &pos, "BIND=%s THREADS=%d CPUS=", bind_name(), threads);
+    for (int t = 0; t < threads; ++t) put(buf, len, &pos, t ? ",%d" : "%d", cpu[t]);
+    put(buf, len, &pos, " NODES=");
+    for (int t = 0; t < threads; ++t) put(buf, len, &pos, t ? ",%d" : "%d", node[t]);
+    put(buf, len, &pos, " ROWS=%zu LOCAL_PCT=", rows);
+    if (known) put(buf, len, &pos, "%.1f", 100.0 * local / known);
+    else       put(buf, len, &pos, "-1");
+    put(buf, len, &pos, " PAGE_NODES=");
+    const char *sep = "";
+    for (int n = 0; n < MW_NUMA_MAX_NODES; ++n) {
+        if (!per_node[n]) continue;
+        put(buf, len, &pos, "%s%d:%zu", sep, n, per_node[n]);
+        sep = ",";
+    }
+    if (unknown) put(buf, len, &pos, "%sunknown:%zu", sep, unknown);
+
+    free(cpu); free(node); free(owner); free(status); free(pages);
+}
+
+void mw_numa_print_all(const mw_grid *g, MPI_Comm comm) {
+    enum { NUMA_LINE = 1024 };
+    int rank = 0, size = 1;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+    char line[NUMA_LINE];
+    char *all = NULL;
+    if (rank == 0) {
+        all = (char*)malloc((size_t)size * NUMA_LINE);
+        if (!all) MPI_Abort(comm, 2);
+    }
+    mw_numa_report(g, line, sizeof line);
+    MPI_Gather(line, NUMA_LINE, MPI_CHAR, all, NUMA_LINE, MPI_CHAR, 0, comm);
+    if (rank == 0) {
+        for (int r = 0; r < size; ++r) printf("NUMA: RANK=%d %s\n", r, all + (size_t)r * NUMA_LINE);
+        free(all);
+    }
+}
+
+double mw_peak_rss(void) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) return -1.0;
+    return ru.ru_maxrss * 1024.0;   // KiB on Linux
+}
@@ -0,0 +1,29 @@
+// miniweather_numa.h - Thread-to-core and page-to-node placement report
+#ifndef MINIWEATHER_NUMA_H
+#define MINIWEATHER_NUMA_H
+
+#include <stddef.h>
+#include <mpi.h>
+#include "miniweather_core.h"
+
+// Describes where the sweep runs and where its data lives, as one line of
+// KEY=VALUE fields:
+//   BIND=         OpenMP proc_bind policy (false, true, master, close, spread)
+//   THREADS=      threads of the sweep
+//   CPUS= NODES=  CPU and NUMA node of each thread (comma separated)
+//   ROWS=         rows of g->cur swept by mw_stencil_box (x 1..sx-2, y 1..sy-2)
+//   LOCAL_PCT=    rows whose page is on the node of the thread sweeping them
+//   PAGE_NODES=   rows per node, node:count (unknown = not yet faulted in)
+// Pages are queried with move_pages(2) and CPU/node with getcpu(2); where
+// either is unavailable the affected fields read -1.
+void mw_numa_report(const mw_grid *g, char *buf, size_t len);
+
+// Collective over comm: gathers every rank's mw_numa_report of its block g
+// and prints them on rank 0 as "NUMA: RANK=r ..." lines in rank order.
+void mw_numa_print_all(const mw_grid *g, MPI_Comm comm);
+
+// Peak resident set size of the process in bytes (getrusage ru_maxrss),
+// -1 if unavailable.
+double mw_peak_rss(void);
+
+#endif
@@ -1,6 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <openacc.h>
+#include "miniweather_core.h"
+#include "miniweather_opts.h"
 
 #ifndef NX
 #define NX 256
@@ -15,61 +17,28 @@
 #define STEPS 100
 #endif
 
-#define IDX(x,y,z) (((x) * (NY) + (y)) * (NZ) + (z))
-
-void init_grid(double *grid) {
-    #pragma acc parallel loop collapse(3) present(grid)
-    for (int x = 0; x < NX; x++) {
-        for (int y = 0; y < NY; y++) {
-            for (int z = 0; z < NZ; z++) {
-                grid[IDX(x,y,z)] = (double)(x + y + z);
-            }
-        }
-    }
-}
-
-void step_update(double *restrict grid, double *restrict new_grid) {
-    #pragma acc parallel loop collapse(3) present(grid, new_grid)
-    for (int x = 1; x < NX-1; x++) {
-        for (int y = 1; y < NY-1; y++) {
-            for (int z = 1; z < NZ-1; z++) {
-                double xm = grid[IDX(x-1, y, z)];
-                double xp = grid[IDX(x+1, y, z)];
-                double ym = grid[IDX(x, y-1, z)];
-                double yp = grid[IDX(x, y+1, z)];
-                double zm = grid[IDX(x, y, z-1)];
-                double zp = grid[IDX(x, y, z+1)];
-                
-                new_grid[IDX(x,y,z)] = (xm + xp + ym + yp + zm + zp) / 6.0;
-            }
-        }
-    }
-    
-    #pragma acc parallel loop collapse(3) present(grid, new_grid)
-    for (int x = 1; x < NX-1; x++) {
-        for (int y = 1; y < NY-1; y++) {
-            for (int z = 1; z < NZ-1; z++) {
-                grid[IDX(x,y,z)] = new_grid[IDX(x,y,z)];
-            }
-        }
-    }
-}
-
 int main(int argc, char **argv) {
-    const size_t elems = (size_t)NX * NY * NZ;
-    double *grid = (double*)malloc(elems * sizeof(double));
-    double *new_grid = (double*)malloc(elems * sizeof(double));
+    mw_opts opts;
+    mw_opts_defaults(&opts);
+    int bad = mw_opts_parse(&opts, argc, argv, MW_CAP_STATS);
+    if (bad) {
+        fprintf(stderr, "ERROR: unknown or unsupported option %s\n", argv[bad]);
+        return 1;
+    }
     
-    if (!grid || !new_grid) {
+    // Allocate on host and GPU
+    mw_grid g;
+    if (mw_grid_alloc(&g, NX, NY, NZ) != 0) {
         fprintf(stderr, "Allocation failed\n");
         return 1;
     }
     
-    // Allocate on GPU
-    #pragma acc enter data create(grid[0:elems], new_grid[0:elems])
-    
     // Initialize grid on GPU
-    init_grid(grid);
+    mw_grid_init(&g, 0, 0, 0);
+    
+    // With --fused-stats the last step's kernel also reduces the field
+    mw_stats stats;
+    mw_stats_clear(&stats);
     
     // Timing using OpenACC wall-clock timer
     double t0 = acc_get_wtime();
@@ -77,7 +46,8 @@ int main(int argc, char **argv) {
     
     for (int t = 0; t < STEPS; t++) {
         double t_kernel_start = acc_get_wtime();
-        step_update(grid, new_grid);
+        if (opts.fused_stats && t == STEPS - 1) mw_step_stats(&g, 1, NX-2, &stats);
+        else                                    mw_step(&g, 1, NX-2);
         #pragma acc wait
         double t_kernel_end = acc_get_wtime();
         kernel_time += (t_kernel_end - t_kernel_start);
@@ -86,19 +56,21 @@ int main(int argc, char **argv) {
     double t1 = acc_get_wtime();
     double elapsed = t1 - t0;
     
-    // Calculate checksum on GPU
-    double sum = 0.0;
-    #pragma acc parallel loop collapse(3) reduction(+:sum) present(grid)
-    for (int x = 0; x < NX; x++) {
-        for (int y = 0; y < NY; y++) {
-            for (int z = 0; z < NZ; z++) {
-                sum += grid[IDX(x,y,z)];
-            }
-        }
+    // Calculate checksum on GPU (only the fixed boundary shell when fused)
+    double sum;
+    if (opts.fused_stats) {
+        const int olo[3] = { 0, 0, 0 }, ohi[3] = { NX-1, NY-1, NZ-1 };
+        const int ilo[3] = { 1, 1, 1 }, ihi[3] = { NX-2, NY-2, NZ-2 };
+        mw_stats_shell(&g, olo, ohi, ilo, ihi, &stats);
+        sum = stats.sum;
+    } else {
+        sum = mw_checksum(&g, 0, NX-1);
     }
     
-    // Copy results back from GPU and free GPU memory
-    #pragma acc exit data copyout(grid[0:elems]) delete(new_grid[0:elems])
+    // Copy results back from GPU
+    double *grid = g.cur;
+    size_t elems = g.elems;
+    #pragma acc update host(grid[0:elems])
     
     // Calculate metrics
     size_t total_cells = (size_t)NX * NY * NZ;
@@ -108,11 +80,12 @@ int main(int argc, char **argv) {
     
     printf("METRICS: VERSION=openacc GPUS=1 GRID=%dx%dx%d STEPS=%d TIME=%.6f "
            "KERNEL_TIME=%.6f KERNEL_PCT=%.2f "
-           "THROUGHPUT_STEPS=%.2f THROUGHPUT_CELLS=%.2e CHECKSUM=%.10e\n",
+           "THROUGHPUT_STEPS=%.2f THROUGHPUT_CELLS=%.2e CHECKSUM=%.10e FUSED_STATS=%d MIN=%.6e MAX=%.6e\n",
            NX, NY, NZ, STEPS, elapsed, kernel_time, kernel_pct,
-           throughput_steps, throughput_cells, sum);
+           throughput_steps, throughput_cells, sum, opts.fused_stats,
+           opts.fused_stats ? stats.min : 0.0, opts.fused_stats ? stats.max : 0.0);
     
-    free(new_grid);
-    free(grid);
+    // Free GPU and host memory
+    mw_grid_free(&g);
     return 0;
 }
\ No newline at end of file
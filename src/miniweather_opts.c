@@ -0,0 +1,210 @@
+// miniweather_opts.c - Runtime options shared by the drivers
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "miniweather_opts.h"
+
+void mw_opts_defaults(mw_opts *o) {
+    o->tblock      = 0;
+    o->tblock_tile = 0;
+    o->tile_y      = 0;
+    o->tile_z      = 0;
+    o->autotune    = 0;
+#if defined(MW_PRECISION) && MW_PRECISION == 32
+    o->tile_cache  = "miniweather_tiles_fp32.txt";   // fp32 rows tune differently
+#else
+    o->tile_cache  = "miniweather_tiles.txt";
+#endif
+    o->decomp      = 1;
+    o->overlap     = 0;
+    o->tasks       = 0;
+    o->task_x      = 0;
+    o->task_y      = 0;
+    o->comm_thread = 0;
+    o->compute_threads = 0;
+    o->ghost_depth = 0;
+    o->halo        = "sendrecv";
+    o->halo_compare = 0;
+    o->rebalance   = 0;
+    o->rebalance_threshold = 1.05;
+    o->checkpoint  = 0;
+    o->checkpoint_file = "miniweather.ckpt";
+    o->restart     = 0;
+    o->snapshot    = 0;
+    o->snapshot_prefix = "snapshot";
+    o->snapshot_codec  = "raw";
+    o->snapshot_stride = 1;
+    o->converge    = 0.0;
+    o->converge_every = 10;
+    o->converge_norm  = "max";
+    o->mg          = 0;
+    o->mg_cycles   = 100;
+    o->mg_sweeps   = 2;
+    o->mg_compare  = 0;
+    o->mg_jacobi_max = 50000;
+    o->ensemble    = 0;
+    o->ensemble_grid = "64x64x64";
+    o->ensemble_perturb = 1.0;
+    o->fused_stats = 0;
+    o->stats_every = 0;
+    o->inplace     = 0;
+    o->thp         = 0;
+    o->numa_report = 0;
+    o->pmu         = 0;
+    o->pmu_trace   = NULL;
+    o->roofline    = 0;
+    o->roofline_mb = 192;
+    o->simd        = "auto";
+    o->ref_checksum = 0.0;
+}
+
+// Matches "--name=<int>"; returns 1 and stores the value on a match.
+static int opt_int(const char *arg, const char *name, int *out) {
+    size_t n = strlen(name);
+    if (strncmp(arg, name, n) != 0 || arg[n] != '=') return 0;
+    char *end = NULL;
+    long v = strtol(arg + n + 1, &end, 10);
+    if (end == arg + n + 1 || *end != '\0') return -1;
+    *out = (int)v;
+    return 1;
+}
+
+// Matches "--name=<number>"; returns 1 and stores the value on a match.
+static int opt_double(const char *arg, const char *name, double *out) {
+    size_t n = strlen(name);
+    if (strncmp(arg, name, n) != 0 || arg[n] != '=') return 0;
+    char *end = NULL;
+    double v = strtod(arg + n + 1, &end);
+    if (end == arg + n + 1 || *end != '\0') return -1;
+    *out = v;
+    return 1;
+}
+
+// Matches "--name=<string>"; returns 1 and points out at the value.
+static int opt_str(const char *arg, const char *name, const char **out) {
+    size_t n = strlen(name);
+    if (strncmp(arg, name, n) != 0 || arg[n] != '=') return 0;
+    *out = arg + n + 1;
+    return 1;
+}
+
+enum { OPT_INT, OPT_DOUBLE, OPT_STR, OPT_FLAG };
+
+typedef struct {
+    const char *name;
+    int kind;
+    size_t off;         // field of mw_opts
+    int value;          // OPT_FLAG: value stored in the field
+    unsigned cap;       // MW_CAP_* group the option belongs to
+    unsigned modes;     // MW_MODE_* run modes that read it
+} opt_def;
+
+#define F(field) offsetof(mw_opts, field)
+static const opt_def opt_table[] = {
+    { "--tblock",              OPT_INT,    F(tblock),              0, MW_CAP_TBLOCK, 0 },
+    { "--tblock-tile",         OPT_INT,    F(tblock_tile),         0, MW_CAP_TBLOCK, 0 },
+    { "--tile-y",              OPT_INT,    F(tile_y),              0, MW_CAP_TILE,   0 },
+    { "--tile-z",              OPT_INT,    F(tile_z),              0, MW_CAP_TILE,   0 },
+    { "--tile-cache",          OPT_STR,    F(tile_cache),          0, MW_CAP_TILE,   0 },
+    { "--autotune",            OPT_FLAG,   F(autotune),            1, MW_CAP_TILE,   0 },
+    { "--retune",              OPT_FLAG,   F(autotune),            2, MW_CAP_TILE,   0 },
+    { "--decomp",              OPT_INT,    F(decomp),              0, MW_CAP_MPI,    MW_MODE_MG | MW_MODE_DEEP },
+    { "--overlap",             OPT_FLAG,   F(overlap),             1, MW_CAP_MPI,    0 },
+    { "--halo",                OPT_STR,    F(halo),                0, MW_CAP_MPI,    MW_MODE_MG | MW_MODE_DEEP },
+    { "--halo-compare",        OPT_FLAG,   F(halo_compare),        1, MW_CAP_MPI,    MW_MODE_MG },
+    { "--rebalance",           OPT_INT,    F(rebalance),           0, MW_CAP_MPI,    0 },
+    { "--rebalance-threshold", OPT_DOUBLE, F(rebalance_threshold), 0, MW_CAP_MPI,    0 },
+    { "--checkpoint",          OPT_INT,    F(checkpoint),          0, MW_CAP_MPI,    0 },
+    { "--checkpoint-file",     OPT_STR,    F(checkpoint_file),     0, MW_CAP_MPI,    0 },
+    { "--restart",             OPT_FLAG,   F(restart),             1, MW_CAP_MPI,    0 },
+    { "--tasks",               OPT_FLAG,   F(tasks),               1, MW_CAP_HYBRID, 0 },
+    { "--task-x",              OPT_INT,    F(task_x),              0, MW_CAP_HYBRID, 0 },
+    { "--task-y",              OPT_INT,    F(task_y),              0, MW_CAP_HYBRID, 0 },
+    { "--comm-thread",         OPT_FLAG,   F(comm_thread),         1, MW_CAP_HYBRID, 0 },
+    { "--compute-threads",     OPT_INT,    F(compute_threads),     0, MW_CAP_HYBRID, 0 },
+    { "--ghost-depth",         OPT_INT,    F(ghost_depth),         0, MW_CAP_DEEP,   MW_MODE_DEEP },
+    { "--snapshot",            OPT_INT,    F(snapshot),            0, MW_CAP_CPU,    0 },
+    { "--snapshot-stride",     OPT_INT,    F(snapshot_stride),     0, MW_CAP_CPU,    0 },
+    { "--snapshot-prefix",     OPT_STR,    F(snapshot_prefix),     0, MW_CAP_CPU,    0 },
+    { "--snapshot-codec",      OPT_STR,    F(snapshot_codec),      0, MW_CAP_CPU,    0 },
+    { "--converge",            OPT_DOUBLE, F(converge),            0, MW_CAP_CPU,    MW_MODE_MG },
+    { "--converge-every",      OPT_INT,    F(converge_every),      0, MW_CAP_CPU,    MW_MODE_MG },
+    { "--converge-norm",       OPT_STR,    F(converge_norm),       0, MW_CAP_CPU,    MW_MODE_MG },
+    { "--mg",                  OPT_FLAG,   F(mg),                  1, MW_CAP_CPU,    MW_MODE_MG },
+    { "--mg-cycles",           OPT_INT,    F(mg_cycles),           0, MW_CAP_CPU,    MW_MODE_MG },
+    { "--mg-sweeps",           OPT_INT,    F(mg_sweeps),           0, MW_CAP_CPU,    MW_MODE_MG },
+    { "--mg-compare",          OPT_FLAG,   F(mg_compare),          1, MW_CAP_CPU,    MW_MODE_MG },
+    { "--mg-jacobi-max",       OPT_INT,    F(mg_jacobi_max),       0, MW_CAP_CPU,    MW_MODE_MG },
+    { "--ensemble",            OPT_INT,    F(ensemble),            0, MW_CAP_CPU,    MW_MODE_ENS },
+    { "--ensemble-grid",       OPT_STR,    F(ensemble_grid),       0, MW_CAP_CPU,    MW_MODE_ENS },
+    { "--ensemble-perturb",    OPT_DOUBLE, F(ensemble_perturb),    0, MW_CAP_CPU,    MW_MODE_ENS },
+    { "--fused-stats",         OPT_FLAG,   F(fused_stats),         1, MW_CAP_STATS,  0 },
+    { "--stats-every",         OPT_INT,    F(stats_every),         0, MW_CAP_CPU,    0 },
+    { "--inplace",             OPT_FLAG,   F(inplace),             1, MW_CAP_CPU,    0 },
+    { "--thp",                 OPT_FLAG,   F(thp),                 1, MW_CAP_CPU,    MW_MODE_MG | MW_MODE_DEEP },
+    { "--numa-report",         OPT_FLAG,   F(numa_report),         1, MW_CAP_CPU,    MW_MODE_MG },
+    { "--pmu",                 OPT_FLAG,   F(pmu),                 1, MW_CAP_CPU,    0 },
+    { "--pmu-trace",           OPT_STR,    F(pmu_trace),           0, MW_CAP_CPU,    0 },
+    { "--roofline",            OPT_FLAG,   F(roofline),            1, MW_CAP_CPU,    0 },
+    { "--roofline-mb",         OPT_INT,    F(roofline_mb),         0, MW_CAP_CPU,    0 },
+    { "--simd",                OPT_STR,    F(simd),                0, MW_CAP_CPU,    MW_MODE_ENS | MW_MODE_MG | MW_MODE_DEEP },
+    { "--ref-checksum",        OPT_DOUBLE, F(ref_checksum),        0, MW_CAP_CPU,    0 },
+};
+#undef F
+
+// Returns 1 if arg is option d (stored into o), 0 if it is another option,
+// -1 if it is d with a malformed value.
+static int opt_match(const opt_def *d, const char *arg, mw_opts *o) {
+    char *field = (char*)o + d->off;
+    switch (d->kind) {
+    case OPT_INT:    return opt_int(arg, d->name, (int*)field);
+    case OPT_DOUBLE: return opt_double(arg, d->name, (double*)field);
+    case OPT_STR:    return opt_str(arg, d->name, (const char**)field);
+    default:
+        if (strcmp(arg, d->name) != 0) return 0;
+        *(int*)field = d->value;
+        return 1;
+    }
+}
+
+// Table entry of arg (stored into o), NULL if unknown or malformed.
+static const opt_def *opt_find(const char *arg, mw_opts *o) {
+    const size_t n = sizeof opt_table / sizeof opt_table[0];
+    for (size_t k = 0; k < n; ++k) {
+        const int r = opt_match(&opt_table[k], arg, o);
+        if (r != 0) return r > 0 ? &opt_table[k] : NULL;
+    }
+    return NULL;
+}
+
+int mw_opts_parse(mw_opts *o, int argc, char **argv, unsigned caps) {
+    for (int i = 1; i < argc; ++i) {
+        const opt_def *d = opt_find(argv[i], o);
+        // Unknown, malformed, or an option this driver would ignore
+        if (!d || !(d->cap & caps)) return i;
+    }
+    if (o->pmu_trace) o->pmu = 1;
+    if (o->stats_every > 0) o->fused_stats = 1;
+    return 0;
+}
+
+int mw_opts_check_mode(const mw_opts *o, int argc, char **argv, const char **mode) {
+    unsigned m = 0;
+    if (o->ensemble > 0) {
+        m = MW_MODE_ENS;
+        *mode = "--ensemble";
+    } else if (o->ghost_depth > 0) {
+        m = MW_MODE_DEEP;
+        *mode = "--ghost-depth";
+    } else if (o->mg) {
+        m = MW_MODE_MG;
+        *mode = "--mg";
+    }
+    if (!m) return 0;
+    mw_opts scratch = *o;
+    for (int i = 1; i < argc; ++i) {
+        const opt_def *d = opt_find(argv[i], &scratch);
+        if (d && !(d->modes & m)) return i;
+    }
+    return 0;
+}
@@ -0,0 +1,89 @@
+// miniweather_opts.h - Runtime options shared by the drivers
+#ifndef MINIWEATHER_OPTS_H
+#define MINIWEATHER_OPTS_H
+
+// Grid size and step count stay compile-time (-DNX=...); these select
+// optional kernels and diagnostics at run time via --name=value flags.
+typedef struct {
+    int tblock;        // --tblock=N       time steps per temporal block (<=1: naive)
+    int tblock_tile;   // --tblock-tile=N  x-planes per temporal tile (0: auto)
+    int tile_y;        // --tile-y=N       y/z cache tile of the sweep (0: untiled)
+    int tile_z;        // --tile-z=N
+    int autotune;      // --autotune       tile shape from cache or search (2: --retune)
+    const char *tile_cache;  // --tile-cache=PATH
+    int decomp;        // --decomp=1|2|3   directions split across MPI ranks
+    int overlap;       // --overlap        nonblocking halos behind the interior sweep
+    int tasks;         // --tasks          task-graph step over tiles, no barrier per step (hybrid)
+    int task_x;        // --task-x=N       x-planes per task tile (0: 4)
+    int task_y;        // --task-y=N       y-rows per task tile (0: all)
+    int comm_thread;   // --comm-thread    one thread per rank owns the halos (hybrid)
+    int compute_threads;  // --compute-threads=N  threads sweeping beside it (0: the rest of the team)
+    int ghost_depth;   // --ghost-depth=K  K x ghost planes, one exchange every K steps (0: off)
+    const char *halo;        // --halo=sendrecv|persistent|neighbor|rma|auto  transport
+    int halo_compare;  // --halo-compare   time every halo backend before the run
+    int rebalance;     // --rebalance=K    rebalance x-slabs every K steps (0: off)
+    double rebalance_threshold;  // --rebalance-threshold=F  imbalance that triggers it
+    int checkpoint;    // --checkpoint=N   write a checkpoint every N steps (0: off)
+    const char *checkpoint_file;  // --checkpoint-file=PATH
+    int restart;       // --restart        resume from checkpoint_file
+    int snapshot;      // --snapshot=N     hand the grid to the writer thread every N steps
+    const char *snapshot_prefix;  // --snapshot-prefix=PATH
+    const char *snapshot_codec;   // --snapshot-codec=raw|rle
+    int snapshot_stride;  // --snapshot-stride=S  keep every S-th cell per direction
+    double converge;   // --converge=TOL   stop once the step residual is <= TOL (0: off)
+    int converge_every;       // --converge-every=K  residual reduced/checked every K steps
+    const char *converge_norm;  // --converge-norm=max|l2
+    int mg;            // --mg             multigrid V-cycles to --converge instead of STEPS
+    int mg_cycles;     // --mg-cycles=N    V-cycle limit
+    int mg_sweeps;     // --mg-sweeps=N    pre- and post-smoothing sweeps per level
+    int mg_compare;    // --mg-compare     also time plain Jacobi to the same tolerance
+    int mg_jacobi_max; // --mg-jacobi-max=N  Jacobi step limit of the comparison
+    int ensemble;      // --ensemble=M     advance M independent perturbed members instead (0: off)
+    const char *ensemble_grid;  // --ensemble-grid=NXxNYxNZ  member grid, boundary layers included
+    double ensemble_perturb;    // --ensemble-perturb=A  noise amplitude of members 1..M-1
+    int fused_stats;   // --fused-stats    checksum/min/max/mean from the last sweep
+    int stats_every;   // --stats-every=N  also print them every N steps (implies --fused-stats)
+    int inplace;       // --inplace        one grid buffer plus rolling planes (half memory)
+    int thp;           // --thp            grid buffers on transparent huge pages
+    int numa_report;   // --numa-report    print thread/core and page/node placement
+    int pmu;           // --pmu            perf_event_open counters around sweep and halos
+    const char *pmu_trace;   // --pmu-trace=PATH  per-step counter CSV (implies --pmu)
+    int roofline;      // --roofline       bandwidth/FLOP probes and roofline fields in METRICS
+    int roofline_mb;   // --roofline-mb=N  MiB of triad arrays per rank
+    const char *simd;        // --simd=auto|avx512|avx2|scalar  row kernel
+    double ref_checksum;     // --ref-checksum=X  double baseline for CHECKSUM_DRIFT (0: none)
+} mw_opts;
+
+// Option groups a driver implements, passed to mw_opts_parse so that a flag
+// the driver would ignore is rejected instead.
+enum {
+    MW_CAP_STATS  = 1 << 0,   // --fused-stats (every driver)
+    MW_CAP_CPU    = 1 << 1,   // options of all CPU drivers: --stats-every, --inplace,
+                              // --thp, --numa-report, --pmu*, --roofline*, --simd,
+                              // --ref-checksum, --snapshot*, --converge*, --mg*, --ensemble*
+    MW_CAP_TBLOCK = 1 << 2,   // --tblock, --tblock-tile
+    MW_CAP_TILE   = 1 << 3,   // --tile-y/z, --autotune, --retune, --tile-cache
+    MW_CAP_MPI    = 1 << 4,   // --decomp, --overlap, --halo*, --rebalance*, --checkpoint*, --restart
+    MW_CAP_HYBRID = 1 << 5,   // --tasks, --task-x/y, --comm-thread, --compute-threads
+    MW_CAP_DEEP   = 1 << 6,   // --ghost-depth
+};
+
+// Run modes that replace the time loop; each reads only some options.
+enum {
+    MW_MODE_ENS   = 1 << 0,   // --ensemble
+    MW_MODE_MG    = 1 << 1,   // --mg
+    MW_MODE_DEEP  = 1 << 2,   // --ghost-depth
+};
+
+void mw_opts_defaults(mw_opts *o);
+
+// Returns 0 on success, otherwise the argv index of the first option that
+// is malformed, unknown, or not in the driver's caps (MW_CAP_* bits).
+int  mw_opts_parse(mw_opts *o, int argc, char **argv, unsigned caps);
+
+// After mw_opts_parse: 0 if o selects no run mode or its mode reads every
+// option in argv, otherwise the argv index of the first option the mode
+// would ignore, with *mode set to the flag that selected it.
+int  mw_opts_check_mode(const mw_opts *o, int argc, char **argv, const char **mode);
+
+#endif
@@ -0,0 +1,326 @@
+// miniweather_pmu.c - Hardware counters around the sweep and the halo exchange
+//
+// Each thread opens its own counters (pid 0 = the calling thread), grouped
+// so they are scheduled together. The master thread reads all of them at
+// phase boundaries: a counter fd reports its target thread's count no
+// matter who reads it. Counts are scaled by time_enabled/time_running when
+// the kernel multiplexes.
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "miniweather_pmu.h"
+
+static const char *const event_names[MW_PMU_NEVENTS] = {
+    "CYCLES", "INSTR", "LLC_MISSES", "TASK_CLOCK", "MEM_BYTES"
+};
+
+const char *mw_pmu_name(int event) {
+    return event_names[event];
+}
+
+static int perf_open(struct perf_event_attr *attr, int pid, int cpu, int group) {
+#ifdef SYS_perf_event_open
+    return (int)syscall(SYS_perf_event_open, attr, pid, cpu, group, 0);
+#else
+    (void)attr; (void)pid; (void)cpu; (void)group;
+    return -1;
+#endif
+}
+
+static int open_thread_event(int event, int group) {
+    struct perf_event_attr a;
+    memset(&a, 0, sizeof a);
+    a.size = sizeof a;
+    a.exclude_kernel = 1;
+    a.exclude_hv = 1;
+    a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    switch (event) {
+    case MW_PMU_CYCLES:     a.type = PERF_TYPE_HARDWARE; a.config = PERF_COUNT_HW_CPU_CYCLES; break;
+    case MW_PMU_INSTR:      a.type = PERF_TYPE_HARDWARE; a.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+    case MW_PMU_LLC_MISS:   a.type = PERF_TYPE_HARDWARE; a.config = PERF_COUNT_HW_CACHE_MISSES; break;
+    case MW_PMU_TASK_CLOCK: a.type = PERF_TYPE_SOFTWARE; a.config = PERF_COUNT_SW_TASK_CLOCK; break;
+    default: return -1;
+    }
+    return perf_open(&a, 0, -1, group);
+}
+
+// Scaled count of one counter, -1 if it cannot be read.
+static double read_count(int fd) {
+    uint64_t v[3];
+    if (fd < 0 || read(fd, v, sizeof v) != (ssize_t)sizeof v) return -1.0;
+    if (v[2] == 0) return 0.0;
+    return v[2] < v[1] ? (double)v[0] * ((double)v[1] / (double)v[2]) : (double)v[0];
+}
+
+// Reads a small sysfs file into buf; 0 on success.
+static int read_sysfs(const char *path, char *buf, size_t len) {
+    FILE *f = fopen(path, "r");
+    if (!f) return -1;
+    size_t n = fread(buf, 1, len - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+    return n ? 0 : -1;
+}
+
+// Intel uncore memory controllers: cas_count_read/write on one CPU per
+// socket (the device's cpumask), bytes via the event's .scale (MiB).
+// Needs perf_event_paranoid <= 0 or CAP_PERFMON; silently absent otherwise.
+static void open_imc(mw_pmu *p) {
+    const char *base = "/sys/bus/event_source/devices";
+    DIR *dir = opendir(base);
+    if (!dir) return;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (strncmp(de->d_name, "uncore_imc", 10) != 0) continue;
+        char path[512], buf[256];
+        snprintf(path, sizeof path, "%s/%s/type", base, de->d_name);
+        if (read_sysfs(path, buf, sizeof buf) != 0) continue;
+        const int type = atoi(buf);
+
+        // cpumask lists one CPU per socket, e.g. "0" or "0,28"
+        snprintf(path, sizeof path, "%s/%s/cpumask", base, de->d_name);
+        if (read_sysfs(path, buf, sizeof buf) != 0) continue;
+        int cpu[MW_PMU_MAX_IMC], ncpu = 0;
+        for (char *tok = strtok(buf, ",\n"); tok && ncpu < MW_PMU_MAX_IMC; tok = strtok(NULL, ",\n"))
+            cpu[ncpu++] = atoi(tok);
+
+        static const char *const cas[2] = { "cas_count_read", "cas_count_write" };
+        for (int k = 0; k < 2; ++k) {
+            unsigned ev = 0, umask = 0;
+            snprintf(path, sizeof path, "%s/%s/events/%s", base, de->d_name, cas[k]);
+            if (read_sysfs(path, buf, sizeof buf) != 0 ||
+                sscanf(buf, "event=0x%x,umask=0x%x", &ev, &umask) < 1) continue;
+            double scale = 1.0;
+            snprintf(path, sizeof path, "%s/%s/events/%s.scale", base, de->d_name, cas[k]);
+            if (read_sysfs(path, buf, sizeof buf) == 0) scale = atof(buf);
+
+            for (int c = 0; c < ncpu && p->imc_n < MW_PMU_MAX_IMC; ++c) {
+                struct perf_event_attr a;
+                memset(&a, 0, sizeof a);
+                a.size = sizeof a;
+                a.type = (uint32_t)type;
+                a.config = ev | (umask << 8);
+                a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+                const int fd = perf_open(&a, -1, cpu[c], -1);
+                if (fd < 0) continue;
+                p->imc_fd[p->imc_n] = fd;
+                p->imc_scale[p->imc_n] = scale * 1048576.0;
+                p->imc_n++;
+            }
+        }
+    }
+    closedir(dir);
+}
+
+static double read_imc(const mw_pmu *p) {
+    double bytes = 0.0;
+    for (int i = 0; i < p->imc_n; ++i) {
+        const double c = read_count(p->imc_fd[i]);
+        if (c > 0.0) bytes += c * p->imc_scale[i];
+    }
+    return bytes;
+}
+
+int mw_pmu_open(mw_pmu *p) {
+    memset(p, 0, sizeof *p);
+#ifdef _OPENMP
+    p->threads = omp_get_max_threads();
+#else
+    p->threads = 1;
+#endif
+    const int T = p->threads;
+    p->fd = (int*)malloc((size_t)T * MW_PMU_NEVENTS * sizeof(int));
+    p->last = (double*)calloc((size_t)T * MW_PMU_NEVENTS, sizeof(double));
+    if (!p->fd || !p->last) {
+        mw_pmu_close(p);
+        return 0;
+    }
+    for (int i = 0; i < T * MW_PMU_NEVENTS; ++i) p->fd[i] = -1;
+
+#ifdef _OPENMP
+    #pragma omp parallel
+#endif
+    {
+        int t = 0;
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+#endif
+        int *fd = &p->fd[t * MW_PMU_NEVENTS];
+        int leader = -1;
+        for (int e = 0; e < MW_PMU_NEVENTS; ++e) {
+            if (e == MW_PMU_MEM_BYTES) continue;
+            fd[e] = open_thread_event(e, leader);
+            if (fd[e] >= 0 && leader < 0) leader = fd[e];
+        }
+    }
+
+    int n = 0;
+    for (int e = 0; e < MW_PMU_NEVENTS; ++e) {
+        p->have[e] = e != MW_PMU_MEM_BYTES;
+        for (int t = 0; t < T && p->have[e]; ++t)
+            if (p->fd[t * MW_PMU_NEVENTS + e] < 0) p->have[e] = 0;
+    }
+    open_imc(p);
+    p->have[MW_PMU_MEM_BYTES] = p->imc_n > 0;
+    for (int e = 0; e < MW_PMU_NEVENTS; ++e) n += p->have[e];
+    return n;
+}
+
+void mw_pmu_close(mw_pmu *p) {
+    if (p->fd) {
+        for (int i = 0; i < p->threads * MW_PMU_NEVENTS; ++i)
+            if (p->fd[i] >= 0) close(p->fd[i]);
+    }
+    for (int i = 0; i < p->imc_n; ++i) close(p->imc_fd[i]);
+    free(p->fd);
+    free(p->last);
+    free(p->trace);
+    p->fd = NULL;
+    p->last = p->trace = NULL;
+    p->imc_n = 0;
+}
+
+void mw_pmu_begin(mw_pmu *p) {
+    for (int t = 0; t < p->threads; ++t)
+        for (int e = 0; e < MW_PMU_MEM_BYTES; ++e)
+            if (p->have[e]) p->last[t * MW_PMU_NEVENTS + e] = read_count(p->fd[t * MW_PMU_NEVENTS + e]);
+    if (p->imc_n) p->imc_last = read_imc(p);
+}
+
+void mw_pmu_end(mw_pmu *p, int phase) {
+    for (int e = 0; e < MW_PMU_NEVENTS; ++e) {
+        if (!p->have[e]) continue;
+        double d = 0.0;
+        if (e == MW_PMU_MEM_BYTES) {
+            d = read_imc(p) - p->imc_last;
+        } else {
+            for (int t = 0; t < p->threads; ++t) {
+                const int i = t * MW_PMU_NEVENTS + e;
+                d += read_count(p->fd[i]) - p->last[i];
+            }
+        }
+        p->total[phase][e] += d;
+        p->step[phase][e] += d;
+    }
+}
+
+void mw_pmu_trace_step(mw_pmu *p, int step, double comp, double comm) {
+    if (p->trace_rows == p->trace_cap) {
+        const int cap = p->trace_cap ? 2 * p->trace_cap : 64;
+        double *t = (double*)realloc(p->trace, (size_t)cap * MW_PMU_TRACE_FIELDS * sizeof(double));
+        if (!t) return;
+        p->trace = t;
+        p->trace_cap = cap;
+    }
+    double *row = &p->trace[(size_t)p->trace_rows++ * MW_PMU_TRACE_FIELDS];
+    row[0] = step;
+    row[1] = comp;
+    row[2] = comm;
+    for (int ph = 0; ph < MW_PMU_NPHASES; ++ph)
+        for (int e = 0; e < MW_PMU_NEVENTS; ++e)
+            row[3 + ph * MW_PMU_NEVENTS + e] = p->have[e] ? p->step[ph][e] : -1.0;
+    memset(p->step, 0, sizeof p->step);
+}
+
+void mw_pmu_trace_header(FILE *f) {
+    fprintf(f, "rank,step,comp_time,comm_time");
+    static const char *const phase[MW_PMU_NPHASES] = { "comp", "comm" };
+    for (int ph = 0; ph < MW_PMU_NPHASES; ++ph)
+        for (int e = 0; e < MW_PMU_NEVENTS; ++e)
+            fprintf(f, ",%s_%s", phase[ph], event_names[e]);
+    fprintf(f, "\n");
+}
+
+void mw_pmu_trace_write(FILE *f, int rank, const double *rows, int n) {
+    for (int r = 0; r < n; ++r) {
+        const double *row = &rows[(size_t)r * MW_PMU_TRACE_FIELDS];
+        fprintf(f, "%d,%d,%.9f,%.9f", rank, (int)row[0], row[1], row[2]);
+        for (int k = 3; k < MW_PMU_TRACE_FIELDS; ++k) fprintf(f, ",%.0f", row[k]);
+        fprintf(f, "\n");
+    }
+}
+
+void mw_pmu_format(char *buf, size_t len, double total[MW_PMU_NPHASES][MW_PMU_NEVENTS],
+                   const int have[MW_PMU_NEVENTS], double comp_time) {
+    static const char *const phase[MW_PMU_NPHASES] = { "COMP", "COMM" };
+    size_t pos = 0;
+    for (int ph = 0; ph < MW_PMU_NPHASES && pos < len; ++ph) {
+        for (int e = 0; e < MW_PMU_NEVENTS && pos < len; ++e) {
+            int n = snprintf(buf + pos, len - pos, " PMU_%s_%s=%.4e", phase[ph], event_names[e],
+                             have[e] ? total[ph][e] : -1.0);
+            if (n > 0) pos += (size_t)n;
+        }
+    }
+    const double *c = total[MW_PMU_COMP];
+    const double ipc = have[MW_PMU_CYCLES] && have[MW_PMU_INSTR] && c[MW_PMU_CYCLES] > 0.0
+                       ? c[MW_PMU_INSTR] / c[MW_PMU_CYCLES] : -1.0;
+    const double bw = have[MW_PMU_MEM_BYTES] && comp_time > 0.0
+                      ? c[MW_PMU_MEM_BYTES] / comp_time : -1.0;
+    if (pos < len) snprintf(buf + pos, len - pos, " PMU_COMP_IPC=%.3f PMU_COMP_MEM_BW=%.4e", ipc, bw);
+}
+
+void mw_pmu_report(const mw_pmu *p, MPI_Comm comm, double comp_time, const char *trace_path,
+                   char *buf, size_t len) {
+    int rank = 0, size = 1;
+    MPI_Comm_rank(comm, &rank);
+    MPI_Comm_size(comm, &size);
+
+    // Events summed over ranks (available only if on every rank), memory
+    // traffic from the busiest node (IMC counts are node wide)
+    double total[MW_PMU_NPHASES][MW_PMU_NEVENTS];
+    int have[MW_PMU_NEVENTS];
+    MPI_Reduce(p->total, total, MW_PMU_NPHASES * MW_PMU_NEVENTS, MPI_DOUBLE, MPI_SUM, 0, comm);
+    for (int ph = 0; ph < MW_PMU_NPHASES; ++ph) {
+        MPI_Reduce(&p->total[ph][MW_PMU_MEM_BYTES], &total[ph][MW_PMU_MEM_BYTES], 1,
+                   MPI_DOUBLE, MPI_MAX, 0, comm);
+    }
+    MPI_Reduce(p->have, have, MW_PMU_NEVENTS, MPI_INT, MPI_MIN, 0, comm);
+    if (rank == 0) {
+        int n = snprintf(buf, len, " PMU=1");
+        mw_pmu_format(buf + n, len - n, total, have, comp_time);
+    }
+    if (!trace_path) return;
+
+    // Trace rows of every rank, gathered in rank order
+    int *rows = NULL, *counts = NULL, *displs = NULL;
+    double *all = NULL;
+    if (rank == 0) {
+        rows = (int*)malloc((size_t)size * 3 * sizeof(int));
+        if (!rows) MPI_Abort(comm, 2);
+        counts = rows + size;
+        displs = rows + 2 * size;
+    }
+    MPI_Gather(&p->trace_rows, 1, MPI_INT, rows, 1, MPI_INT, 0, comm);
+    if (rank == 0) {
+        size_t n = 0;
+        for (int r = 0; r < size; ++r) {
+            counts[r] = rows[r] * MW_PMU_TRACE_FIELDS;
+            displs[r] = (int)n;
+            n += (size_t)counts[r];
+        }
+        all = (double*)malloc((n ? n : 1) * sizeof(double));
+        if (!all) MPI_Abort(comm, 2);
+    }
+    MPI_Gatherv(p->trace, p->trace_rows * MW_PMU_TRACE_FIELDS, MPI_DOUBLE,
+                all, counts, displs, MPI_DOUBLE, 0, comm);
+    if (rank == 0) {
+        FILE *f = fopen(trace_path, "w");
+        if (f) {
+            mw_pmu_trace_header(f);
+            for (int r = 0; r < size; ++r) mw_pmu_trace_write(f, r, all + displs[r], rows[r]);
+            fclose(f);
+        } else {
+            fprintf(stderr, "ERROR: cannot write PMU trace '%s'\n", trace_path);
+        }
+    }
+    free(all);
+    free(rows);
+}
@@ -0,0 +1,83 @@
+// miniweather_pmu.h - Hardware counters around the sweep and the halo exchange
+#ifndef MINIWEATHER_PMU_H
+#define MINIWEATHER_PMU_H
+
+#include <stdio.h>
+#include <mpi.h>
+
+// Per-thread events, opened with perf_event_open(2) by every thread of the
+// OpenMP team (user space only, so perf_event_paranoid <= 2 suffices).
+// Events the CPU or kernel does not offer (e.g. in a VM) stay unavailable
+// and read as -1.
+enum {
+    MW_PMU_CYCLES,
+    MW_PMU_INSTR,
+    MW_PMU_LLC_MISS,
+    MW_PMU_TASK_CLOCK,      // ns on CPU (software event, always present)
+    MW_PMU_MEM_BYTES,       // DRAM traffic from uncore IMC CAS counts (Intel)
+    MW_PMU_NEVENTS
+};
+
+// Phases the counts are attributed to.
+enum {
+    MW_PMU_COMP,            // stencil sweep (the whole step when overlapped)
+    MW_PMU_COMM,            // halo exchange
+    MW_PMU_NPHASES
+};
+
+// Per-step trace row: step, comp/comm seconds, then every event per phase.
+#define MW_PMU_TRACE_FIELDS (3 + MW_PMU_NPHASES * MW_PMU_NEVENTS)
+
+#define MW_PMU_MAX_IMC 32
+
+typedef struct {
+    int threads;
+    int *fd;                // threads x events, -1 if not opened
+    double *last;           // threads x events, counts at mw_pmu_begin
+    int have[MW_PMU_NEVENTS];          // event counted on every thread
+    int imc_n;                         // uncore IMC counters (node wide)
+    int imc_fd[MW_PMU_MAX_IMC];
+    double imc_scale[MW_PMU_MAX_IMC];  // bytes per count
+    double imc_last;
+    double total[MW_PMU_NPHASES][MW_PMU_NEVENTS];   // summed over threads
+    double step[MW_PMU_NPHASES][MW_PMU_NEVENTS];    // since the last trace row
+    double *trace;          // rows x MW_PMU_TRACE_FIELDS
+    int trace_rows, trace_cap;
+} mw_pmu;
+
+// Opens the counters on every thread of the current OpenMP team (one
+// thread in serial builds). Call outside a parallel region. Returns the
+// number of events available.
+int  mw_pmu_open(mw_pmu *p);
+void mw_pmu_close(mw_pmu *p);
+
+// Brackets one phase; the counts in between are added to total[phase] and
+// step[phase]. Must not be nested and is called by the master thread only.
+void mw_pmu_begin(mw_pmu *p);
+void mw_pmu_end(mw_pmu *p, int phase);
+
+// Appends a trace row from step[] and the given times, then clears step[].
+void mw_pmu_trace_step(mw_pmu *p, int step, double comp, double comm);
+
+// CSV output of trace rows: header once, then one line per row.
+void mw_pmu_trace_header(FILE *f);
+void mw_pmu_trace_write(FILE *f, int rank, const double *rows, int n);
+
+// Event name for METRICS/trace columns ("CYCLES", "INSTR", ...).
+const char *mw_pmu_name(int event);
+
+// METRICS suffix " PMU_COMP_CYCLES=... PMU_COMM_MEM_BYTES=..." for totals
+// (already reduced over ranks), plus the sweep's IPC and DRAM bandwidth
+// over comp_time seconds. Unavailable events print -1.
+void mw_pmu_format(char *buf, size_t len, double total[MW_PMU_NPHASES][MW_PMU_NEVENTS],
+                   const int have[MW_PMU_NEVENTS], double comp_time);
+
+// Collective over comm: reduces every rank's totals to rank 0 and writes
+// " PMU=1" plus the mw_pmu_format suffix into buf there (comp_time is the
+// slowest rank's sweep time). Events count only if every rank has them;
+// MEM_BYTES is the busiest rank's, as IMC counts are node wide. With a
+// trace_path, rank 0 also gathers all trace rows into that CSV.
+void mw_pmu_report(const mw_pmu *p, MPI_Comm comm, double comp_time, const char *trace_path,
+                   char *buf, size_t len);
+
+#endif
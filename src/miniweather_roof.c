@@ -0,0 +1,192 @@
+// miniweather_roof.c - Machine peak probes and roofline position of a run
+//
+// The multiply-add probe carries one variant per row kernel ISA, compiled
+// with per-function target attributes like miniweather_simd.c, so the
+// compute roof is the one the selected kernel can actually reach. The
+// chains run in double in every build because the row kernels do: fp32
+// builds only store cells as float and widen them for the arithmetic. The
+// triad streams mw_real, the element type the sweep moves.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "miniweather_core.h"
+#include "miniweather_roof.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    !defined(__NVCOMPILER) && !defined(_OPENACC)
+  #define MW_HAVE_X86_SIMD 1
+  #include <immintrin.h>
+#endif
+
+#define MW_ROOF_REPS   5            // best of, as in STREAM
+#define MW_ROOF_CHAINS 16           // independent chains, enough to hide FMA latency
+#define MW_ROOF_ITERS  (1L << 21)   // multiply-adds per chain and run
+
+static double wtime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// ---------------------------------------------------------------------------
+// Multiply-add chains: acc = acc * m + a, MW_ROOF_CHAINS x lanes at a time.
+// Each variant returns the sum of its accumulators so nothing is elided.
+// ---------------------------------------------------------------------------
+static double madd_generic(long iters, int *lanes) {
+    double acc[MW_ROOF_CHAINS];
+    for (int k = 0; k < MW_ROOF_CHAINS; ++k) acc[k] = 1.0 + k * 1e-3;
+    for (long i = 0; i < iters; ++i) {
+        for (int k = 0; k < MW_ROOF_CHAINS; ++k) acc[k] = acc[k] * 0.9999999 + 1e-7;
+    }
+    double s = 0.0;
+    for (int k = 0; k < MW_ROOF_CHAINS; ++k) s += acc[k];
+    *lanes = 1;
+    return s;
+}
+
+#ifdef MW_HAVE_X86_SIMD
+
+__attribute__((target("avx2,fma")))
+static double madd_avx2(long iters, int *lanes) {
+    __m256d acc[MW_ROOF_CHAINS];
+    const __m256d m = _mm256_set1_pd(0.9999999), a = _mm256_set1_pd(1e-7);
+    for (int k = 0; k < MW_ROOF_CHAINS; ++k) acc[k] = _mm256_set1_pd(1.0 + k * 1e-3);
+    for (long i = 0; i < iters; ++i) {
+        for (int k = 0; k < MW_ROOF_CHAINS; ++k) acc[k] = _mm256_fmadd_pd(acc[k], m, a);
+    }
+    double out[4], s = 0.0;
+    for (int k = 0; k < MW_ROOF_CHAINS; ++k) {
+        _mm256_storeu_pd(out, acc[k]);
+        s += out[0] + out[1] + out[2] + out[3];
+    }
+    *lanes = 4;
+    return s;
+}
+
+__attribute__((target("avx512f")))
+static double madd_avx512(long iters, int *lanes) {
+    __m512d acc[MW_ROOF_CHAINS];
+    const __m512d m = _mm512_set1_pd(0.9999999), a = _mm512_set1_pd(1e-7);
+    for (int k = 0; k < MW_ROOF_CHAINS; ++k) acc[k] = _mm512_set1_pd(1.0 + k * 1e-3);
+    for (long i = 0; i < iters; ++i) {
+        for (int k = 0; k < MW_ROOF_CHAINS; ++k) acc[k] = _mm512_fmadd_pd(acc[k], m, a);
+    }
+    double s = 0.0;
+    for (int k = 0; k < MW_ROOF_CHAINS; ++k) s += _mm512_reduce_add_pd(acc[k]);
+    *lanes = 8;
+    return s;
+}
+
+#endif
+
+typedef double (*madd_fn)(long iters, int *lanes);
+
+static madd_fn madd_select(void) {
+#ifdef MW_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    const char *k = mw_simd_name();
+    if (strcmp(k, "avx512") == 0) return madd_avx512;
+    if (strcmp(k, "avx2") == 0 && __builtin_cpu_supports("fma")) return madd_avx2;
+#endif
+    return madd_generic;
+}
+
+static double probe_flops(void) {
+    const madd_fn fn = madd_select();
+    volatile double sink = 0.0;
+    double best = 0.0;
+    for (int rep = 0; rep < MW_ROOF_REPS; ++rep) {
+        double flop = 0.0, check = 0.0;
+        const double t0 = wtime();
+#ifdef _OPENMP
+        #pragma omp parallel reduction(+:flop, check)
+#endif
+        {
+            int lanes = 1;
+            check += fn(MW_ROOF_ITERS, &lanes);
+            flop += 2.0 * MW_ROOF_ITERS * MW_ROOF_CHAINS * lanes;
+        }
+        const double dt = wtime() - t0;
+        sink += check;
+        if (dt > 0.0 && flop / dt > best) best = flop / dt;
+    }
+    (void)sink;
+    return best;
+}
+
+// ---------------------------------------------------------------------------
+// STREAM triad
+// ---------------------------------------------------------------------------
+static double probe_bw(size_t bytes) {
+    const long n = (long)(bytes / (3 * sizeof(mw_real)));
+    if (n < 1) return 0.0;
+    mw_real *a = NULL, *b = NULL, *c = NULL;
+    if (posix_memalign((void**)&a, MW_ALIGN, n * sizeof(mw_real)) != 0 ||
+        posix_memalign((void**)&b, MW_ALIGN, n * sizeof(mw_real)) != 0 ||
+        posix_memalign((void**)&c, MW_ALIGN, n * sizeof(mw_real)) != 0) {
+        free(a); free(b); free(c);
+        return -1.0;
+    }
+
+    // First touch with the schedule of the timed loop
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static)
+#endif
+    for (long i = 0; i < n; ++i) {
+        a[i] = 0.0;
+        b[i] = 1.0;
+        c[i] = 2.0;
+    }
+
+    double best = 0.0;
+    for (int rep = 0; rep < MW_ROOF_REPS; ++rep) {
+        const double t0 = wtime();
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(static)
+#endif
+        for (long i = 0; i < n; ++i) a[i] = b[i] + (mw_real)3.0 * c[i];
+        const double dt = wtime() - t0;
+        const double bw = 3.0 * sizeof(mw_real) * n / dt;
+        if (dt > 0.0 && bw > best) best = bw;
+    }
+
+    volatile mw_real sink = a[n / 2];
+    (void)sink;
+    free(a); free(b); free(c);
+    return best;
+}
+
+int mw_roof_probe(mw_roof *r, size_t bytes) {
+    r->bw = probe_bw(bytes);
+    r->flops = probe_flops();
+    return r->bw < 0.0 ? -1 : 0;
+}
+
+void mw_roof_format(char *buf, size_t len, const mw_roof *peak, double cells_per_s,
+                    double bytes_per_update, double flops_per_update) {
+    const double ai = flops_per_update / bytes_per_update;
+    const double gbs = cells_per_s * bytes_per_update / 1e9;
+    const double gflops = cells_per_s * flops_per_update / 1e9;
+    const double mem_roof = ai * peak->bw / 1e9;
+    const double cpu_roof = peak->flops / 1e9;
+    const double roof = mem_roof < cpu_roof ? mem_roof : cpu_roof;
+    snprintf(buf, len,
+             " ROOF_PEAK_GBS=%.2f ROOF_PEAK_GFLOPS=%.2f ROOF_BW_PRECISION=%d "
+             "ROOF_FLOP_PRECISION=64 AI=%.4f ACHIEVED_GBS=%.2f "
+             "ACHIEVED_GFLOPS=%.3f ROOF_PCT=%.1f ROOF_BOUND=%s",
+             peak->bw / 1e9, cpu_roof, MW_PRECISION, ai, gbs, gflops,
+             roof > 0.0 ? 100.0 * gflops / roof : -1.0,
+             mem_roof < cpu_roof ? "memory" : "compute");
+}
+
+int mw_roof_probe_all(mw_roof *r, size_t bytes, MPI_Comm comm) {
+    mw_roof mine = { 0.0, 0.0 };
+    MPI_Barrier(comm);
+    int ok = mw_roof_probe(&mine, bytes) == 0, all_ok;
+    MPI_Allreduce(&ok, &all_ok, 1, MPI_INT, MPI_MIN, comm);
+    if (!all_ok) return -1;
+    MPI_Reduce(&mine.bw, &r->bw, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+    MPI_Reduce(&mine.flops, &r->flops, 1, MPI_DOUBLE, MPI_SUM, 0, comm);
+    return 0;
+}
@@ -0,0 +1,40 @@
+// miniweather_roof.h - Machine peak probes and roofline position of a run
+#ifndef MINIWEATHER_ROOF_H
+#define MINIWEATHER_ROOF_H
+
+#include <stddef.h>
+#include <mpi.h>
+
+// Measured peaks of the calling process: STREAM triad bandwidth and
+// multiply-add throughput, both on every thread of the OpenMP team (one
+// thread in serial builds).
+typedef struct {
+    double bw;      // bytes/s, best triad a[i] = b[i] + s*c[i] on mw_real arrays
+    double flops;   // flop/s, best run of independent double multiply-add chains
+} mw_roof;
+
+// Runs both probes. The triad arrays take `bytes` in total (pick several
+// times the last-level cache) and are first-touched with the sweep's static
+// schedule; the multiply-add probe uses the vector width of the row kernel
+// selected by mw_simd_select. Returns -1 if the arrays cannot be allocated.
+int mw_roof_probe(mw_roof *r, size_t bytes);
+
+// Collective over comm: every rank probes at once after a barrier, so
+// shared node bandwidth is split as in the run, and r on rank 0 receives
+// the peaks summed over ranks. Returns -1 on every rank if any rank cannot
+// allocate its arrays.
+int mw_roof_probe_all(mw_roof *r, size_t bytes, MPI_Comm comm);
+
+// METRICS suffix for a run sweeping cells_per_s cell updates per second:
+//   ROOF_PEAK_GBS= ROOF_PEAK_GFLOPS=  measured peaks (already summed over ranks)
+//   ROOF_BW_PRECISION= ROOF_FLOP_PRECISION=  bits of the triad elements
+//                                     (MW_PRECISION) and of the flops (64,
+//                                     as in the row kernels)
+//   AI=                               flop per DRAM byte of the sweep
+//   ACHIEVED_GBS= ACHIEVED_GFLOPS=    modelled traffic and flops per second
+//   ROOF_PCT=                         achieved GFLOP/s over min(peak, AI * bw)
+//   ROOF_BOUND=memory|compute         which roof limits the sweep
+void mw_roof_format(char *buf, size_t len, const mw_roof *peak, double cells_per_s,
+                    double bytes_per_update, double flops_per_update);
+
+#endif
@@ -1,7 +1,16 @@
 // miniweather_serial.c - Serial baseline with comprehensive metrics
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 #include <sys/time.h>
+#include "miniweather_core.h"
+#include "miniweather_opts.h"
+#include "miniweather_snap.h"
+#include "miniweather_numa.h"
+#include "miniweather_pmu.h"
+#include "miniweather_roof.h"
+#include "miniweather_mg.h"
+#include "miniweather_ens.h"
 
 #ifndef NX
 #define NX 64
@@ -22,39 +31,212 @@ static double get_wtime() {
     return tv.tv_sec + tv.tv_usec * 1e-6;
 }
 
-int main() {
-    double (*grid)[NY][NZ] = malloc(sizeof(double[NX][NY][NZ]));
-    double (*new_grid)[NY][NZ] = malloc(sizeof(double[NX][NY][NZ]));
+int main(int argc, char **argv) {
+    mw_opts opts;
+    mw_opts_defaults(&opts);
+    int bad = mw_opts_parse(&opts, argc, argv,
+                            MW_CAP_STATS | MW_CAP_CPU | MW_CAP_TBLOCK);
+    if (bad) {
+        fprintf(stderr, "ERROR: unknown or unsupported option %s\n", argv[bad]);
+        return 1;
+    }
+
+    // Run modes that replace the time loop take only their own options
+    const char *mode = NULL;
+    bad = mw_opts_check_mode(&opts, argc, argv, &mode);
+    if (bad) {
+        fprintf(stderr, "ERROR: %s cannot be combined with %s\n", mode, argv[bad]);
+        return 1;
+    }
+    if (opts.mg && opts.converge <= 0.0) {
+        fprintf(stderr, "ERROR: --mg needs --converge=TOL\n");
+        return 1;
+    }
+    const int depth = opts.tblock > 1 ? opts.tblock : 1;
+    
+    // Row kernel by cpuid unless forced
+    if (!mw_simd_select(opts.simd)) {
+        fprintf(stderr, "ERROR: SIMD kernel '%s' not available\n", opts.simd);
+        return 1;
+    }
     
-    if (!grid || !new_grid) {
+    // Machine peaks for the roofline, before the grid takes memory
+    mw_roof roof;
+    if (opts.roofline && mw_roof_probe(&roof, (size_t)opts.roofline_mb << 20) != 0) {
+        fprintf(stderr, "ERROR: cannot allocate %d MiB for the bandwidth probe\n", opts.roofline_mb);
+        return 1;
+    }
+    
+    if (opts.thp && !mw_grid_hugepages(1)) {
+        fprintf(stderr, "ERROR: transparent huge pages not supported\n");
+        return 1;
+    }
+    
+    // In place: one grid buffer plus rolling planes, plain x-ordered sweep only
+    if (opts.inplace && (depth > 1 || !mw_grid_inplace(1))) {
+        fprintf(stderr, "ERROR: --inplace cannot be combined with --tblock\n");
+        return 1;
+    }
+    
+    // Ensemble: many small independent grids instead of the one below
+    if (opts.ensemble > 0) {
+        return mw_ens_run(&opts, MPI_COMM_NULL, STEPS, "serial", 0);
+    }
+
+    mw_grid g;
+    if (mw_grid_alloc(&g, NX, NY, NZ) != 0) {
         fprintf(stderr, "Allocation failed\n");
         return 1;
     }
     
     // Initialize grid
-    for (int x = 0; x < NX; x++)
-        for (int y = 0; y < NY; y++)
-            for (int z = 0; z < NZ; z++)
-                grid[x][y][z] = (double)(x + y + z);
+    mw_grid_init(&g, 0, 0, 0);
+    
+    if (opts.numa_report) {
+        char numa[1024];
+        mw_numa_report(&g, numa, sizeof numa);
+        printf("NUMA: %s\n", numa);
+    }
+    
+    // Optional snapshots of the whole grid, written by a background thread
+    const int snap_codec = mw_snap_parse(opts.snapshot_codec);
+    if (snap_codec < 0) {
+        fprintf(stderr, "ERROR: unknown snapshot codec '%s'\n", opts.snapshot_codec);
+        return 1;
+    }
+    const int snap_lo[3] = { 0, 0, 0 }, snap_hi[3] = { NX-1, NY-1, NZ-1 };
+    mw_snap snap;
+    if (opts.snapshot > 0 &&
+        mw_snap_open(&snap, opts.snapshot_prefix, 0, (mw_snap_codec)snap_codec,
+                     opts.snapshot_stride) != 0) {
+        fprintf(stderr, "ERROR: cannot start snapshot writer\n");
+        return 1;
+    }
+    
+    // Convergence mode: residual of every K-th step, stop at the tolerance
+    const int conv_norm = mw_norm_parse(opts.converge_norm);
+    if (conv_norm < 0 || opts.converge_every < 1) {
+        fprintf(stderr, "ERROR: bad convergence norm '%s' or interval %d\n",
+                opts.converge_norm, opts.converge_every);
+        return 1;
+    }
+    const int conv_every = opts.converge > 0.0 ? opts.converge_every : 0;
+    const double interior = (double)(NX-2) * (NY-2) * (NZ-2);
+    
+    // Multigrid: V-cycles to the tolerance replace the time loop
+    if (opts.mg) {
+        const int rc = mw_mg_run(&g, NULL, &opts, conv_norm, STEPS, "serial", 0);
+        mw_grid_free(&g);
+        return rc;
+    }
+    double residual = -1.0;
+    int steps_taken = STEPS, converged = 0;
+    
+    // Fused statistics: the last step (and every --stats-every step) folds
+    // the new level into stats while sweeping; stats_step is the step they
+    // describe
+    mw_stats stats;
+    mw_stats_clear(&stats);
+    int stats_step = -1;
+    
+    // Hardware counters of every thread around each sweep
+    mw_pmu pmu;
+    if (opts.pmu) mw_pmu_open(&pmu);
     
     // Timing
     double t0 = get_wtime();
     
-    // Time evolution loop
-    for (int t = 0; t < STEPS; t++) {
-        // 6-point stencil update
-        for (int x = 1; x < NX-1; x++)
-            for (int y = 1; y < NY-1; y++)
-                for (int z = 1; z < NZ-1; z++)
-                    new_grid[x][y][z] = (grid[x-1][y][z] + grid[x+1][y][z] +
-                                         grid[x][y-1][z] + grid[x][y+1][z] +
-                                         grid[x][y][z-1] + grid[x][y][z+1]) / 6.0;
-        
-        // Copy back
-        for (int x = 1; x < NX-1; x++)
-            for (int y = 1; y < NY-1; y++)
-                for (int z = 1; z < NZ-1; z++)
-                    grid[x][y][z] = new_grid[x][y][z];
+    // Time evolution loop: 6-point stencil, buffers swapped each step
+    if (depth > 1) {
+        // Temporal blocks stop at every snapshot and convergence check step
+        int n = 0;
+        for (int t = 0; t < STEPS; t += n) {
+            n = STEPS - t;
+            if (opts.snapshot > 0 && opts.snapshot - t % opts.snapshot < n)
+                n = opts.snapshot - t % opts.snapshot;
+            if (conv_every > 0 && conv_every - t % conv_every < n)
+                n = conv_every - t % conv_every;
+            if (opts.stats_every > 0 && opts.stats_every - t % opts.stats_every < n)
+                n = opts.stats_every - t % opts.stats_every;
+            const int stats_now = opts.fused_stats && (t + n == STEPS ||
+                                  (opts.stats_every > 0 && (t + n) % opts.stats_every == 0));
+            const double ts = opts.pmu ? get_wtime() : 0.0;
+            if (opts.pmu) mw_pmu_begin(&pmu);
+            if (stats_now) {
+                // Last step of the block sweeps with the statistics fused in
+                if (n > 1) mw_step_tblock(&g, 1, NX-2, n - 1, depth, opts.tblock_tile);
+                mw_stats_clear(&stats);
+                mw_step_stats(&g, 1, NX-2, &stats);
+            } else {
+                mw_step_tblock(&g, 1, NX-2, n, depth, opts.tblock_tile);
+            }
+            if (opts.pmu) {
+                mw_pmu_end(&pmu, MW_PMU_COMP);
+                mw_pmu_trace_step(&pmu, t + n, get_wtime() - ts, 0.0);
+            }
+            if (stats_now) {
+                mw_grid_stats(&g, &stats, 1);
+                stats_step = t + n;
+                if (opts.stats_every > 0) mw_stats_print(t + n, &stats);
+            }
+            if (opts.snapshot > 0 && (t + n) % opts.snapshot == 0)
+                mw_snap_write(&snap, &g, snap_lo, snap_hi, snap_lo, t + n);
+            if (conv_every > 0 && (t + n) % conv_every == 0) {
+                // The blocked sweep leaves the previous level in next
+                const double r = mw_residual(&g, 1, NX-2, conv_norm);
+                residual = conv_norm == MW_NORM_L2 ? sqrt(r / interior) : r;
+                if (residual <= opts.converge) {
+                    converged = 1;
+                    steps_taken = t + n;
+                    break;
+                }
+            }
+        }
+    } else {
+        for (int t = 0; t < STEPS; t++) {
+            const int check = conv_every > 0 && (t + 1) % conv_every == 0;
+            const int stats_now = opts.fused_stats && (t + 1 == STEPS ||
+                                  (opts.stats_every > 0 && (t + 1) % opts.stats_every == 0));
+            const double ts = opts.pmu ? get_wtime() : 0.0;
+            if (opts.pmu) mw_pmu_begin(&pmu);
+            if (check) {
+                // Residual fused into the (untiled) sweep
+                const double r = mw_step_residual(&g, 1, NX-2, conv_norm);
+                residual = conv_norm == MW_NORM_L2 ? sqrt(r / interior) : r;
+            } else if (stats_now) {
+                // Statistics fused into the (untiled) sweep
+                mw_stats_clear(&stats);
+                mw_step_stats(&g, 1, NX-2, &stats);
+            } else {
+                mw_step(&g, 1, NX-2);
+            }
+            if (opts.pmu) {
+                mw_pmu_end(&pmu, MW_PMU_COMP);
+                mw_pmu_trace_step(&pmu, t + 1, get_wtime() - ts, 0.0);
+            }
+            if (stats_now) {
+                // A residual step cannot fuse both: it takes the extra pass
+                mw_grid_stats(&g, &stats, !check);
+                stats_step = t + 1;
+                if (opts.stats_every > 0) mw_stats_print(t + 1, &stats);
+            }
+            if (opts.snapshot > 0 && (t + 1) % opts.snapshot == 0)
+                mw_snap_write(&snap, &g, snap_lo, snap_hi, snap_lo, t + 1);
+            if (check && residual <= opts.converge) {
+                converged = 1;
+                steps_taken = t + 1;
+                break;
+            }
+        }
+    }
+    
+    // Queued snapshots still count: the run ends when they are on disk
+    double snap_bytes = 0.0, snap_bw = 0.0, snap_stall = 0.0;
+    if (opts.snapshot > 0) {
+        mw_snap_close(&snap);
+        snap_bytes = snap.bytes;
+        snap_bw    = snap.write_time > 0.0 ? snap.bytes / snap.write_time : 0.0;
+        snap_stall = snap.stall_time;
     }
     
     double t1 = get_wtime();
@@ -62,21 +244,75 @@ int main() {
     
     // Calculate metrics
     size_t total_cells = (size_t)NX * NY * NZ;
-    double throughput_steps = STEPS / elapsed;
-    double throughput_cells = (total_cells * STEPS) / elapsed;
+    double throughput_steps = steps_taken / elapsed;
+    double throughput_cells = (total_cells * steps_taken) / elapsed;
+    double bytes_per_update = mw_bytes_per_update(depth);
+    
+    // Checksum for correctness: by-product of the last sweep in fused mode
+    // (one pass after the loop only if the run converged before STEPS)
+    double sum;
+    char stats_str[128] = " FUSED_STATS=0";
+    if (opts.fused_stats) {
+        if (stats_step != steps_taken) mw_grid_stats(&g, &stats, 0);
+        sum = stats.sum;
+        snprintf(stats_str, sizeof stats_str, " FUSED_STATS=1 MIN=%.6e MAX=%.6e MEAN=%.10e",
+                 stats.min, stats.max, stats.sum / stats.cells);
+    } else {
+        sum = mw_checksum(&g, 0, NX-1);
+    }
     
-    // Checksum for correctness
-    double sum = 0.0;
-    for (int x = 0; x < NX; x++)
-        for (int y = 0; y < NY; y++)
-            for (int z = 0; z < NZ; z++)
-                sum += grid[x][y][z];
+    // Counter totals for METRICS, per-step rows for the trace
+    char pmu_str[1024] = " PMU=0";
+    if (opts.pmu) {
+        int n = snprintf(pmu_str, sizeof pmu_str, " PMU=1");
+        mw_pmu_format(pmu_str + n, sizeof pmu_str - n, pmu.total, pmu.have, elapsed);
+        if (opts.pmu_trace) {
+            FILE *f = fopen(opts.pmu_trace, "w");
+            if (f) {
+                mw_pmu_trace_header(f);
+                mw_pmu_trace_write(f, 0, pmu.trace, pmu.trace_rows);
+                fclose(f);
+            } else {
+                fprintf(stderr, "ERROR: cannot write PMU trace '%s'\n", opts.pmu_trace);
+            }
+        }
+        mw_pmu_close(&pmu);
+    }
     
+    // Position of the sweep under the measured roofs
+    char roof_str[256] = " ROOFLINE=0";
+    if (opts.roofline) {
+        int n = snprintf(roof_str, sizeof roof_str, " ROOFLINE=1");
+        mw_roof_format(roof_str + n, sizeof roof_str - n, &roof, throughput_cells,
+                       bytes_per_update, mw_flops_per_update());
+    }
+    
+    // Steps taken and the time the skipped ones would have cost at this rate
+    char conv_str[192] = " CONVERGE=0";
+    if (conv_every > 0) {
+        snprintf(conv_str, sizeof conv_str,
+                 " CONVERGE=1 CONVERGE_NORM=%s CONVERGE_TOL=%.3e RESIDUAL=%.3e CONVERGED=%d "
+                 "STEPS_TAKEN=%d TIME_SAVED=%.6f",
+                 opts.converge_norm, opts.converge, residual, converged, steps_taken,
+                 (STEPS - steps_taken) * elapsed / steps_taken);
+    }
+    
+    // Relative checksum drift against a (double precision) reference run
+    char drift[48] = "";
+    if (opts.ref_checksum != 0.0) {
+        snprintf(drift, sizeof drift, " CHECKSUM_DRIFT=%.3e",
+                 fabs(sum - opts.ref_checksum) / fabs(opts.ref_checksum));
+    }
+
     printf("METRICS: VERSION=serial GRID=%dx%dx%d STEPS=%d TIME=%.6f "
-           "THROUGHPUT_STEPS=%.2f THROUGHPUT_CELLS=%.2e CHECKSUM=%.10e\n",
-           NX, NY, NZ, STEPS, elapsed, throughput_steps, throughput_cells, sum);
+           "THROUGHPUT_STEPS=%.2f THROUGHPUT_CELLS=%.2e SIMD=%s TBLOCK=%d BYTES_PER_UPDATE=%.2f "
+           "SNAPSHOT=%d SNAPSHOT_CODEC=%s SNAPSHOT_BYTES=%.3e SNAPSHOT_BW=%.2e SNAPSHOT_STALL_TIME=%.6f "
+           "PRECISION=%d INPLACE=%d GRID_MB=%.1f PEAK_RSS_MB=%.1f CHECKSUM=%.10e%s%s%s%s%s\n",
+           NX, NY, NZ, STEPS, elapsed, throughput_steps, throughput_cells,
+           mw_simd_name(), depth, bytes_per_update,
+           opts.snapshot, opts.snapshot_codec, snap_bytes, snap_bw, snap_stall, MW_PRECISION,
+           opts.inplace, mw_grid_bytes(&g) / 1048576.0, mw_peak_rss() / 1048576.0, sum, stats_str, drift, pmu_str, roof_str, conv_str);
     
-    free(new_grid);
-    free(grid);
+    mw_grid_free(&g);
     return 0;
 }
\ No newline at end of file
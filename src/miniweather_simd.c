@@ -0,0 +1,122 @@
+// miniweather_simd.c - Hand-vectorised row kernels with runtime CPU dispatch
+//
+// The AVX2 / AVX-512 kernels are compiled with per-function target
+// attributes, so one binary carries all variants and mw_simd_select picks
+// the widest one the CPU reports through cpuid. Lanes add the six
+// neighbours in the same order as mw_stencil_row and divide by 6, so the
+// results are bit-identical to the scalar reference.
+#include <stdint.h>
+#include <string.h>
+#include "miniweather_core.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    !defined(__NVCOMPILER) && !defined(_OPENACC)
+  #define MW_HAVE_X86_SIMD 1
+  #include <immintrin.h>
+#endif
+
+static void row_scalar(const mw_real *restrict g, mw_real *restrict ng,
+                       size_t i0, size_t px, int zs, int z0, int z1) {
+    mw_stencil_row(g, ng, i0, px, zs, z0, z1);
+}
+
+#ifdef MW_HAVE_X86_SIMD
+
+// Lane loads/stores in double. With float storage a vector of 4 (AVX2) or
+// 8 (AVX-512) cells is widened on load and rounded back on store, so the
+// sums are still taken in double.
+#if MW_PRECISION == 32
+  #define LD4(p)     _mm256_cvtps_pd(_mm_load_ps(p))
+  #define LDU4(p)    _mm256_cvtps_pd(_mm_loadu_ps(p))
+  #define ST4(p, v)  _mm_store_ps(p, _mm256_cvtpd_ps(v))
+  #define LD8(p)     _mm512_cvtps_pd(_mm256_load_ps(p))
+  #define LDU8(p)    _mm512_cvtps_pd(_mm256_loadu_ps(p))
+  #define ST8(p, v)  _mm256_store_ps(p, _mm512_cvtpd_ps(v))
+#else
+  #define LD4(p)     _mm256_load_pd(p)
+  #define LDU4(p)    _mm256_loadu_pd(p)
+  #define ST4(p, v)  _mm256_store_pd(p, v)
+  #define LD8(p)     _mm512_load_pd(p)
+  #define LDU8(p)    _mm512_loadu_pd(p)
+  #define ST8(p, v)  _mm512_store_pd(p, v)
+#endif
+
+// Rows start MW_ALIGN-aligned at z = 1, so after peeling to the vector
+// width the stores (and the x/y neighbour loads) are aligned.
+__attribute__((target("avx2")))
+static void row_avx2(const mw_real *restrict g, mw_real *restrict ng,
+                     size_t i0, size_t px, int zs, int z0, int z1) {
+    const uintptr_t mask = 4 * sizeof(mw_real) - 1;
+    int z = z0;
+    while (z < z1 && ((uintptr_t)&ng[i0 + z] & mask)) ++z;
+    mw_stencil_row(g, ng, i0, px, zs, z0, z);
+
+    const __m256d six = _mm256_set1_pd(6.0);
+    for (; z + 4 <= z1; z += 4) {
+        const mw_real *c = &g[i0 + z];
+        __m256d s = _mm256_add_pd(LD4(c - px), LD4(c + px));
+        s = _mm256_add_pd(s, LD4(c - zs));
+        s = _mm256_add_pd(s, LD4(c + zs));
+        s = _mm256_add_pd(s, LDU4(c - 1));
+        s = _mm256_add_pd(s, LDU4(c + 1));
+        ST4(&ng[i0 + z], _mm256_div_pd(s, six));
+    }
+    mw_stencil_row(g, ng, i0, px, zs, z, z1);
+}
+
+__attribute__((target("avx512f")))
+static void row_avx512(const mw_real *restrict g, mw_real *restrict ng,
+                       size_t i0, size_t px, int zs, int z0, int z1) {
+    const uintptr_t mask = 8 * sizeof(mw_real) - 1;
+    int z = z0;
+    while (z < z1 && ((uintptr_t)&ng[i0 + z] & mask)) ++z;
+    mw_stencil_row(g, ng, i0, px, zs, z0, z);
+
+    const __m512d six = _mm512_set1_pd(6.0);
+    for (; z + 8 <= z1; z += 8) {
+        const mw_real *c = &g[i0 + z];
+        __m512d s = _mm512_add_pd(LD8(c - px), LD8(c + px));
+        s = _mm512_add_pd(s, LD8(c - zs));
+        s = _mm512_add_pd(s, LD8(c + zs));
+        s = _mm512_add_pd(s, LDU8(c - 1));
+        s = _mm512_add_pd(s, LDU8(c + 1));
+        ST8(&ng[i0 + z], _mm512_div_pd(s, six));
+    }
+    mw_stencil_row(g, ng, i0, px, zs, z, z1);
+}
+
+#endif
+
+mw_row_fn mw_row_kernel = row_scalar;
+static const char *row_kernel_name = "scalar";
+
+const char *mw_simd_select(const char *want) {
+    mw_row_fn fn = NULL;
+    const char *name = NULL;
+    const int any = (want == NULL || strcmp(want, "auto") == 0);
+
+#ifdef MW_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (!fn && (any || strcmp(want, "avx512") == 0) && __builtin_cpu_supports("avx512f")) {
+        fn = row_avx512;
+        name = "avx512";
+    }
+    if (!fn && (any || strcmp(want, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+        fn = row_avx2;
+        name = "avx2";
+    }
+#endif
+    if (!fn && (any || strcmp(want, "scalar") == 0)) {
+        fn = row_scalar;
+        name = "scalar";
+    }
+    if (!fn) return NULL;
+
+    mw_row_kernel = fn;
+    row_kernel_name = name;
+    return name;
+}
+
+const char *mw_simd_name(void) {
+    return row_kernel_name;
+}
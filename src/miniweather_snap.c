@@ -0,0 +1,247 @@
+// miniweather_snap.c - Asynchronous snapshot output on a writer thread
+//
+// The compute thread owns free slots, the writer owns the slot it is
+// writing; both hand slots over under s->lock. With two slots the compute
+// thread only waits when one snapshot is being written and the next one is
+// already queued.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "miniweather_snap.h"
+
+enum { SLOT_FREE, SLOT_QUEUED, SLOT_BUSY };
+
+static const char *const codec_names[MW_SNAP_COUNT] = { "raw", "rle" };
+
+static double wtime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int mw_snap_parse(const char *name) {
+    for (int k = 0; k < MW_SNAP_COUNT; ++k)
+        if (strcmp(name, codec_names[k]) == 0) return k;
+    return -1;
+}
+
+const char *mw_snap_name(mw_snap_codec codec) {
+    return codec_names[codec];
+}
+
+// PackBits: control byte c <= 127 is followed by c + 1 literal bytes,
+// c >= 129 by one byte repeated 257 - c times. At most n + n/128 + 1 bytes.
+static size_t packbits(const unsigned char *in, size_t n, unsigned char *out) {
+    size_t i = 0, o = 0;
+    while (i < n) {
+        size_t run = 1;
+        while (i + run < n && run < 128 && in[i + run] == in[i]) ++run;
+        if (run >= 3) {
+            out[o++] = (unsigned char)(257 - run);
+            out[o++] = in[i];
+            i += run;
+            continue;
+        }
+        // Literals up to the next run of three
+        size_t lit = 0;
+        while (i + lit < n && lit < 128) {
+            if (i + lit + 2 < n && in[i + lit] == in[i + lit + 1] &&
+                in[i + lit] == in[i + lit + 2]) break;
+            ++lit;
+        }
+        out[o++] = (unsigned char)(lit - 1);
+        memcpy(out + o, in + i, lit);
+        o += lit;
+        i += lit;
+    }
+    return o;
+}
+
+// Encodes a staged block into s->enc; returns the encoded size and points
+// *data at the bytes to write.
+static size_t encode(mw_snap *s, const mw_snap_slot *sl, const unsigned char **data) {
+    const size_t raw = (size_t)sl->hd.raw_bytes;
+    if (s->codec == MW_SNAP_RAW) {
+        *data = (const unsigned char*)sl->data;
+        return raw;
+    }
+
+    // Shuffle into the first raw bytes, run-length code behind them
+    const size_t need = 2 * raw + raw / 128 + 16;
+    if (need > s->enc_cap) {
+        free(s->enc);
+        s->enc = (unsigned char*)malloc(need);
+        s->enc_cap = s->enc ? need : 0;
+        if (!s->enc) return (size_t)-1;
+    }
+    const unsigned char *in = (const unsigned char*)sl->data;
+    const size_t rb = sizeof(mw_real), cells = raw / rb;
+    for (size_t b = 0; b < rb; ++b)
+        for (size_t i = 0; i < cells; ++i)
+            s->enc[b * cells + i] = in[i * rb + b];
+    *data = s->enc + raw;
+    return packbits(s->enc, raw, s->enc + raw);
+}
+
+// Writes one staged snapshot; returns 0 on success.
+static int write_slot(mw_snap *s, mw_snap_slot *sl, double *bytes) {
+    const unsigned char *data = NULL;
+    const size_t n = encode(s, sl, &data);
+    if (n == (size_t)-1) return -1;
+    sl->hd.data_bytes = (int64_t)n;
+
+    char path[4096];
+    snprintf(path, sizeof path, "%s_%06d_r%04d.mws", s->prefix, sl->hd.step, s->rank);
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    int ok = fwrite(&sl->hd, sizeof sl->hd, 1, f) == 1 &&
+             (n == 0 || fwrite(data, n, 1, f) == 1);
+    if (fclose(f) != 0) ok = 0;
+    if (!ok) return -1;
+    *bytes = (double)(sizeof sl->hd + n);
+    return 0;
+}
+
+static void *writer_main(void *arg) {
+    mw_snap *s = (mw_snap*)arg;
+    pthread_mutex_lock(&s->lock);
+    for (;;) {
+        // Oldest queued slot first
+        mw_snap_slot *sl = NULL;
+        for (int k = 0; k < 2; ++k) {
+            if (s->slot[k].state == SLOT_QUEUED && (!sl || s->slot[k].seq < sl->seq))
+                sl = &s->slot[k];
+        }
+        if (!sl) {
+            if (s->stop) break;
+            pthread_cond_wait(&s->cond, &s->lock);
+            continue;
+        }
+        sl->state = SLOT_BUSY;
+        pthread_mutex_unlock(&s->lock);
+
+        const double t0 = wtime();
+        double bytes = 0.0;
+        const int rc = write_slot(s, sl, &bytes);
+        const double t1 = wtime();
+        if (rc != 0) {
+            fprintf(stderr, "ERROR: cannot write snapshot %s step %d (rank %d)\n",
+                    s->prefix, sl->hd.step, s->rank);
+        }
+
+        pthread_mutex_lock(&s->lock);
+        s->write_time += t1 - t0;
+        if (rc == 0) { s->count++; s->bytes += bytes; }
+        else s->failed++;
+        sl->state = SLOT_FREE;
+        pthread_cond_broadcast(&s->cond);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+int mw_snap_open(mw_snap *s, const char *prefix, int rank,
+                 mw_snap_codec codec, int stride) {
+    memset(s, 0, sizeof *s);
+    s->prefix = prefix;
+    s->rank = rank;
+    s->codec = codec;
+    s->stride = stride > 1 ? stride : 1;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    if (pthread_create(&s->thread, NULL, writer_main, s) != 0) {
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->lock);
+        return -1;
+    }
+    return 0;
+}
+
+// First selected local index of [lo, hi] and the number of cells kept.
+static int select_range(int lo, int hi, int org, int stride, int *first) {
+    *first = lo + (stride - (org + lo) % stride) % stride;
+    return *first > hi ? 0 : (hi - *first) / stride + 1;
+}
+
+void mw_snap_write(mw_snap *s, const mw_grid *g, const int lo[3], const int hi[3],
+                   const int org[3], int step) {
+    const double t0 = wtime();
+
+    pthread_mutex_lock(&s->lock);
+    mw_snap_slot *sl = NULL;
+    for (;;) {
+        for (int k = 0; k < 2 && !sl; ++k)
+            if (s->slot[k].state == SLOT_FREE) sl = &s->slot[k];
+        if (sl) break;
+        pthread_cond_wait(&s->cond, &s->lock);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    // Stage the (strided) box contiguously, z fastest
+    const int st = s->stride;
+    int first[3], cnt[3];
+    for (int i = 0; i < 3; ++i) cnt[i] = select_range(lo[i], hi[i], org[i], st, &first[i]);
+    const size_t cells = (size_t)cnt[0] * cnt[1] * cnt[2];
+    if (cells > sl->cap) {
+        free(sl->data);
+        sl->data = (mw_real*)malloc(cells * sizeof(mw_real));
+        sl->cap = sl->data ? cells : 0;
+        if (!sl->data) {
+            fprintf(stderr, "ERROR: cannot stage snapshot step %d (rank %d)\n", step, s->rank);
+            pthread_mutex_lock(&s->lock);
+            s->failed++;
+            pthread_mutex_unlock(&s->lock);
+            s->stall_time += wtime() - t0;
+            return;
+        }
+    }
+    size_t k = 0;
+    for (int a = 0; a < cnt[0]; ++a) {
+        for (int b = 0; b < cnt[1]; ++b) {
+            const mw_real *row = &g->cur[MW_IDX(g, first[0] + a * st, first[1] + b * st, first[2])];
+            if (st == 1) {
+                memcpy(&sl->data[k], row, (size_t)cnt[2] * sizeof(mw_real));
+                k += (size_t)cnt[2];
+            } else {
+                for (int c = 0; c < cnt[2]; ++c) sl->data[k++] = row[(size_t)c * st];
+            }
+        }
+    }
+
+    mw_snap_header *hd = &sl->hd;
+    memset(hd, 0, sizeof *hd);
+    memcpy(hd->magic, MW_SNAP_MAGIC, sizeof hd->magic);
+    hd->step = step;
+    hd->codec = s->codec;
+    hd->stride = st;
+    hd->real_bytes = (int32_t)sizeof(mw_real);
+    for (int i = 0; i < 3; ++i) {
+        hd->start[i] = (org[i] + first[i]) / st;
+        hd->count[i] = cnt[i];
+    }
+    hd->raw_bytes = (int64_t)(cells * sizeof(mw_real));
+
+    pthread_mutex_lock(&s->lock);
+    sl->seq = s->seq++;
+    sl->state = SLOT_QUEUED;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+
+    s->stall_time += wtime() - t0;
+}
+
+void mw_snap_close(mw_snap *s) {
+    const double t0 = wtime();
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+    s->stall_time += wtime() - t0;
+
+    for (int k = 0; k < 2; ++k) free(s->slot[k].data);
+    free(s->enc);
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->lock);
+}
@@ -0,0 +1,86 @@
+// miniweather_snap.h - Asynchronous snapshot output on a writer thread
+#ifndef MINIWEATHER_SNAP_H
+#define MINIWEATHER_SNAP_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include "miniweather_core.h"
+
+// Snapshot encodings. Both are lossless; downsampling (stride) is applied
+// before encoding.
+//   raw   cells as stored (mw_real), z fastest
+//   rle   bytes of the cells split into planes (all first bytes, then all
+//         second bytes, ...) and run-length coded; sign/exponent planes of a
+//         smooth field collapse to a few runs
+typedef enum {
+    MW_SNAP_RAW,
+    MW_SNAP_RLE,
+    MW_SNAP_COUNT
+} mw_snap_codec;
+
+// One file per snapshot and rank, PREFIX_SSSSSS_rRRRR.mws: this header and
+// the encoded block. start/count describe the block in the global grid
+// (indices divided by the stride), so a reader can stitch the ranks' files.
+#define MW_SNAP_MAGIC "MWSNAP1"
+
+typedef struct {
+    char    magic[8];
+    int32_t step;
+    int32_t codec;
+    int32_t stride;
+    int32_t real_bytes;     // sizeof(mw_real) of the writer
+    int32_t start[3];       // global index / stride of the first cell
+    int32_t count[3];       // cells per direction
+    int64_t raw_bytes;      // count product * real_bytes
+    int64_t data_bytes;     // encoded bytes following the header
+} mw_snap_header;
+
+// Staging slot handed from the compute thread to the writer.
+typedef struct {
+    mw_real *data;
+    size_t cap;
+    int state;              // free, queued or being written
+    long seq;
+    mw_snap_header hd;
+} mw_snap_slot;
+
+typedef struct {
+    const char *prefix;
+    int rank;
+    mw_snap_codec codec;
+    int stride;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    mw_snap_slot slot[2];   // double buffer: one written, one waiting
+    long seq;
+    int stop;
+    unsigned char *enc;     // writer-owned encode buffer
+    size_t enc_cap;
+    int count;              // snapshots written
+    int failed;             // snapshots that could not be written
+    double bytes;           // bytes written, headers included
+    double write_time;      // writer time encoding and writing
+    double stall_time;      // compute time waiting for a slot plus staging
+} mw_snap;
+
+// Parses "raw" or "rle"; -1 if unknown.
+int mw_snap_parse(const char *name);
+const char *mw_snap_name(mw_snap_codec codec);
+
+// Starts the writer thread. stride >= 1 keeps every stride-th cell in each
+// direction (global indices divisible by stride). Returns 0 on success.
+int  mw_snap_open(mw_snap *s, const char *prefix, int rank,
+                  mw_snap_codec codec, int stride);
+
+// Copies the local box lo..hi (inclusive, local indices) of g->cur into a
+// staging slot and queues it; org is the global index of local cell 0.
+// Returns at once unless both slots are taken, i.e. the writer is more than
+// one snapshot behind. Waiting and copying are added to stall_time.
+void mw_snap_write(mw_snap *s, const mw_grid *g, const int lo[3], const int hi[3],
+                   const int org[3], int step);
+
+// Writes out what is queued (the wait counts as stall) and joins the thread.
+void mw_snap_close(mw_snap *s);
+
+#endif
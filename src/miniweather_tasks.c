@@ -0,0 +1,194 @@
+// miniweather_tasks.c - Task-graph time stepping over tiles of the local slab
+//
+// Dependencies are expressed on one-byte tokens: done[t & 1][tile] is the
+// output of a tile task (two parities suffice, since OpenMP orders a later
+// `out` after every earlier `in` on the same token), halo chains the halo
+// tasks and the boundary tiles, arrived[t] marks the end of step t's halo.
+// Without OpenMP the tasks run in creation order, which is a valid
+// schedule of the same graph.
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "miniweather_tasks.h"
+
+enum { BUSY_TILE, BUSY_HALO };
+
+static int thread_id(void) {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+int mw_tasks_create(mw_tasks *k, mw_halo *h, int tx, int ty) {
+    const mw_decomp *d = h->d;
+    memset(k, 0, sizeof *k);
+    k->h = h;
+    k->tx = tx < 1 ? 4 : (tx > d->n[0] ? d->n[0] : tx);
+    k->ty = ty < 1 || ty > d->n[1] ? d->n[1] : ty;
+    k->ntx = (d->n[0] + k->tx - 1) / k->tx;
+    k->nty = (d->n[1] + k->ty - 1) / k->ty;
+#ifdef _OPENMP
+    k->threads = omp_get_max_threads();
+#else
+    k->threads = 1;
+#endif
+    const int nt = k->ntx * k->nty;
+    k->boundary = (int*)malloc((size_t)nt * sizeof(int));
+    k->done[0] = (char*)calloc((size_t)nt, 1);
+    k->done[1] = (char*)calloc((size_t)nt, 1);
+    k->busy = (double*)calloc((size_t)k->threads * MW_TASKS_PAD, sizeof(double));
+    if (!k->boundary || !k->done[0] || !k->done[1] || !k->busy) {
+        mw_tasks_free(k);
+        return -1;
+    }
+
+    // A tile is on the boundary if its stencil reaches a ghost layer that
+    // the exchange refreshes; every tile touches both z faces
+    const int zb = d->nbr[2][0] != MPI_PROC_NULL || d->nbr[2][1] != MPI_PROC_NULL;
+    for (int i = 0; i < k->ntx; ++i) {
+        for (int j = 0; j < k->nty; ++j) {
+            k->boundary[i * k->nty + j] = zb ||
+                (i == 0 && d->nbr[0][0] != MPI_PROC_NULL) ||
+                (i == k->ntx - 1 && d->nbr[0][1] != MPI_PROC_NULL) ||
+                (j == 0 && d->nbr[1][0] != MPI_PROC_NULL) ||
+                (j == k->nty - 1 && d->nbr[1][1] != MPI_PROC_NULL);
+        }
+    }
+    return 0;
+}
+
+void mw_tasks_free(mw_tasks *k) {
+    free(k->boundary);
+    free(k->done[0]);
+    free(k->done[1]);
+    free(k->busy);
+    k->boundary = NULL;
+    k->done[0] = k->done[1] = NULL;
+    k->busy = NULL;
+}
+
+// Tile (i,j) of one step, from src into dst; runs on the calling thread.
+static void sweep_tile(mw_tasks *k, const mw_real *restrict src, mw_real *restrict dst,
+                       int i, int j) {
+    const double t0 = MPI_Wtime();
+    const mw_grid *g = k->h->g;
+    const int sy = g->sy, zs = g->zs;
+    const size_t px = (size_t)sy * zs;
+    const mw_row_fn row = mw_row_kernel;
+    const int *n = k->h->d->n;
+    const int x0 = 1 + i * k->tx, x1 = x0 + k->tx - 1 < n[0] ? x0 + k->tx - 1 : n[0];
+    const int y0 = 1 + j * k->ty, y1 = y0 + k->ty - 1 < n[1] ? y0 + k->ty - 1 : n[1];
+    for (int x = x0; x <= x1; ++x) {
+        for (int y = y0; y <= y1; ++y) {
+            row(src, dst, ((size_t)x * sy + y) * zs, px, zs, 1, g->sz - 1);
+        }
+    }
+    k->busy[thread_id() * MW_TASKS_PAD + BUSY_TILE] += MPI_Wtime() - t0;
+}
+
+// Halo begin (with cur/next pointed at the step's buffers) or end.
+static void halo_task(mw_tasks *k, mw_real *src, mw_real *dst, int begin) {
+    const double t0 = MPI_Wtime();
+    if (begin) {
+        k->h->g->cur = src;
+        k->h->g->next = dst;
+        mw_halo_begin(k->h);
+    } else {
+        mw_halo_end(k->h);
+    }
+    k->busy[thread_id() * MW_TASKS_PAD + BUSY_HALO] += MPI_Wtime() - t0;
+}
+
+void mw_tasks_run(mw_tasks *k, int steps, double *comp, double *comm) {
+    mw_grid *g = k->h->g;
+    mw_real *buf[2] = { g->cur, g->next };
+    const int ntx = k->ntx, nty = k->nty;
+
+    // arrived[steps] is never written: the "previous halo" of the first step
+    char *arrived = (char*)calloc((size_t)steps + 1, 1);
+    if (!arrived) MPI_Abort(k->h->d->cart, 2);
+    char halo = 0;
+
+    double halo0 = 0.0;
+    for (int t = 0; t < k->threads; ++t) halo0 += k->busy[t * MW_TASKS_PAD + BUSY_HALO];
+    const double t0 = MPI_Wtime();
+
+#ifdef _OPENMP
+    #pragma omp parallel
+    #pragma omp single
+#endif
+    for (int t = 0; t < steps; ++t) {
+        mw_real *src = buf[t & 1], *dst = buf[(t + 1) & 1];
+        char *prev = k->done[(t + 1) & 1], *mine = k->done[t & 1];
+        char *last = &arrived[t > 0 ? t - 1 : steps];
+        char *arr = &arrived[t];
+        (void)halo; (void)prev; (void)mine; (void)last; (void)arr;   // depend clauses only
+
+#ifdef _OPENMP
+        #pragma omp task depend(inout: halo)
+#endif
+        halo_task(k, src, dst, 1);
+
+        // Interior tiles first so they are queued while the halo is in flight
+        for (int pass = 0; pass < 2; ++pass) {
+            if (pass == 1) {
+#ifdef _OPENMP
+                #pragma omp task depend(inout: halo) depend(out: arr[0])
+#endif
+                halo_task(k, src, dst, 0);
+            }
+            for (int i = 0; i < ntx; ++i) {
+                for (int j = 0; j < nty; ++j) {
+                    const int tile = i * nty + j;
+                    if (k->boundary[tile] != pass) continue;
+                    const int xl = (i > 0 ? i - 1 : i) * nty + j;
+                    const int xu = (i < ntx - 1 ? i + 1 : i) * nty + j;
+                    const int yl = i * nty + (j > 0 ? j - 1 : j);
+                    const int yu = i * nty + (j < nty - 1 ? j + 1 : j);
+                    (void)xl; (void)xu; (void)yl; (void)yu;
+                    if (pass == 0) {
+#ifdef _OPENMP
+                        #pragma omp task depend(in: last[0], prev[tile], prev[xl], prev[xu], \
+                                                    prev[yl], prev[yu]) depend(out: mine[tile])
+#endif
+                        sweep_tile(k, src, dst, i, j);
+                    } else {
+#ifdef _OPENMP
+                        #pragma omp task depend(in: halo, last[0], prev[tile], prev[xl], \
+                                                    prev[xu], prev[yl], prev[yu]) \
+                                         depend(out: mine[tile])
+#endif
+                        sweep_tile(k, src, dst, i, j);
+                    }
+                }
+            }
+        }
+    }
+
+    const double wall = MPI_Wtime() - t0;
+    free(arrived);
+    g->cur = buf[steps & 1];
+    g->next = buf[(steps + 1) & 1];
+
+    double halo1 = 0.0;
+    for (int t = 0; t < k->threads; ++t) halo1 += k->busy[t * MW_TASKS_PAD + BUSY_HALO];
+    k->wall += wall;
+    *comm += halo1 - halo0;
+    *comp += wall - (halo1 - halo0);
+}
+
+double mw_tasks_tile_time(const mw_tasks *k, int t) {
+    return k->busy[t * MW_TASKS_PAD + BUSY_TILE];
+}
+
+double mw_tasks_halo_time(const mw_tasks *k, int t) {
+    return k->busy[t * MW_TASKS_PAD + BUSY_HALO];
+}
+
+double mw_tasks_idle_time(const mw_tasks *k, int t) {
+    return k->wall - k->busy[t * MW_TASKS_PAD + BUSY_TILE] - k->busy[t * MW_TASKS_PAD + BUSY_HALO];
+}
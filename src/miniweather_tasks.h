@@ -0,0 +1,53 @@
+// miniweather_tasks.h - Task-graph time stepping over tiles of the local slab
+#ifndef MINIWEATHER_TASKS_H
+#define MINIWEATHER_TASKS_H
+
+#include "miniweather_halo.h"
+
+// The local block is cut into tiles of tx x-planes by ty y-rows (full z
+// rows). A window of steps becomes one OpenMP task graph, built by one
+// thread and run by the whole team without barriers in between:
+//   - every step has a halo begin and a halo end task, chained in order;
+//   - a tile of step t waits for its own tile and its four x/y neighbours
+//     of step t-1 (the cells its stencil reads, and the cells of the
+//     buffer it overwrites), and for the halo end of step t-1 (nothing in
+//     a buffer may be written while it is being exchanged);
+//   - boundary tiles (those reading a ghost cell some neighbour rank
+//     refreshes) also wait for the halo end of their own step, and the
+//     next halo begin waits for them.
+// Interior tiles therefore run while the halo is in flight, and a tile of
+// step t+1 starts as soon as its neighbours of step t are done. Results
+// are bit-identical to mw_halo_exchange + mw_step. Halo tasks call MPI from
+// whichever thread runs them, one at a time: MPI_THREAD_SERIALIZED.
+typedef struct {
+    mw_halo *h;
+    int tx, ty;                 // tile extent in x-planes and y-rows
+    int ntx, nty;               // tiles per direction
+    int *boundary;              // ntx*nty flags
+    char *done[2];              // dependency tokens of the tiles, by step parity
+    int threads;
+    double *busy;               // threads x MW_TASKS_PAD: tile, halo seconds
+    double wall;                // seconds inside mw_tasks_run
+} mw_tasks;
+
+#define MW_TASKS_PAD 8          // doubles per thread (one cache line)
+
+// Tiles h's grid (tx < 1: 4 planes, ty < 1: all rows; both clamped to the
+// block). Call outside a parallel region; the team size is the current
+// omp_get_max_threads(). Returns -1 if allocation fails.
+int  mw_tasks_create(mw_tasks *k, mw_halo *h, int tx, int ty);
+void mw_tasks_free(mw_tasks *k);
+
+// Runs `steps` time steps as one task graph; g->cur/next end as after as
+// many mw_step calls. Halo task time is added to *comm, the rest of the
+// window to *comp.
+void mw_tasks_run(mw_tasks *k, int steps, double *comp, double *comm);
+
+// Time of thread t in seconds: running tiles, running halo tasks, and
+// neither (waiting for dependencies or building the graph) while inside
+// mw_tasks_run.
+double mw_tasks_tile_time(const mw_tasks *k, int t);
+double mw_tasks_halo_time(const mw_tasks *k, int t);
+double mw_tasks_idle_time(const mw_tasks *k, int t);
+
+#endif
@@ -0,0 +1,195 @@
+// miniweather_tiling.c - Cache-blocked variants of the stencil sweep
+#include <stdio.h>
+#include <time.h>
+#include "miniweather_core.h"
+
+static double wtime(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int mw_tblock_auto_tile(const mw_grid *g, int depth) {
+    // A tile touches tile + depth planes of both buffers.
+    const size_t plane_bytes = mw_plane_elems(g) * sizeof(mw_real);
+    int planes = (int)(MW_TBLOCK_CACHE_BYTES / (2 * plane_bytes));
+    int tile = planes - depth;
+    return tile < 1 ? 1 : tile;
+}
+
+double mw_bytes_per_update(int depth) {
+    if (depth < 1) depth = 1;
+    return 2.0 * sizeof(mw_real) / depth;
+}
+
+double mw_flops_per_update(void) {
+    return 6.0;
+}
+
+// One stage of a skewed tile: level s -> s+1 for planes x0..x1.
+static void tblock_stage(const mw_real *restrict g, mw_real *restrict ng,
+                         int x0, int x1, int sy, int sz, int zs) {
+    const size_t px = (size_t)sy * zs;
+    const mw_row_fn row = mw_row_kernel;
+
+#ifdef _OPENMP
+    #pragma omp for collapse(2) schedule(static)
+#endif
+    for (int x = x0; x <= x1; ++x) {
+        for (int y = 1; y < sy - 1; ++y) {
+            row(g, ng, ((size_t)x * sy + y) * zs, px, zs, 1, sz - 1);
+        }
+    }
+}
+
+// Level s lives in buf[s % 2]. Stage s of the tile starting at plane a covers
+// [a - s, a + tile - 1 - s]: everything it reads at level s was produced by
+// this tile or the one to its left, and the level s - 1 planes it overwrites
+// are no longer needed by the tile to its right.
+void mw_step_tblock(mw_grid *g, int x_lo, int x_hi, int nsteps, int depth, int tile) {
+    if (depth < 1) depth = 1;
+    if (tile < 1) tile = mw_tblock_auto_tile(g, depth);
+    const int sy = g->sy, sz = g->sz, zs = g->zs;
+
+    for (int t = 0; t < nsteps; t += depth) {
+        const int d = (nsteps - t < depth) ? nsteps - t : depth;
+        mw_real *buf[2] = { g->cur, g->next };
+
+#ifdef _OPENMP
+        #pragma omp parallel
+#endif
+        for (int a = x_lo; a <= x_hi + d - 1; a += tile) {
+            for (int s = 0; s < d; ++s) {
+                int x0 = a - s;
+                int x1 = a + tile - 1 - s;
+                if (x0 < x_lo) x0 = x_lo;
+                if (x1 > x_hi) x1 = x_hi;
+                if (x0 <= x1)
+                    tblock_stage(buf[s & 1], buf[(s + 1) & 1], x0, x1, sy, sz, zs);
+            }
+        }
+
+        if (d & 1) mw_grid_swap(g);
+    }
+}
+
+void mw_stencil_planes_tiled(mw_grid *grid, int x_lo, int x_hi, int ty, int tz) {
+    const mw_real *restrict g = grid->cur;
+    mw_real *restrict ng = grid->next;
+    const int sy = grid->sy, sz = grid->sz, zs = grid->zs;
+    const size_t px = (size_t)sy * zs;
+    const mw_row_fn row = mw_row_kernel;
+    const int ny_in = sy - 2, nz_in = sz - 2;
+
+    if (ty <= 0 && tz <= 0) {
+        mw_stencil_planes(grid, x_lo, x_hi);
+        return;
+    }
+    if (ty <= 0 || ty > ny_in) ty = ny_in;
+    if (tz <= 0 || tz > nz_in) tz = nz_in;
+    const int nty = (ny_in + ty - 1) / ty;
+    const int ntz = (nz_in + tz - 1) / tz;
+
+#ifdef _OPENMP
+    #pragma omp parallel for collapse(2) schedule(static)
+#endif
+    for (int by = 0; by < nty; ++by) {
+        for (int bz = 0; bz < ntz; ++bz) {
+            const int y0 = 1 + by * ty, z0 = 1 + bz * tz;
+            const int y1 = (y0 + ty < sy - 1) ? y0 + ty : sy - 1;
+            const int z1 = (z0 + tz < sz - 1) ? z0 + tz : sz - 1;
+            for (int x = x_lo; x <= x_hi; ++x) {
+                for (int y = y0; y < y1; ++y) {
+                    row(g, ng, ((size_t)x * sy + y) * zs, px, zs, z0, z1);
+                }
+            }
+        }
+    }
+}
+
+void mw_step_tiled(mw_grid *g, int x_lo, int x_hi, int ty, int tz) {
+    // Untiled is the plain step, which also covers in-place grids
+    if (ty <= 0 && tz <= 0) {
+        mw_step(g, x_lo, x_hi);
+        return;
+    }
+    mw_stencil_planes_tiled(g, x_lo, x_hi, ty, tz);
+    mw_grid_swap(g);
+}
+
+// Cache file: one "nx ny nz threads ty tz" line per entry, '#' comments.
+// Later lines win, so a re-tune simply appends.
+static int tiles_lookup(const char *path, int nx, int ny, int nz, int threads,
+                        int *ty, int *tz) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+
+    char line[256];
+    int found = 0;
+    while (fgets(line, sizeof line, f)) {
+        int k[6];
+        if (line[0] == '#') continue;
+        if (sscanf(line, "%d %d %d %d %d %d", &k[0], &k[1], &k[2], &k[3], &k[4], &k[5]) != 6)
+            continue;
+        if (k[0] == nx && k[1] == ny && k[2] == nz && k[3] == threads) {
+            *ty = k[4];
+            *tz = k[5];
+            found = 1;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+static void tiles_store(const char *path, int nx, int ny, int nz, int threads,
+                        int ty, int tz) {
+    FILE *f = fopen(path, "a");
+    if (!f) {
+        fprintf(stderr, "WARNING: cannot write tile cache %s\n", path);
+        return;
+    }
+    if (ftell(f) == 0) fprintf(f, "# nx ny nz threads tile_y tile_z\n");
+    fprintf(f, "%d %d %d %d %d %d\n", nx, ny, nz, threads, ty, tz);
+    fclose(f);
+}
+
+int mw_autotune_tiles(mw_grid *g, int x_lo, int x_hi, const char *path,
+                      int nx, int ny, int nz, int threads, int force,
+                      int *ty, int *tz) {
+    if (!force && tiles_lookup(path, nx, ny, nz, threads, ty, tz)) return 1;
+
+    static const int ty_cand[] = { 2, 4, 8, 16, 32, 64, 0 };
+    static const int tz_cand[] = { 0, 256, 128, 64 };
+    const int ny_in = g->sy - 2, nz_in = g->sz - 2;
+    double best = -1.0;
+
+    for (size_t i = 0; i < sizeof ty_cand / sizeof ty_cand[0]; ++i) {
+        for (size_t j = 0; j < sizeof tz_cand / sizeof tz_cand[0]; ++j) {
+            const int cy = ty_cand[i], cz = tz_cand[j];
+            if (cy >= ny_in || cz >= nz_in) continue;
+
+            // Every thread needs a tile of its own (0x0 is the plain sweep).
+            const int ey = cy ? cy : ny_in, ez = cz ? cz : nz_in;
+            const int tiles = ((ny_in + ey - 1) / ey) * ((nz_in + ez - 1) / ez);
+            if (tiles < threads && (cy || cz)) continue;
+
+            // One warm-up sweep, then best of two; only next is written.
+            mw_stencil_planes_tiled(g, x_lo, x_hi, cy, cz);
+            double t = -1.0;
+            for (int r = 0; r < 2; ++r) {
+                double t0 = wtime();
+                mw_stencil_planes_tiled(g, x_lo, x_hi, cy, cz);
+                double dt = wtime() - t0;
+                if (t < 0.0 || dt < t) t = dt;
+            }
+            if (best < 0.0 || t < best) {
+                best = t;
+                *ty = cy;
+                *tz = cz;
+            }
+        }
+    }
+
+    tiles_store(path, nx, ny, nz, threads, *ty, *tz);
+    return 0;
+}